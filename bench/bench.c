@@ -0,0 +1,700 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmarks for the lexer, compiler and both VMs, and for whole lines
+// going through all of them
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "box.h"
+#include "common.h"
+#include "compiler.h"
+#include "corpus.h"
+#include "cost.h"
+#include "lexer.h"
+#include "memory.h"
+#include "output.h"
+#include "passes.h"
+#include "regbox.h"
+#include "regvm.h"
+#include "value.h"
+#include "vm.h"
+
+#define BENCH_MAX_RESULTS 96
+#define BENCH_DEFAULT_COUNT 2000
+#define BENCH_DEFAULT_MIN_TIME 0.2
+#define BENCH_DEFAULT_THRESHOLD 5.0
+#define BENCH_SEED 42
+
+typedef struct {
+    char name[64];
+    double ns_per_op;
+    double ops_per_s;
+    double bytes_per_s;
+    double instructions_per_op; // in the code run, when it is known
+    double cost_per_op; // estimated statically, when it is
+} Bench_result;
+
+typedef struct {
+    const char *filter;
+    const char *json_path;
+    const char *baseline_path;
+    bool levels; // compare optimization levels instead
+    int count;
+    double min_time;
+    double threshold;
+} Options;
+
+typedef struct {
+    Options opt;
+    Bench_result results[BENCH_MAX_RESULTS];
+    int count;
+} Bench;
+
+// A benchmark does one pass over a corpus and reports how many
+// operations and bytes that pass amounted to
+typedef void (*Bench_fn)(void *state, const Corpus *corpus, long *ops, size_t *bytes);
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Repeats passes until at least min_time has gone by, after one to warm
+// up caches and the branch predictor. Returns how long they took.
+static double measure(const Bench *b, const Corpus *corpus, Bench_fn fn, void *state,
+        long *ops, size_t *bytes) {
+    fn(state, corpus, ops, bytes);
+    *ops = 0;
+    *bytes = 0;
+    double start = now_s(), elapsed;
+    do {
+        fn(state, corpus, ops, bytes);
+        elapsed = now_s() - start;
+    } while(elapsed < b->opt.min_time);
+    return elapsed;
+}
+
+// Times a benchmark with measure(). Returns the result, unless the
+// benchmark was left out.
+static Bench_result *run(Bench *b, const char *phase, const Corpus *corpus, Bench_fn fn, void *state) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s", phase, corpus_shape_name(corpus->shape));
+    if(b->opt.filter != NULL && strstr(name, b->opt.filter) == NULL)
+        return NULL;
+    if(b->count == BENCH_MAX_RESULTS)
+        return NULL;
+
+    long ops;
+    size_t bytes;
+    double elapsed = measure(b, corpus, fn, state, &ops, &bytes);
+    Bench_result *res = &b->results[b->count++];
+    strcpy(res->name, name);
+    res->ns_per_op = elapsed * 1e9 / ops;
+    res->ops_per_s = ops / elapsed;
+    res->bytes_per_s = bytes / elapsed;
+    res->instructions_per_op = 0;
+    res->cost_per_op = 0;
+    printf("%-24s %12.1f ns/op %14.0f ops/s %10.1f MB/s\n", res->name,
+            res->ns_per_op, res->ops_per_s, res->bytes_per_s / 1e6);
+    return res;
+}
+
+static void report_instructions(Bench_result *res, long instructions, int ops) {
+    if(res == NULL || ops == 0)
+        return;
+    res->instructions_per_op = (double) instructions / ops;
+    printf("%-24s %12.1f instructions/op\n", "", res->instructions_per_op);
+}
+
+// How the static cost estimates (see cost.h) compare with the time
+// taken, which should come to about as many nanoseconds per unit for
+// every shape of corpus
+static void report_cost(Bench_result *res, double cost, int ops) {
+    if(res == NULL || ops == 0 || cost <= 0)
+        return;
+    res->cost_per_op = cost / ops;
+    printf("%-24s %12.1f cost/op %13.2f ns/cost\n", "", res->cost_per_op,
+            res->ns_per_op / res->cost_per_op);
+}
+
+// Benchmarks
+
+static void bench_lexer(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    (void) state;
+    for(int i = 0; i < corpus->count; ++i) {
+        Lexer lex;
+        lexer_init(&lex, corpus->text + corpus->lines[i], corpus->lengths[i]);
+        Token tok;
+        do {
+            tok = lexer_get_token(&lex);
+            ++*ops;
+        } while(tok.type != TOKEN_END);
+        *bytes += corpus->lengths[i];
+    }
+}
+
+// Into token buffers, as the compiler lexes
+static void bench_tokenize(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    Cog_arena *arena = state;
+    for(int i = 0; i < corpus->count; ++i) {
+        cog_arena_reset(arena);
+        Token_buffer buf;
+        lexer_tokenize(&buf, corpus->text + corpus->lines[i], corpus->lengths[i], arena);
+        *ops += buf.count;
+        *bytes += corpus->lengths[i];
+    }
+}
+
+// The same, over the whole corpus as one large source
+static void bench_lexer_large(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    (void) state;
+    Lexer lex;
+    lexer_init(&lex, corpus->text, corpus->size);
+    Token tok;
+    do {
+        tok = lexer_get_token(&lex);
+        ++*ops;
+    } while(tok.type != TOKEN_END);
+    *bytes += corpus->size;
+}
+
+static void bench_tokenize_large(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    Cog_arena *arena = state;
+    cog_arena_reset(arena);
+    Token_buffer buf;
+    lexer_tokenize(&buf, corpus->text, corpus->size, arena);
+    *ops += buf.count;
+    *bytes += corpus->size;
+}
+
+// The same again, fed to a stream in pieces the size of a pipe's buffer
+#define BENCH_PIECE_SIZE 4096
+
+static void bench_tokenize_stream(void *state, const Corpus *corpus, long *ops,
+        size_t *bytes) {
+    Cog_arena *arena = state;
+    cog_arena_reset(arena);
+    Token_buffer buf;
+    Lexer_stream ls;
+    lexer_stream_init(&ls, &buf, arena);
+    for(size_t offset = 0; offset < corpus->size; offset += BENCH_PIECE_SIZE) {
+        size_t length = corpus->size - offset;
+        lexer_stream_feed(&ls, corpus->text + offset,
+                length < BENCH_PIECE_SIZE ? length : BENCH_PIECE_SIZE);
+    }
+    lexer_stream_finish(&ls);
+    *ops += buf.count;
+    *bytes += corpus->size;
+}
+
+// What the tokens of the whole corpus take up, as an array of Token and
+// in a token buffer, unless the report was left out
+static void report_token_memory(const Bench *b, const Corpus *corpus, Cog_arena *arena) {
+    char name[64];
+    snprintf(name, sizeof(name), "memory/%s", corpus_shape_name(corpus->shape));
+    if(b->opt.filter != NULL && strstr(name, b->opt.filter) == NULL)
+        return;
+    cog_arena_reset(arena);
+    Token_buffer buf;
+    lexer_tokenize(&buf, corpus->text, corpus->size, arena);
+    size_t as_tokens = buf.count * sizeof(Token);
+    size_t in_buffer = buf.count * (sizeof(*buf.types) + sizeof(*buf.starts)
+            + sizeof(*buf.lengths));
+    printf("%-24s %12u tokens %11.1f KB as tokens %8.1f KB buffered\n", name,
+            buf.count, as_tokens / 1e3, in_buffer / 1e3);
+}
+
+static void bench_compile(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    Box *box = state;
+    for(int i = 0; i < corpus->count; ++i) {
+        box_reset(box);
+        compile(corpus->text + corpus->lines[i], corpus->lengths[i], box);
+        *bytes += corpus->lengths[i];
+    }
+    *ops += corpus->count;
+}
+
+// Runs the boxes compiled from the corpus, or from those of its
+// expressions that made it into them
+typedef struct {
+    Cog_env env;
+    Box *boxes;
+    int count;
+} Execute_state;
+
+static void bench_execute(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    (void) corpus;
+    Execute_state *st = state;
+    for(int i = 0; i < st->count; ++i) {
+        execute(&st->env, &st->boxes[i]);
+        *bytes += st->boxes[i].count;
+    }
+    *ops += st->count;
+}
+
+// The same on the register machine
+typedef struct {
+    Cog_env env;
+    Reg_box *boxes;
+    int count;
+} Registers_state;
+
+static void bench_registers(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    (void) corpus;
+    Registers_state *st = state;
+    for(int i = 0; i < st->count; ++i) {
+        reg_execute(&st->env, &st->boxes[i]);
+        *bytes += st->boxes[i].count * sizeof(Reg_instr);
+    }
+    *ops += st->count;
+}
+
+// The operands of vectors that follow them are not instructions
+static long reg_instructions(const Reg_box *rbox) {
+    long count = 0;
+    for(unsigned i = 0; i < rbox->count; ++i, ++count) {
+        if(rbox->code[i].op == OP_VECTOR)
+            i += (REG_WIDE(rbox->code[i]) + 1) / 2;
+    }
+    return count;
+}
+
+// Evaluates the assignments of corpus_globals() in env
+static void define_globals(Cog_env *env) {
+    Box box;
+    box_init(&box);
+    for(const char *line = corpus_globals(); *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        box_reset(&box);
+        if(compile(line, end - line, &box))
+            execute(env, &box);
+        line = end + 1;
+    }
+    box_free(&box);
+}
+
+// The stack and register machines on the same expressions: those of a
+// corpus with variables that the register machine takes, which the
+// compiler can't fold to constants for either
+static void bench_machines(Bench *b, const Corpus *corpus) {
+    Execute_state stack;
+    Registers_state regs;
+    cog_env_init(&stack.env);
+    cog_env_init(&regs.env);
+    define_globals(&stack.env);
+    define_globals(&regs.env);
+    stack.boxes = cog_realloc(NULL, 0, corpus->count * sizeof(Box));
+    regs.boxes = cog_realloc(NULL, 0, corpus->count * sizeof(Reg_box));
+    regs.count = 0;
+    long stack_instructions = 0, register_instructions = 0;
+    for(int i = 0; i < corpus->count; ++i) {
+        const char *source = corpus->text + corpus->lines[i];
+        Reg_box *rbox = &regs.boxes[regs.count];
+        reg_box_init(rbox);
+        if(!compile_registers(source, corpus->lengths[i], rbox)) {
+            reg_box_free(rbox);
+            continue;
+        }
+        register_instructions += reg_instructions(rbox);
+        Box *box = &stack.boxes[regs.count++];
+        box_init(box);
+        compile(source, corpus->lengths[i], box);
+        for(unsigned j = 0; j < box->block_count; ++j)
+            stack_instructions += box->blocks[j].cost;
+    }
+    stack.count = regs.count;
+    report_instructions(run(b, "stack", corpus, bench_execute, &stack),
+            stack_instructions, stack.count);
+    report_instructions(run(b, "registers", corpus, bench_registers, &regs),
+            register_instructions, regs.count);
+    for(int i = 0; i < regs.count; ++i) {
+        box_free(&stack.boxes[i]);
+        reg_box_free(&regs.boxes[i]);
+    }
+    free(stack.boxes);
+    free(regs.boxes);
+    cog_env_free(&stack.env);
+    cog_env_free(&regs.env);
+}
+
+typedef struct {
+    Cog_env env;
+    Box box;
+    Cog_output out;
+} Line_state;
+
+static void bench_line(void *state, const Corpus *corpus, long *ops, size_t *bytes) {
+    Line_state *st = state;
+    st->out.count = 0;
+    for(int i = 0; i < corpus->count; ++i) {
+        batch_eval_line(&st->env, &st->box, corpus->text + corpus->lines[i],
+                corpus->lengths[i], &st->out, NULL);
+        *bytes += corpus->lengths[i] + 1;
+    }
+    *ops += corpus->count;
+}
+
+static void bench_corpus(Bench *b, const Corpus *corpus) {
+    run(b, "lexer", corpus, bench_lexer, NULL);
+    Cog_arena arena;
+    cog_arena_init(&arena);
+    run(b, "tokenize", corpus, bench_tokenize, &arena);
+    run(b, "lexer-large", corpus, bench_lexer_large, NULL);
+    run(b, "tokenize-large", corpus, bench_tokenize_large, &arena);
+    run(b, "tokenize-stream", corpus, bench_tokenize_stream, &arena);
+    report_token_memory(b, corpus, &arena);
+    cog_arena_free(&arena);
+
+    Box box;
+    box_init(&box);
+    run(b, "compile", corpus, bench_compile, &box);
+    box_free(&box);
+
+    // Instructions are counted in the code, as blocks count them
+    Execute_state ex;
+    cog_env_init(&ex.env);
+    ex.boxes = cog_realloc(NULL, 0, corpus->count * sizeof(Box));
+    ex.count = corpus->count;
+    long instructions = 0;
+    double cost = 0;
+    for(int i = 0; i < corpus->count; ++i) {
+        box_init(&ex.boxes[i]);
+        compile(corpus->text + corpus->lines[i], corpus->lengths[i], &ex.boxes[i]);
+        for(unsigned j = 0; j < ex.boxes[i].block_count; ++j)
+            instructions += ex.boxes[i].blocks[j].cost;
+        Cost_estimate est;
+        cost_estimate(&ex.boxes[i], &est);
+        cost += est.cost;
+    }
+    Bench_result *res = run(b, "execute", corpus, bench_execute, &ex);
+    report_instructions(res, instructions, corpus->count);
+    report_cost(res, cost, corpus->count);
+    for(int i = 0; i < corpus->count; ++i)
+        box_free(&ex.boxes[i]);
+    free(ex.boxes);
+    cog_env_free(&ex.env);
+
+    Line_state line;
+    cog_env_init(&line.env);
+    box_init(&line.box);
+    cog_output_init(&line.out, NULL, COG_OUTPUT_CAPACITY);
+    run(b, "line", corpus, bench_line, &line);
+    cog_output_free(&line.out);
+    box_free(&line.box);
+    cog_env_free(&line.env);
+}
+
+// Comparing optimization levels
+
+#define BENCH_LEVELS (PASSES_MAX_LEVEL + 1)
+// Times the corpus at each level this many times, taking turns, and
+// keeps the fastest, as the one least disturbed by anything else
+#define BENCH_LEVEL_ROUNDS 5
+
+// Whether a and b print the same, which unlike cog_values_equal holds
+// for NaN too
+static bool same_value(Cog_value a, Cog_value b) {
+    char *a_text = cog_realloc(NULL, 0, cog_value_format_size(a));
+    char *b_text = cog_realloc(NULL, 0, cog_value_format_size(b));
+    size_t a_length = cog_value_format(a, a_text);
+    size_t b_length = cog_value_format(b, b_text);
+    bool same = a_length == b_length && memcmp(a_text, b_text, a_length) == 0;
+    free(a_text);
+    free(b_text);
+    return same;
+}
+
+// Whether two executions both failed the same way, or both gave results
+// that print the same
+static bool same_outcome(Cog_result a, const Cog_env *a_env, Cog_result b,
+        const Cog_env *b_env) {
+    return a == b && (a != RES_OK || same_value(a_env->ret, b_env->ret));
+}
+
+// Lines that gave something else at some level than at -O0, which the
+// generated corpora don't cover
+static const char *level_cases[] = {
+    "([1, 2] == [1, 2, 3]) * 1",
+    "([1, 2] == true) - 0",
+};
+
+// Runs each of level_cases compiled at every level, checking that they
+// all give what they give at -O0. Returns how many don't.
+static int check_level_cases(const Bench *b) {
+    const char *prefix = "levels/cases";
+    if(b->opt.filter != NULL && strstr(prefix, b->opt.filter) == NULL)
+        return 0;
+    Cog_env env[BENCH_LEVELS];
+    Box box[BENCH_LEVELS];
+    Cog_result res[BENCH_LEVELS];
+    for(int level = 0; level < BENCH_LEVELS; ++level) {
+        cog_env_init(&env[level]);
+        box_init(&box[level]);
+    }
+    int failures = 0;
+    int count = (int) (sizeof(level_cases) / sizeof(level_cases[0]));
+    for(int i = 0; i < count; ++i) {
+        for(int level = 0; level < BENCH_LEVELS; ++level) {
+            compile_set_level(level);
+            box_reset(&box[level]);
+            compile(level_cases[i], strlen(level_cases[i]), &box[level]);
+            res[level] = execute(&env[level], &box[level]);
+            if(level == 0 || same_outcome(res[level], &env[level], res[0], &env[0]))
+                continue;
+            eprintf("(!) %s: line %d gives something else at -O%d: %s\n",
+                    prefix, i + 1, level, level_cases[i]);
+            ++failures;
+        }
+    }
+    printf("%-24s %12d lines %12d differ\n", prefix, count, failures);
+    for(int level = 0; level < BENCH_LEVELS; ++level) {
+        box_free(&box[level]);
+        cog_env_free(&env[level]);
+    }
+    return failures;
+}
+
+// Runs every expression of a corpus with variables compiled at every
+// level, checking that they all give what they give at -O0, and that
+// no level is slower than -O0 by more than the threshold. Returns how
+// many of those checks failed.
+static int compare_levels(Bench *b, const Corpus *corpus) {
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "levels/%s", corpus_shape_name(corpus->shape));
+    if(b->opt.filter != NULL && strstr(prefix, b->opt.filter) == NULL)
+        return 0;
+
+    Execute_state ex[BENCH_LEVELS];
+    for(int level = 0; level < BENCH_LEVELS; ++level) {
+        compile_set_level(level);
+        cog_env_init(&ex[level].env);
+        define_globals(&ex[level].env);
+        ex[level].boxes = cog_realloc(NULL, 0, corpus->count * sizeof(Box));
+        ex[level].count = corpus->count;
+        for(int i = 0; i < corpus->count; ++i) {
+            box_init(&ex[level].boxes[i]);
+            compile(corpus->text + corpus->lines[i], corpus->lengths[i],
+                    &ex[level].boxes[i]);
+        }
+    }
+
+    int failures = 0;
+    for(int i = 0; i < corpus->count; ++i) {
+        Cog_result expected = execute(&ex[0].env, &ex[0].boxes[i]);
+        for(int level = 1; level < BENCH_LEVELS; ++level) {
+            Cog_result res = execute(&ex[level].env, &ex[level].boxes[i]);
+            if(same_outcome(res, &ex[level].env, expected, &ex[0].env))
+                continue;
+            eprintf("(!) %s: line %d gives something else at -O%d: %.*s\n",
+                    prefix, i + 1, level, (int) corpus->lengths[i],
+                    corpus->text + corpus->lines[i]);
+            ++failures;
+        }
+    }
+
+    double best[BENCH_LEVELS];
+    for(int round = 0; round < BENCH_LEVEL_ROUNDS; ++round) {
+        for(int level = 0; level < BENCH_LEVELS; ++level) {
+            long ops;
+            size_t bytes;
+            double ns_per_op = measure(b, corpus, bench_execute, &ex[level], &ops, &bytes)
+                * 1e9 / ops;
+            if(round == 0 || ns_per_op < best[level])
+                best[level] = ns_per_op;
+        }
+    }
+    for(int level = 0; level < BENCH_LEVELS; ++level) {
+        double change = (best[level] / best[0] - 1.0) * 100.0;
+        bool slower = change > b->opt.threshold;
+        failures += slower;
+        char name[64];
+        snprintf(name, sizeof(name), "%s/O%d", prefix, level);
+        printf("%-24s %12.1f ns/op %+8.1f%%%s\n", name, best[level], change,
+                slower ? "  SLOWER THAN -O0" : "");
+        if(b->count < BENCH_MAX_RESULTS) {
+            Bench_result *res = &b->results[b->count++];
+            memset(res, 0, sizeof(*res));
+            strcpy(res->name, name);
+            res->ns_per_op = best[level];
+            res->ops_per_s = 1e9 / best[level];
+        }
+    }
+
+    for(int level = 0; level < BENCH_LEVELS; ++level) {
+        for(int i = 0; i < corpus->count; ++i)
+            box_free(&ex[level].boxes[i]);
+        free(ex[level].boxes);
+        cog_env_free(&ex[level].env);
+    }
+    return failures;
+}
+
+// Saving and comparing results
+
+static bool save_json(const Bench *b, const char *path) {
+    FILE *file = fopen(path, "w");
+    if(file == NULL) {
+        eprintf("(!) Could not write %s\n", path);
+        return false;
+    }
+    fprintf(file, "{\n  \"benchmarks\": [\n");
+    for(int i = 0; i < b->count; ++i) {
+        const Bench_result *res = &b->results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_s\": %.1f,"
+                " \"bytes_per_s\": %.1f", res->name, res->ns_per_op,
+                res->ops_per_s, res->bytes_per_s);
+        if(res->instructions_per_op > 0)
+            fprintf(file, ", \"instructions_per_op\": %.1f", res->instructions_per_op);
+        if(res->cost_per_op > 0)
+            fprintf(file, ", \"cost_per_op\": %.1f", res->cost_per_op);
+        fprintf(file, " }%s\n", i + 1 < b->count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+// Reads back the name and ns_per_op of every benchmark in a file
+// written by save_json. Returns how many were found, or -1.
+static int load_json(const char *path, Bench_result *results, int max) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        eprintf("(!) Could not read %s\n", path);
+        return -1;
+    }
+    int count = 0;
+    char line[512];
+    while(count < max && fgets(line, sizeof(line), file) != NULL) {
+        const char *name = strstr(line, "\"name\": \"");
+        const char *ns = strstr(line, "\"ns_per_op\": ");
+        if(name == NULL || ns == NULL)
+            continue;
+        name += strlen("\"name\": \"");
+        const char *name_end = strchr(name, '"');
+        if(name_end == NULL || name_end - name >= 64)
+            continue;
+        Bench_result *res = &results[count++];
+        memset(res, 0, sizeof(*res));
+        memcpy(res->name, name, name_end - name);
+        res->ns_per_op = strtod(ns + strlen("\"ns_per_op\": "), NULL);
+    }
+    fclose(file);
+    return count;
+}
+
+// Reports the change of every benchmark against the baseline. Returns
+// the number of benchmarks that got slower by more than the threshold.
+static int compare(const Bench *b, const char *path) {
+    Bench_result baseline[BENCH_MAX_RESULTS];
+    int count = load_json(path, baseline, BENCH_MAX_RESULTS);
+    if(count < 0)
+        return -1;
+    int regressions = 0;
+    printf("\n%-24s %12s %12s %9s\n", "compared to baseline", "before", "after", "change");
+    for(int i = 0; i < b->count; ++i) {
+        const Bench_result *now = &b->results[i];
+        for(int j = 0; j < count; ++j) {
+            if(strcmp(baseline[j].name, now->name) != 0)
+                continue;
+            double change = (now->ns_per_op / baseline[j].ns_per_op - 1.0) * 100.0;
+            bool regressed = change > b->opt.threshold;
+            regressions += regressed;
+            printf("%-24s %9.1f ns %9.1f ns %+8.1f%%%s\n", now->name,
+                    baseline[j].ns_per_op, now->ns_per_op, change,
+                    regressed ? "  REGRESSION" : "");
+            break;
+        }
+    }
+    return regressions;
+}
+
+static void usage(const char *name) {
+    eprintf("usage: %s [--filter TEXT] [--count N] [--min-time SECONDS]\n"
+            "       [--json FILE] [--baseline FILE] [--threshold PERCENT]\n"
+            "       [--level N | --compare-levels]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    Bench b;
+    b.count = 0;
+    b.opt = (Options) { NULL, NULL, NULL, false, BENCH_DEFAULT_COUNT,
+        BENCH_DEFAULT_MIN_TIME, BENCH_DEFAULT_THRESHOLD };
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            b.opt.filter = argv[++i];
+        else if(strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            b.opt.count = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            b.opt.min_time = atof(argv[++i]);
+        else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            b.opt.json_path = argv[++i];
+        else if(strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            b.opt.baseline_path = argv[++i];
+        else if(strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            b.opt.threshold = atof(argv[++i]);
+        else if(strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+            compile_set_level(atoi(argv[++i]));
+        else if(strcmp(argv[i], "--compare-levels") == 0)
+            b.opt.levels = true;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(b.opt.count <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int failures = b.opt.levels ? check_level_cases(&b) : 0;
+    for(int shape = 0; shape < SHAPE_COUNT; ++shape) {
+        Corpus corpus;
+        corpus_generate(&corpus, (Shape) shape, b.opt.count, BENCH_SEED, b.opt.levels);
+        if(b.opt.levels) {
+            failures += compare_levels(&b, &corpus);
+        } else {
+            bench_corpus(&b, &corpus);
+            corpus_free(&corpus);
+            corpus_generate(&corpus, (Shape) shape, b.opt.count, BENCH_SEED, true);
+            bench_machines(&b, &corpus);
+        }
+        corpus_free(&corpus);
+    }
+    if(failures != 0)
+        return 1;
+
+    if(b.opt.json_path != NULL && !save_json(&b, b.opt.json_path))
+        return 1;
+    if(b.opt.baseline_path != NULL) {
+        int regressions = compare(&b, b.opt.baseline_path);
+        if(regressions != 0)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "corpus.h"
+#include "memory.h"
+
+typedef struct {
+    Corpus *corpus;
+    uint64_t state;
+} Generator;
+
+// xorshift64*, which is plenty for picking shapes of expressions
+static uint64_t next_random(Generator *gen) {
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return gen->state * 2685821657736338717ull;
+}
+
+static int random_below(Generator *gen, int n) {
+    return (int) (next_random(gen) % (uint64_t) n);
+}
+
+static void emit(Generator *gen, const char *text) {
+    Corpus *c = gen->corpus;
+    size_t length = strlen(text);
+    if(c->size + length + 1 > c->capacity) {
+        size_t new_capacity = c->capacity * 2;
+        while(new_capacity < c->size + length + 1)
+            new_capacity *= 2;
+        c->text = cog_realloc(c->text, c->capacity, new_capacity);
+        c->capacity = new_capacity;
+    }
+    memcpy(c->text + c->size, text, length);
+    c->size += length;
+}
+
+// What corpora with variables read instead of numbers and words, and
+// what corpus_globals() sets them to; no number is 0, which would make
+// divisions fail
+static const char *variables[] = { "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7" };
+static const char *words_variables[] = { "w0", "w1", "w2", "w3" };
+static const char globals[] =
+    "x0 = 3\nx1 = 17\nx2 = 250\nx3 = 4096\n"
+    "x4 = 0.5\nx5 = 2.25\nx6 = 99.99\nx7 = 12345\n"
+    "w0 = \"open\"\nw1 = \"US\"\nw2 = \"payment_declined\"\n"
+    "w3 = \"customer_support\"\n";
+
+static void emit_number(Generator *gen) {
+    if(gen->corpus->variables && random_below(gen, 2)) {
+        emit(gen, variables[random_below(gen, sizeof(variables) / sizeof(variables[0]))]);
+        return;
+    }
+    char text[32];
+    if(random_below(gen, 3) == 0)
+        snprintf(text, sizeof(text), "%d.%02d", random_below(gen, 1000), random_below(gen, 100));
+    else
+        snprintf(text, sizeof(text), "%d", random_below(gen, 100000));
+    emit(gen, text);
+}
+
+static const char *arith_ops[] = { " + ", " - ", " * ", " / " };
+static const char *compare_ops[] = { " < ", " > ", " <= ", " >= ", " == ", " != " };
+
+static void literal_expr(Generator *gen) {
+    // a handful of terms, each a product of literals
+    int terms = 2 + random_below(gen, 4);
+    for(int i = 0; i < terms; ++i) {
+        if(i > 0) emit(gen, " + ");
+        emit_number(gen);
+        if(random_below(gen, 2)) {
+            emit(gen, " * ");
+            emit_number(gen);
+        }
+    }
+}
+
+static void nested_expr(Generator *gen, int depth) {
+    if(depth == 0) {
+        emit_number(gen);
+        return;
+    }
+    emit(gen, "(");
+    nested_expr(gen, depth - 1);
+    emit(gen, arith_ops[random_below(gen, 3)]);
+    if(random_below(gen, 2))
+        nested_expr(gen, depth - 1 - random_below(gen, depth));
+    else
+        emit_number(gen);
+    emit(gen, ")");
+}
+
+static void flat_expr(Generator *gen) {
+    int terms = 64 + random_below(gen, 64);
+    emit_number(gen);
+    for(int i = 1; i < terms; ++i) {
+        emit(gen, arith_ops[random_below(gen, 3)]);
+        emit_number(gen);
+    }
+}
+
+static void boolean_term(Generator *gen, int depth) {
+    int choice = random_below(gen, depth > 0 ? 5 : 3);
+    switch(choice) {
+        case 0:
+        case 1:
+            emit_number(gen);
+            emit(gen, compare_ops[random_below(gen, 6)]);
+            emit_number(gen);
+            break;
+        case 2:
+            emit(gen, random_below(gen, 2) ? "true" : "false");
+            break;
+        case 3:
+            emit(gen, "not (");
+            boolean_term(gen, depth - 1);
+            emit(gen, ")");
+            break;
+        default:
+            emit(gen, "(");
+            boolean_term(gen, depth - 1);
+            emit(gen, random_below(gen, 2) ? " and " : " or ");
+            boolean_term(gen, depth - 1);
+            emit(gen, ")");
+            break;
+    }
+}
+
+static void boolean_expr(Generator *gen) {
+    int terms = 3 + random_below(gen, 6);
+    for(int i = 0; i < terms; ++i) {
+        if(i > 0) emit(gen, random_below(gen, 2) ? " and " : " or ");
+        boolean_term(gen, 3);
+    }
+}
+
+// field values, some short enough to be stored inline and some not
+static const char *words[] = {
+    "open", "closed", "pending", "US", "BR", "error", "warning",
+    "critical_failure", "payment_declined", "shipping_delayed",
+    "customer_support", "account_suspended",
+};
+
+static void emit_word(Generator *gen) {
+    if(gen->corpus->variables && random_below(gen, 2)) {
+        emit(gen, words_variables[random_below(gen,
+                    sizeof(words_variables) / sizeof(words_variables[0]))]);
+        return;
+    }
+    emit(gen, "\"");
+    emit(gen, words[random_below(gen, sizeof(words) / sizeof(words[0]))]);
+    emit(gen, "\"");
+}
+
+static void string_term(Generator *gen) {
+    switch(random_below(gen, 3)) {
+        case 0: {
+            // a concatenation against what it may or may not produce
+            const char *a = words[random_below(gen, sizeof(words) / sizeof(words[0]))];
+            const char *b = words[random_below(gen, sizeof(words) / sizeof(words[0]))];
+            emit(gen, "\""); emit(gen, a); emit(gen, "\" + \":\" + \"");
+            emit(gen, b); emit(gen, "\" == \""); emit(gen, a); emit(gen, ":");
+            emit(gen, random_below(gen, 2) ? b : a);
+            emit(gen, "\"");
+            break;
+        }
+        case 1:
+            emit_word(gen);
+            emit(gen, random_below(gen, 2) ? " < " : " > ");
+            emit_word(gen);
+            break;
+        default:
+            emit_word(gen);
+            emit(gen, random_below(gen, 2) ? " == " : " != ");
+            emit_word(gen);
+            break;
+    }
+}
+
+static void string_expr(Generator *gen) {
+    int terms = 2 + random_below(gen, 5);
+    for(int i = 0; i < terms; ++i) {
+        if(i > 0) emit(gen, random_below(gen, 2) ? " and " : " or ");
+        string_term(gen);
+    }
+}
+
+static void emit_vector(Generator *gen, int length) {
+    emit(gen, "[");
+    for(int i = 0; i < length; ++i) {
+        if(i > 0) emit(gen, ", ");
+        emit_number(gen);
+    }
+    emit(gen, "]");
+}
+
+static void vector_expr(Generator *gen) {
+    // a score from features and weights, and a count of features over a
+    // threshold
+    int length = 64 + random_below(gen, 192);
+    emit(gen, "sum(");
+    emit_vector(gen, length);
+    emit(gen, " * ");
+    emit_vector(gen, length);
+    emit(gen, ") > ");
+    emit_number(gen);
+    emit(gen, " and sum(");
+    emit_vector(gen, length);
+    emit(gen, random_below(gen, 2) ? " > " : " < ");
+    emit_number(gen);
+    emit(gen, ") > ");
+    emit_number(gen);
+}
+
+// Public interface
+
+const char *corpus_shape_name(Shape shape) {
+    switch(shape) {
+        case SHAPE_LITERAL: return "literal";
+        case SHAPE_NESTED: return "nested";
+        case SHAPE_FLAT: return "flat";
+        case SHAPE_BOOLEAN: return "boolean";
+        case SHAPE_STRING: return "string";
+        case SHAPE_VECTOR: return "vector";
+        default: return "???";
+    }
+}
+
+void corpus_generate(Corpus *corpus, Shape shape, int count, uint64_t seed,
+        bool variables) {
+    corpus->shape = shape;
+    corpus->variables = variables;
+    corpus->capacity = 1 << 16;
+    corpus->text = cog_realloc(NULL, 0, corpus->capacity);
+    corpus->size = 0;
+    corpus->lines = cog_realloc(NULL, 0, count * sizeof(size_t));
+    corpus->lengths = cog_realloc(NULL, 0, count * sizeof(size_t));
+    corpus->count = count;
+
+    Generator gen = { corpus, seed * 0x9E3779B97F4A7C15ull + shape + 1 };
+    for(int i = 0; i < count; ++i) {
+        corpus->lines[i] = corpus->size;
+        switch(shape) {
+            case SHAPE_LITERAL: literal_expr(&gen); break;
+            case SHAPE_NESTED: nested_expr(&gen, 12 + random_below(&gen, 8)); break;
+            case SHAPE_FLAT: flat_expr(&gen); break;
+            case SHAPE_BOOLEAN: boolean_expr(&gen); break;
+            case SHAPE_STRING: string_expr(&gen); break;
+            case SHAPE_VECTOR: vector_expr(&gen); break;
+            default: break;
+        }
+        corpus->lengths[i] = corpus->size - corpus->lines[i];
+        emit(&gen, "\n");
+    }
+}
+
+const char *corpus_globals(void) {
+    return globals;
+}
+
+void corpus_free(Corpus *corpus) {
+    free(corpus->text);
+    free(corpus->lines);
+    free(corpus->lengths);
+    corpus->text = NULL;
+    corpus->count = 0;
+}
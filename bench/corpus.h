@@ -0,0 +1,67 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Deterministic generation of expression corpora for benchmarking
+
+#ifndef COG_CORPUS_H
+#define COG_CORPUS_H
+
+#include "common.h"
+
+typedef enum {
+    SHAPE_LITERAL, // many literals and few operators
+    SHAPE_NESTED,  // deeply parenthesized
+    SHAPE_FLAT,    // long chains of binary operators
+    SHAPE_BOOLEAN, // comparisons under and, or and not
+    SHAPE_STRING,  // string comparisons and concatenations
+    SHAPE_VECTOR,  // dot products and thresholds over long vectors
+    SHAPE_COUNT,
+} Shape;
+
+// Expressions, one per line, in one buffer
+typedef struct {
+    Shape shape;
+    bool variables; // some numbers are read from corpus_globals()
+    char *text;
+    size_t size;
+    size_t capacity;
+    size_t *lines; // offset of the start of each line
+    size_t *lengths;
+    int count;
+} Corpus;
+
+const char *corpus_shape_name(Shape shape);
+
+// Generates count expressions of the given shape. The same shape,
+// count and seed always produce the same corpus. With variables, about
+// half the numbers are global variables instead, so that the compiler
+// can't fold the expressions to constants.
+void corpus_generate(Corpus *corpus, Shape shape, int count, uint64_t seed,
+        bool variables);
+
+// Assignments to the global variables of corpora with variables, one
+// per line, to be evaluated before any of their expressions
+const char *corpus_globals(void);
+
+void corpus_free(Corpus *corpus);
+
+#endif // COG_CORPUS_H
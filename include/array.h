@@ -41,6 +41,8 @@ int cog_array_push(Cog_array *arr, Cog_value value);
 
 Cog_value cog_array_get(const Cog_array *arr, int index);
 
+void cog_array_set(Cog_array *arr, int index, Cog_value value);
+
 Cog_value cog_array_pop(Cog_array *arr);
 
 void cog_array_free(Cog_array *arr);
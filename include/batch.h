@@ -0,0 +1,79 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Evaluation of whole files of expressions, one per line
+
+#ifndef COG_BATCH_H
+#define COG_BATCH_H
+
+#include "box.h"
+#include "common.h"
+#include "output.h"
+#include "stats.h"
+#include "vm.h"
+
+// A read-only view of a whole input file
+typedef struct {
+    const char *data;
+    size_t size;
+    int fd; // of input that can't be mapped, or -1
+} Batch_file;
+
+// Maps the file at path into memory. Input that can't be mapped, such
+// as a pipe, has no data, and is left open as fd to be read instead.
+// Returns false, after reporting why, if neither is possible.
+bool batch_file_open(Batch_file *file, const char *path);
+
+void batch_file_close(Batch_file *file);
+
+// Compiles and runs one line, which need not be terminated, and writes
+// its result followed by a newline to out. Lines that fail to compile
+// or run produce "error" in place of a result, and empty lines produce
+// empty results, so output lines always match input lines. The box is
+// reused from one call to the next. Unless stats is NULL, the time
+// each phase takes is recorded in it.
+void batch_eval_line(Cog_env *env, Box *box, const char *line, size_t length,
+        Cog_output *out, Cog_stats *stats);
+
+// Evaluates every line in the size bytes at data, in order
+void batch_eval_lines(Cog_env *env, Box *box, const char *data, size_t size,
+        Cog_output *out, Cog_stats *stats);
+
+// Evaluates every line of the file at path, in order. Lines from input
+// that can't be mapped are lexed as they are read, straight out of the
+// blocks they are read into, with no time for lexing recorded on its
+// own. Statistics, if kept, are dumped whenever SIGUSR1 asks for them.
+bool batch_run(const char *path, Cog_output *out, Cog_stats *stats);
+
+// The same, for a file that is already open
+bool batch_run_file(const Batch_file *file, Cog_output *out, Cog_stats *stats);
+
+// Evaluates the lines of the file at path as one set of rules, compiled
+// together and run at once, and writes their results in the same order.
+// Rules too many for the code of one box are split into runs of as many
+// as fit (see compile_many_fitting), which share no work between them.
+// Input that can't be mapped is read whole first. Empty lines have empty
+// results. Returns false, after reporting why, if any rule fails to
+// compile or run.
+bool batch_run_rules(const char *path, Cog_output *out, Cog_stats *stats);
+
+#endif // COG_BATCH_H
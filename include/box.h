@@ -27,23 +27,75 @@
 
 #include "array.h"
 #include "common.h"
+#include "memory.h"
+#include "symbol.h"
 #include "value.h"
 
 #define BOX_CODE_INITIAL_CAPACITY 10
 #define BOX_CODE_GROWTH_FACTOR 2
 
+// Instruction budgets are charged a whole block at a time, so blocks are
+// kept short enough for that to stay accurate
+#define BOX_BLOCK_MAX_LENGTH 64
+
+// A straight run of instructions, ending at offset end of the code
+typedef struct {
+    unsigned end;
+    unsigned cost; // how many instructions it holds
+} Box_block;
+
+// Where a global variable is accessed, remembering the slot the name
+// was found in last time and in which table (see globals.h)
+typedef struct {
+    const Cog_symbol *name;
+    uint32_t table; // 0 until the first access
+    uint32_t slot;
+} Box_site;
+
+// Operands of site instructions are 16 bits
+#define BOX_MAX_SITES 65536
+
 typedef struct {
     uint8_t *code;
     unsigned count;
     unsigned capacity;
     Cog_array constants;
+    Cog_arena arena; // objects the constants point to
+    // Written by executions, so a box must not be executed by two
+    // threads at once
+    Box_site *sites;
+    unsigned site_count;
+    unsigned site_capacity;
+    Box_block *blocks; // in order, covering all of the code
+    unsigned block_count;
+    unsigned block_capacity;
+    // Where the compiler builds the IR of the code, kept from one
+    // compilation to the next
+    Cog_arena ir_arena;
 } Box;
 
 void box_init(Box *box);
 
+// Empties the box while keeping its allocations, so that it can be
+// reused for another compilation
+void box_reset(Box *box);
+
 void box_code_write(Box *box, uint8_t byte);
 
-uint8_t box_value_write(Box *box, Cog_value value);
+int box_value_write(Box *box, Cog_value value);
+
+// Returns the index of a new site for name
+int box_site_write(Box *box, const Cog_symbol *name);
+
+// Size in bytes of the instruction starting with op
+unsigned box_instruction_length(uint8_t op);
+
+// Where the jump or call at offset lands
+unsigned box_jump_target(const Box *box, unsigned offset);
+
+// Splits the finished code into blocks, which end after every jump and
+// start wherever one lands
+void box_mark_blocks(Box *box);
 
 void box_free(Box *box);
 
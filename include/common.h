@@ -30,4 +30,11 @@
 #define eprintf(...) \
     fprintf(stderr, __VA_ARGS__)
 
+// For functions meant to be specialized at each call site
+#if defined(__GNUC__)
+#define COG_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define COG_ALWAYS_INLINE inline
+#endif
+
 #endif // COG_COMMON_H
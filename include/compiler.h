@@ -28,7 +28,44 @@
 #include "box.h"
 #include "common.h"
 #include "lexer.h"
+#include "regbox.h"
 
-bool compile(const char *source, Box *box);
+// Sets how hard compilations that start from now on work on the code
+// they make, from 0 to PASSES_MAX_LEVEL, which is the default (see
+// passes.h). Not safe while other threads are compiling.
+void compile_set_level(int level);
+
+// Compiles the expression in the first length bytes of source, which
+// need not be NUL-terminated
+bool compile(const char *source, size_t length, Box *box);
+
+// Compiles the expression whose tokens are in tokens, such as those of
+// a source lexed in pieces (see lexer.h). They must not live in the IR
+// arena of box, which compiling starts by emptying.
+bool compile_tokens(const Token_buffer *tokens, Box *box);
+
+// Compiles count expressions into one box, whose executions leave their
+// results in the results of the environment, in order, and none in ret.
+// Whatever they have in common is computed once (see dag.h). As their
+// evaluation is one execution, an error in any of them fails them all.
+// Calls only reach 16 bits into a box, so together they must come to
+// less than 64 KiB of code, or they all fail to compile.
+bool compile_many(const char *const *sources, const size_t *lengths, int count,
+        Box *box);
+
+// Code past which compile_many_fitting leaves the rest of the
+// expressions out; combining them may add some
+#define COMPILER_MANY_CODE_BUDGET (UINT16_MAX / 2)
+
+// Compiles the first of count expressions as compile_many does, along
+// with as many of those after it as fit: until their code comes to
+// COMPILER_MANY_CODE_BUDGET. Returns how many, or 0 if any of them
+// failed to compile.
+int compile_many_fitting(const char *const *sources, const size_t *lengths, int count,
+        Box *box);
+
+// Compiles the expression for the register machine instead (see
+// regvm.h), which takes any expression without functions
+bool compile_registers(const char *source, size_t length, Reg_box *rbox);
 
 #endif // COG_COMPILER_H
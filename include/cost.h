@@ -0,0 +1,49 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Static estimates of what executing a box costs, from its code alone,
+// for deciding before it runs whether it may, and where
+
+#ifndef COG_COST_H
+#define COG_COST_H
+
+#include "box.h"
+#include "common.h"
+
+typedef struct {
+    // The costliest way through the code, in units of about one psh,
+    // and the most instructions any way through it runs. Each call is
+    // taken to run its function once more, and no further.
+    double cost;
+    unsigned instructions;
+    unsigned max_stack; // values on the stack at once, at most
+    unsigned constants;
+    size_t constant_bytes; // taken up by the constants and their objects
+    // False when functions may call themselves, which could make
+    // executions arbitrarily longer than estimated
+    bool bounded;
+} Cost_estimate;
+
+// Works out the estimate of box, whose code must be finished
+void cost_estimate(const Box *box, Cost_estimate *est);
+
+#endif // COG_COST_H
@@ -0,0 +1,44 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Sharing of work between expressions compiled into one box
+
+#ifndef COG_DAG_H
+#define COG_DAG_H
+
+#include "box.h"
+#include "common.h"
+
+// The code of one expression, up to and including its ret
+typedef struct {
+    unsigned start;
+    unsigned end;
+} Dag_region;
+
+// Replaces the code of box, made of count regions one after another,
+// with code that evaluates each expression in turn and sets its value
+// aside with OP_RESULT. Subexpressions the straight-line expressions
+// have in common are computed only once. Returns false, after reporting
+// why, if the result would be too long for calls to reach its end.
+bool dag_combine(Box *box, const Dag_region *regions, int count);
+
+#endif // COG_DAG_H
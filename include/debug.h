@@ -24,7 +24,18 @@
 #define COG_DEBUG_H
 
 #include "box.h"
+#include "profile.h"
 
+const char *op_name(uint8_t op);
+
+// Lists the instructions of box, after its static cost estimate
 void disassemble(const Box *box);
 
+// Disassembles box with each instruction's share of the cycles spent in
+// it, how often it ran and what it cost on average
+void disassemble_profiled(const Box *box, const Cog_profile *prof);
+
+// Lists the count and cycles of every opcode that has run
+void print_opcode_profile(const Cog_profile *prof);
+
 #endif // COG_DEBUG_H
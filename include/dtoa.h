@@ -0,0 +1,39 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Conversion of doubles to their shortest round-trip decimal text
+
+#ifndef COG_DTOA_H
+#define COG_DTOA_H
+
+#include "common.h"
+
+// Large enough for any output of cog_dtoa, including the terminator
+#define COG_DTOA_BUFFER_SIZE 32
+
+// Writes the shortest decimal text that reads back as exactly the
+// same double into buffer, which must hold at least
+// COG_DTOA_BUFFER_SIZE bytes. Returns the length of the text; the
+// buffer is also NUL-terminated.
+size_t cog_dtoa(double value, char *buffer);
+
+#endif // COG_DTOA_H
@@ -0,0 +1,86 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Global variables
+//
+// A table of values keyed by interned names, which hosts fill in with
+// the inputs of an evaluation. Every name gets a slot for good the
+// first time it is seen, so that a host can look up the slots of its
+// inputs once and then rebind them with a plain write, and so that each
+// access in a box can remember the slot it found (see Box_site).
+
+#ifndef COG_GLOBALS_H
+#define COG_GLOBALS_H
+
+#include "common.h"
+#include "symbol.h"
+#include "value.h"
+
+typedef struct {
+    const Cog_symbol *name;
+    Cog_value value;
+    bool defined;
+} Cog_global;
+
+typedef struct {
+    uint32_t id; // different for every table ever made, and never 0
+    // open addressing with linear probing, from names to slot + 1
+    uint32_t *index;
+    uint32_t index_capacity;
+    Cog_global *slots;
+    uint32_t count;
+    uint32_t capacity;
+} Cog_globals;
+
+void cog_globals_init(Cog_globals *globals);
+
+// The slot of the named variable, which is created undefined if needed
+uint32_t cog_globals_slot(Cog_globals *globals, const Cog_symbol *name);
+
+// Shorthand for hosts, which have names rather than symbols
+uint32_t cog_globals_lookup(Cog_globals *globals, const char *name, size_t length);
+
+// Strings and vectors that would not outlive the execution or box they
+// come from are copied into the table
+void cog_globals_set(Cog_globals *globals, uint32_t slot, Cog_value value);
+
+// Sets the slot as cog_globals_set does, but hands the value it
+// replaces, if the table owned it, to the caller through old instead
+// of freeing it, for executions that may still be holding on to it.
+// Returns whether it did.
+bool cog_globals_replace(Cog_globals *globals, uint32_t slot, Cog_value value,
+        Cog_value *old);
+
+// Frees a value that the table owned
+void cog_globals_release(Cog_value value);
+
+static inline bool cog_globals_defined(const Cog_globals *globals, uint32_t slot) {
+    return globals->slots[slot].defined;
+}
+
+static inline Cog_value cog_globals_get(const Cog_globals *globals, uint32_t slot) {
+    return globals->slots[slot].value;
+}
+
+void cog_globals_free(Cog_globals *globals);
+
+#endif // COG_GLOBALS_H
@@ -0,0 +1,114 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Math functions built into the language, each with an instruction of
+// its own that works on the stack directly
+
+#ifndef COG_INTRINSIC_H
+#define COG_INTRINSIC_H
+
+#include <math.h>
+
+#include "common.h"
+#include "number.h"
+#include "opcodes.h"
+#include "value.h"
+
+// How many numbers the intrinsic takes, or 0 if op is not one
+static inline int cog_intrinsic_arity(Op_code op) {
+    switch(op) {
+        case OP_SQRT:
+        case OP_ABS:
+        case OP_FLOOR:
+        case OP_EXP:
+        case OP_LOG:
+            return 1;
+        case OP_MIN:
+        case OP_MAX:
+        case OP_POW:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// fmin and fmax may pick either zero when given both, and do pick
+// differently depending on how they are compiled, so constants would
+// fold into something else than the VM computes. Here -0 comes before
+// 0, and NaNs give way to numbers, as with fmin.
+static inline double cog_intrinsic_min(double x, double y) {
+    if(isnan(x) || y < x)
+        return y;
+    if(x == y && signbit(y))
+        return y;
+    return x;
+}
+
+static inline double cog_intrinsic_max(double x, double y) {
+    if(isnan(x) || y > x)
+        return y;
+    if(x == y && !signbit(y))
+        return y;
+    return x;
+}
+
+// The intrinsic on doubles, where y is ignored by those that take one
+static inline double cog_intrinsic_apply(Op_code op, double x, double y) {
+    switch(op) {
+        case OP_SQRT: return sqrt(x);
+        case OP_ABS: return fabs(x);
+        case OP_FLOOR: return floor(x);
+        case OP_EXP: return exp(x);
+        case OP_LOG: return log(x);
+        case OP_MIN: return cog_intrinsic_min(x, y);
+        case OP_MAX: return cog_intrinsic_max(x, y);
+        case OP_POW: return pow(x, y);
+        default: return NAN;
+    }
+}
+
+// The intrinsic on numbers of either kind. Ints stay ints through abs,
+// min and max (unless abs overflows), and floor gives ints for doubles
+// as well; everything else is done on doubles.
+static inline Cog_value cog_intrinsic(Op_code op, Cog_value a, Cog_value b) {
+    switch(op) {
+        case OP_ABS:
+            if(IS_INT(a) && TO_INT(a) != INT64_MIN)
+                return COG_INT(TO_INT(a) < 0 ? -TO_INT(a) : TO_INT(a));
+            break;
+        case OP_FLOOR:
+            return IS_INT(a) ? a : cog_number_floor(TO_DOUBLE(a));
+        case OP_MIN:
+            if(IS_INT(a) && IS_INT(b))
+                return TO_INT(a) < TO_INT(b) ? a : b;
+            break;
+        case OP_MAX:
+            if(IS_INT(a) && IS_INT(b))
+                return TO_INT(a) > TO_INT(b) ? a : b;
+            break;
+        default:
+            break;
+    }
+    return COG_NUMBER(cog_intrinsic_apply(op, AS_DOUBLE(a), AS_DOUBLE(b)));
+}
+
+#endif // COG_INTRINSIC_H
@@ -0,0 +1,111 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Intermediate representation of expressions, between the parser and
+// the code of a box
+
+#ifndef COG_IR_H
+#define COG_IR_H
+
+#include "box.h"
+#include "common.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "symbol.h"
+#include "value.h"
+
+// Deepest tree of nodes lowering and the passes will walk, which keeps
+// their recursion well within the bounds of the C stack
+#define IR_MAX_DEPTH 16384
+
+typedef enum {
+    IR_CONSTANT,
+    IR_OP,         // an instruction that only computes, on its operands
+    IR_LOCAL,      // a value bound by let, or a parameter of a function
+    IR_GET_GLOBAL,
+    IR_SET_GLOBAL, // of its one operand
+    IR_LET,        // operands: the value bound and the body
+    IR_IF,         // operands: condition, then and else
+    IR_FUNCTION,   // operands: its body and the rest, where it's in scope
+    IR_CALL,       // operands: the arguments
+} Ir_tag;
+
+// What is known about the value of a node before it runs
+typedef enum {
+    IR_TYPE_ANY,
+    IR_TYPE_INT,     // or a double past the range of ints, if not finite
+    IR_TYPE_DOUBLE,
+    IR_TYPE_NUMBER,  // either of the two above
+    IR_TYPE_BOOLEAN,
+    IR_TYPE_VECTOR,
+} Ir_type;
+
+typedef struct Ir_node Ir_node;
+
+struct Ir_node {
+    uint8_t tag;
+    uint8_t type;
+    uint8_t op;        // of IR_OP
+    uint32_t count;    // of operands
+    uint32_t depth;    // of the tree below, the node itself included
+    int index;         // parameter of a local, or arity of a function
+    int slot;          // where let puts its value, or where a function
+                       // starts, once lowered
+    int uses;          // of the value bound by let, or calls of a function
+    Ir_node **operands;
+    union {
+        Cog_value value;         // IR_CONSTANT
+        const Cog_symbol *name;  // globals
+        Ir_node *binding;        // the let or function of IR_LOCAL and IR_CALL
+    } as;
+};
+
+// The expression being compiled into box, with its nodes allocated from
+// arena all at once
+typedef struct {
+    Box *box;
+    Cog_arena *arena;
+    bool too_deep;     // some node is deeper than IR_MAX_DEPTH
+} Ir;
+
+void ir_init(Ir *ir, Box *box, Cog_arena *arena);
+
+Ir_node *ir_constant(Ir *ir, Cog_value value);
+
+// Operands go in after the node is made, which sets its type
+Ir_node *ir_node(Ir *ir, Ir_tag tag, unsigned count);
+
+Ir_node *ir_unary(Ir *ir, Op_code op, Ir_node *a);
+
+Ir_node *ir_binary(Ir *ir, Op_code op, Ir_node *a, Ir_node *b);
+
+// Works out the type and depth of node from its operands, once they
+// are all in place
+void ir_finish(Ir *ir, Ir_node *node);
+
+bool ir_is_number(const Ir_node *node);
+
+// Appends code for the expression to box, followed by its ret. Returns
+// false, after reporting why, if the code can't be made to fit.
+bool ir_lower(Ir *ir, Ir_node *root);
+
+#endif // COG_IR_H
@@ -23,11 +23,18 @@
 #ifndef COG_LEXER_H
 #define COG_LEXER_H
 
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+
 typedef struct {
     const char *start;
     const char *current;
+    const char *end;
+    const char *line_start; // where the line of current starts
     int line;
-    int col;
+    int length; // of the last token
 } Lexer;
 
 typedef enum {
@@ -38,6 +45,21 @@ typedef enum {
     TOKEN_AND,
     TOKEN_OR,
     TOKEN_NONE,
+    TOKEN_LET,
+    TOKEN_IN,
+    TOKEN_IF,
+    TOKEN_THEN,
+    TOKEN_ELSE,
+    TOKEN_SQRT,
+    TOKEN_ABS,
+    TOKEN_FLOOR,
+    TOKEN_EXP,
+    TOKEN_LOG,
+    TOKEN_MIN,
+    TOKEN_MAX,
+    TOKEN_POW,
+    TOKEN_SUM,
+    TOKEN_MEAN,
 
     // Operators
     TOKEN_PLUS,
@@ -46,6 +68,9 @@ typedef enum {
     TOKEN_SLASH,
     TOKEN_OPEN_PAREN,
     TOKEN_CLOSE_PAREN,
+    TOKEN_OPEN_BRACKET,
+    TOKEN_CLOSE_BRACKET,
+    TOKEN_COMMA,
 
     TOKEN_LESS,
     TOKEN_LESS_EQUAL,
@@ -57,7 +82,10 @@ typedef enum {
 
     // Values
     TOKEN_NUM,
+    TOKEN_INT,
     TOKEN_SYM,
+    TOKEN_STR,
+    TOKEN_ID,
 
     // Special
     TOKEN_ERR,
@@ -72,8 +100,100 @@ typedef struct {
     int col;
 } Token;
 
-void lexer_init(Lexer *lex, const char *source);
+// Where the part of a source lexed in pieces that starts at offset is
+typedef struct {
+    uint32_t offset;
+    const char *data;
+} Token_segment;
+
+// The tokens of a whole source, lexed all at once, in parallel arrays
+// of what parsing needs of them: their type and where they are in the
+// source. Their lines and columns are only worked out for the tokens
+// that errors are reported at, from an index of the newlines in the
+// source, which is built the first time one is.
+typedef struct {
+    const char *source;
+    const char *end;
+    uint8_t *types;
+    uint32_t *starts;  // offsets into the source
+    uint32_t *lengths;
+    unsigned count;
+    unsigned capacity;
+    uint32_t *newlines; // offsets of each one, once indexed
+    unsigned newline_count;
+    unsigned newline_capacity;
+    bool indexed;
+    // Of sources lexed in pieces, which have no source of their own,
+    // in order of offset
+    Token_segment *segments;
+    unsigned segment_count;
+    unsigned segment_capacity;
+    Cog_arena *arena; // where the arrays live
+} Token_buffer;
+
+// Lexes a source that arrives in pieces, such as the buffers filled by
+// read() or the windows of a mapping, into a token buffer. The tokens
+// point into the pieces, so each must stay where it is, unchanged,
+// until the buffer is no longer used; only a token that the end of a
+// piece cuts short is copied, once the rest of it arrives.
+typedef struct {
+    Token_buffer *buf;
+    uint32_t offset; // of the next piece in the source
+    char *carry; // the start of the token the last piece cut short
+    size_t carry_length;
+    size_t carry_capacity;
+    uint32_t carry_offset;
+    bool in_comment; // whether the last piece ended inside of one
+} Lexer_stream;
+
+// The source need not be NUL-terminated: lexing stops after length
+// bytes, and NULs before that are not recognized as any token
+void lexer_init(Lexer *lex, const char *source, size_t length);
 
 Token lexer_get_token(Lexer *lex);
 
+// Lexes source into buf, up to and including its TOKEN_END, with the
+// arrays of buf allocated from arena. Only the first 4 GiB of source
+// are lexed.
+void lexer_tokenize(Token_buffer *buf, const char *source, size_t length,
+        Cog_arena *arena);
+
+// Starts lexing a source in pieces into buf, with the arrays of buf
+// allocated from arena
+void lexer_stream_init(Lexer_stream *ls, Token_buffer *buf, Cog_arena *arena);
+
+// Lexes the next length bytes of the source
+void lexer_stream_feed(Lexer_stream *ls, const char *piece, size_t length);
+
+// Lexes whatever is left of the source, up to its TOKEN_END, after
+// which buf is complete. The stream must be finished even when it's
+// given up on, to free what it holds; it can then be started again.
+void lexer_stream_finish(Lexer_stream *ls);
+
+// The message of a TOKEN_ERR, given its length in a token buffer
+const char *lexer_error_message(uint32_t length);
+
+// Where the text at offset is, in a source lexed in pieces
+const char *token_buffer_text(const Token_buffer *buf, uint32_t offset);
+
+// The index-th token of buf, as lexer_get_token would have returned it,
+// but with 0 for its line and column
+static inline Token token_buffer_get(const Token_buffer *buf, unsigned index) {
+    Token tok;
+    tok.type = (Token_t) buf->types[index];
+    tok.start = buf->segment_count == 0 ? buf->source + buf->starts[index]
+        : token_buffer_text(buf, buf->starts[index]);
+    tok.offset = buf->lengths[index];
+    tok.line = tok.col = 0;
+    if(tok.type == TOKEN_ERR) {
+        tok.start = lexer_error_message(buf->lengths[index]);
+        tok.offset = strlen(tok.start);
+    }
+    return tok;
+}
+
+// Where the index-th token of buf starts, counting lines and columns
+// from 1
+void token_buffer_position(Token_buffer *buf, unsigned index, int *line, int *col);
+
 #endif // COG_LEXER_H
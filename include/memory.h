@@ -27,4 +27,32 @@
 
 void *cog_realloc(void *ptr, size_t old_size, size_t new_size);
 
+// Bump allocation of objects that all die together
+
+#define COG_ARENA_CHUNK_SIZE 4096
+
+typedef struct Cog_arena_chunk {
+    struct Cog_arena_chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} Cog_arena_chunk;
+
+typedef struct {
+    Cog_arena_chunk *chunks; // the one being filled first
+} Cog_arena;
+
+void cog_arena_init(Cog_arena *arena);
+
+void *cog_arena_alloc(Cog_arena *arena, size_t size);
+
+// Frees everything allocated so far at once, keeping one chunk around
+// for what comes next
+void cog_arena_reset(Cog_arena *arena);
+
+void cog_arena_free(Cog_arena *arena);
+
+// FNV-1a, for the hash tables around
+uint32_t cog_hash_bytes(const char *bytes, size_t length);
+
 #endif // COG_MEMORY_H
@@ -0,0 +1,80 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Arithmetic on numbers, which are either 64 bit ints or doubles
+//
+// Ints stay ints for as long as the results fit; one that overflows is
+// computed as a double instead. With a double on either side, the int
+// is converted and the result is a double. Division always gives a
+// double, which floor() turns back into an int. Both the VM and
+// constant folding go through here.
+
+#ifndef COG_NUMBER_H
+#define COG_NUMBER_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "value.h"
+
+static inline Cog_value cog_number_neg(Cog_value a) {
+    if(IS_INT(a) && TO_INT(a) != INT64_MIN)
+        return COG_INT(-TO_INT(a));
+    return COG_NUMBER(-AS_DOUBLE(a));
+}
+
+static inline Cog_value cog_number_add(Cog_value a, Cog_value b) {
+    int64_t result;
+    if(IS_INT(a) && IS_INT(b) && !__builtin_add_overflow(TO_INT(a), TO_INT(b), &result))
+        return COG_INT(result);
+    return COG_NUMBER(AS_DOUBLE(a) + AS_DOUBLE(b));
+}
+
+static inline Cog_value cog_number_sub(Cog_value a, Cog_value b) {
+    int64_t result;
+    if(IS_INT(a) && IS_INT(b) && !__builtin_sub_overflow(TO_INT(a), TO_INT(b), &result))
+        return COG_INT(result);
+    return COG_NUMBER(AS_DOUBLE(a) - AS_DOUBLE(b));
+}
+
+static inline Cog_value cog_number_mul(Cog_value a, Cog_value b) {
+    int64_t result;
+    if(IS_INT(a) && IS_INT(b) && !__builtin_mul_overflow(TO_INT(a), TO_INT(b), &result))
+        return COG_INT(result);
+    return COG_NUMBER(AS_DOUBLE(a) * AS_DOUBLE(b));
+}
+
+static inline Cog_value cog_number_div(Cog_value a, Cog_value b) {
+    return COG_NUMBER(AS_DOUBLE(a) / AS_DOUBLE(b));
+}
+
+// floor() of a double, which is an int unless it doesn't fit in one
+static inline Cog_value cog_number_floor(double x) {
+    double y = floor(x);
+    // false for NaN, as it should be
+    if(y >= -0x1p63 && y < 0x1p63)
+        return COG_INT((int64_t) y);
+    return COG_NUMBER(y);
+}
+
+#endif // COG_NUMBER_H
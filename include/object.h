@@ -0,0 +1,101 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Strings
+//
+// Strings of up to COG_SHORT_STRING_MAX bytes live right inside their
+// Cog_value, NUL-padded, with their length in the last byte; comparing
+// two of them is comparing two words. Longer ones are Cog_string objects
+// allocated from an arena: that of the box for literals, that of the
+// environment for the results of an execution. Which representation a
+// string gets depends only on its length, so strings of different
+// representations are never equal.
+
+// Vectors
+//
+// Vectors of numbers are Cog_vector objects, allocated the same way as
+// long strings. Arithmetic on them works element by element (see
+// vector.h), and so do comparisons, which give masks: vectors holding 1
+// where the comparison holds and 0 where it doesn't.
+
+#ifndef COG_OBJECT_H
+#define COG_OBJECT_H
+
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+#include "value.h"
+
+#define COG_SHORT_STRING_MAX 7
+
+struct Cog_string {
+    uint32_t length;
+    uint32_t hash; // 0 until first needed
+    bool interned; // one of a kind, so pointers alone decide equality
+    char chars[];  // NUL-terminated
+};
+
+// A string with the length bytes at chars, allocated from arena if it
+// is too long to be short, or on its own for the caller to free if
+// arena is NULL
+Cog_value cog_string_value(Cog_arena *arena, const char *chars, size_t length);
+
+// The one string with these contents shared by all who intern it, which
+// is never freed. Safe to call from any thread.
+Cog_value cog_string_intern(const char *chars, size_t length);
+
+// Where the bytes of a string value are, which for short strings is
+// inside the value itself
+const char *cog_string_chars(const Cog_value *value, size_t *length);
+
+uint32_t cog_string_hash(Cog_string *string);
+
+Cog_value cog_string_concat(Cog_arena *arena, Cog_value a, Cog_value b);
+
+bool cog_strings_equal(Cog_value a, Cog_value b);
+
+// Negative, zero or positive as a sorts before, with or after b
+int cog_strings_compare(Cog_value a, Cog_value b);
+
+struct Cog_vector {
+    uint32_t length;
+    double elements[];
+};
+
+// A vector of length elements, left for the caller to fill in, allocated
+// from arena or on its own for the caller to free if arena is NULL
+Cog_vector *cog_vector_new(Cog_arena *arena, size_t length);
+
+// A copy of the vector, allocated the same way as by cog_vector_new
+Cog_value cog_vector_copy(Cog_arena *arena, Cog_value vector);
+
+bool cog_vectors_equal(Cog_value a, Cog_value b);
+
+static inline bool cog_short_strings_equal(Cog_value a, Cog_value b) {
+    uint64_t x, y;
+    memcpy(&x, a.as.chars, sizeof(x));
+    memcpy(&y, b.as.chars, sizeof(y));
+    return x == y;
+}
+
+#endif // COG_OBJECT_H
@@ -31,6 +31,23 @@ typedef enum {
     OP_MUL,
     OP_DIV,
 
+    // math intrinsics, on numbers
+    OP_SQRT,
+    OP_ABS,
+    OP_FLOOR,
+    OP_EXP,
+    OP_LOG,
+    OP_MIN,
+    OP_MAX,
+    OP_POW,
+
+    // vectors
+    OP_VECTOR, // pops a 16 bit count of numbers into a new vector
+    OP_SUM,
+    OP_MEAN,
+    OP_MIN_OF,
+    OP_MAX_OF,
+
     // logic and relational
     OP_NOT,
     OP_EQ,
@@ -41,12 +58,29 @@ typedef enum {
 
     // stack manipulation
     OP_PSH,
+    OP_PSH_LONG, // 24 bit constant index, for boxes with many constants
     OP_PSH_TRUE,
     OP_PSH_FALSE,
     OP_PSH_NONE,
 
+    // variables
+    OP_GET_LOCAL, // 8 bit stack slot
+    OP_SET_LOCAL, // pops into the slot
+    OP_GET_GLOBAL, // 16 bit site
+    OP_SET_GLOBAL, // leaves the value on the stack
+
+    // control flow, with 16 bit forward offsets from the next instruction
+    OP_JMP,
+    OP_JMP_FALSE, // pops the condition
+    // 16 bit offset of the function and 8 bit count of arguments
+    OP_CALL,
+    OP_TAIL_CALL, // takes over the frame of the caller
+
     // others
     OP_RET,
+    OP_RESULT, // pops the value into the results of the execution
+
+    OP_COUNT, // not an instruction; the number of opcodes
 } Op_code;
 
 #endif // COG_OPCODES_H
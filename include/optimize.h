@@ -0,0 +1,38 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Rewrites of compiled boxes that keep what they compute
+
+#ifndef COG_OPTIMIZE_H
+#define COG_OPTIMIZE_H
+
+#include "box.h"
+
+// Settles jumps on conditions known at compile time, threads jumps that
+// land on other jumps straight to their final destination (or turns
+// them into the ret they lead to), turns calls right before a ret into
+// tail calls, and removes code that can't be reached as well as jumps
+// to the next instruction. Only tail calls are made at level 0, as deep
+// recursion depends on them; the rest needs level 1 or above.
+void optimize_jumps(Box *box, int level);
+
+#endif // COG_OPTIMIZE_H
@@ -0,0 +1,57 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Buffered output of results
+
+#ifndef COG_OUTPUT_H
+#define COG_OUTPUT_H
+
+#include <stdio.h>
+
+#include "common.h"
+#include "value.h"
+
+#define COG_OUTPUT_CAPACITY (1 << 16)
+#define COG_OUTPUT_GROWTH_FACTOR 2
+
+typedef struct {
+    FILE *stream; // NULL: the buffer grows instead of being flushed
+    char *data;
+    size_t count;
+    size_t capacity;
+} Cog_output;
+
+void cog_output_init(Cog_output *out, FILE *stream, size_t capacity);
+
+void cog_output_write(Cog_output *out, const char *text, size_t length);
+
+void cog_output_char(Cog_output *out, char ch);
+
+void cog_output_value(Cog_output *out, Cog_value value);
+
+// Hands everything buffered so far to the stream in a single write.
+// Returns false if the stream reported an error.
+bool cog_output_flush(Cog_output *out);
+
+void cog_output_free(Cog_output *out);
+
+#endif // COG_OUTPUT_H
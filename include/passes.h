@@ -0,0 +1,42 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Optimization of the IR, in passes picked by level
+
+#ifndef COG_PASSES_H
+#define COG_PASSES_H
+
+#include "ir.h"
+
+// Levels go from 0, where code is compiled as written, up to this one.
+// Level 1 folds constants; level 2 also applies algebraic identities,
+// turns divisions into multiplications, reassociates constants and
+// removes values and functions that are never used. All of them keep
+// what the expression computes, down to the last bit, as well as the
+// errors it runs into.
+#define PASSES_MAX_LEVEL 2
+
+// Runs every pass of the level or below over the expression at root,
+// returning what takes its place
+Ir_node *passes_run(Ir *ir, Ir_node *root, int level);
+
+#endif // COG_PASSES_H
@@ -0,0 +1,84 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Hardware performance counters
+//
+// On Linux, perf_event_open gives each thread its own count of cycles,
+// instructions, branch mispredictions and so on, which say much more
+// about changes to the dispatch loop than timings do. Everything here
+// degrades gracefully: counters the system won't give us are simply
+// marked as missing, and elsewhere none of them ever are available.
+
+#ifndef COG_PERF_H
+#define COG_PERF_H
+
+#include <stdio.h>
+
+#include "common.h"
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCHES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES, // read misses in the L1 data cache
+    PERF_COUNTER_COUNT,
+} Perf_counter;
+
+typedef struct {
+    uint64_t values[PERF_COUNTER_COUNT];
+} Cog_perf_sample;
+
+typedef struct {
+    // the counters are opened as one group, so they are read in one go
+    int leader;
+    int fds[PERF_COUNTER_COUNT]; // -1 for counters that are missing
+    int slots[PERF_COUNTER_COUNT]; // position of each in a group read
+    int opened;
+} Cog_perf;
+
+// Opens every counter available to the calling thread, counting only
+// what it does in user space. Returns false, leaving nothing open, when
+// not a single one is.
+bool cog_perf_open(Cog_perf *perf);
+
+bool cog_perf_has(const Cog_perf *perf, Perf_counter counter);
+
+// Reads the current value of every counter; missing ones read as 0.
+// Returns false if the counters could not be read or were never
+// scheduled onto the hardware.
+bool cog_perf_read(const Cog_perf *perf, Cog_perf_sample *sample);
+
+// Adds what was counted from before to after into total
+void cog_perf_accumulate(Cog_perf_sample *total, const Cog_perf_sample *before,
+        const Cog_perf_sample *after);
+
+void cog_perf_close(Cog_perf *perf);
+
+const char *cog_perf_counter_name(Perf_counter counter);
+
+// Writes the counts in sample, averaged over runs, along with the IPC
+// and branch miss rate derived from them, as a single line
+void cog_perf_print(const Cog_perf *perf, const Cog_perf_sample *sample,
+        uint64_t runs, FILE *file);
+
+#endif // COG_PERF_H
@@ -0,0 +1,47 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Parallel evaluation of files of expressions, with ordered output
+
+#ifndef COG_PIPELINE_H
+#define COG_PIPELINE_H
+
+#include "common.h"
+#include "output.h"
+#include "stats.h"
+
+// Input is handed to workers in chunks of about this many bytes,
+// always ending on a line boundary
+#define PIPELINE_CHUNK_SIZE (1 << 20)
+
+// Finished chunks that may wait for their turn to be written, per job
+#define PIPELINE_WINDOW_PER_JOB 4
+
+// Evaluates every line of the file at path on jobs worker threads (one
+// per core if jobs is 0). Results are written to out in the order of
+// the input lines, exactly as batch_run would write them. Statistics,
+// if kept, are gathered from every worker. Input that can't be mapped,
+// such as a pipe, is streamed through batch_run_file on the calling
+// thread alone.
+bool pipeline_run(const char *path, int jobs, Cog_output *out, Cog_stats *stats);
+
+#endif // COG_PIPELINE_H
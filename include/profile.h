@@ -0,0 +1,58 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Opt-in execution profiling
+//
+// Builds configured with -Dprofile=true define COG_PROFILE, which makes
+// execute() count every instruction it runs, per opcode and per offset
+// in the box, and estimate the cycles each one takes. Without it the VM
+// contains no trace of any of this.
+
+#ifndef COG_PROFILE_H
+#define COG_PROFILE_H
+
+#include "box.h"
+#include "common.h"
+#include "opcodes.h"
+
+typedef struct {
+    // per offset in the box being profiled
+    const Box *box;
+    uint64_t *counts;
+    uint64_t *cycles;
+    unsigned size;
+    // per opcode, across every box profiled so far
+    uint64_t op_counts[OP_COUNT];
+    uint64_t op_cycles[OP_COUNT];
+} Cog_profile;
+
+void cog_profile_init(Cog_profile *prof);
+
+// Starts profiling box afresh; totals per opcode carry on
+void cog_profile_attach(Cog_profile *prof, const Box *box);
+
+void cog_profile_free(Cog_profile *prof);
+
+// A cheap timestamp: the time stamp counter on x86, nanoseconds elsewhere
+uint64_t cog_profile_clock(void);
+
+#endif // COG_PROFILE_H
@@ -0,0 +1,41 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Lowering of the IR into code for the register machine
+
+#ifndef COG_REGALLOC_H
+#define COG_REGALLOC_H
+
+#include "common.h"
+#include "ir.h"
+#include "regbox.h"
+
+// Appends code for the expression to rbox, whose box must be the one of
+// ir, followed by its ret. The values of the expression get registers
+// by linear scan over the code: each holds a register from the
+// instruction that makes it to the last one that reads it, and then
+// hands it over. Returns false, after reporting why, if the code needs
+// more registers than the window has, or functions, which only the
+// stack machine runs.
+bool reg_lower(Ir *ir, Ir_node *root, Reg_box *rbox);
+
+#endif // COG_REGALLOC_H
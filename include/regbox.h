@@ -0,0 +1,100 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Code for the register machine (see regvm.h), an alternative to the
+// stack machine that works on three-address instructions
+
+#ifndef COG_REGBOX_H
+#define COG_REGBOX_H
+
+#include "box.h"
+#include "common.h"
+#include "opcodes.h"
+
+// Registers the code of a box may use. Operands past them name the
+// first constants of the box, which need no instruction of their own.
+#define REG_WINDOW 128
+#define REG_OPERANDS 256
+
+// The last registers of the window are left for values brought back
+// from spill slots, which is where values go while the window is full
+#define REG_SCRATCH 2
+#define REG_MAX_SPILLS (65536 - REG_OPERANDS)
+
+// Every instruction is four bytes: op, then a, which is usually the
+// register written, then the operands b and c. Those that take a 16
+// bit operand take it in b and c, as the wide operand.
+//
+//   computing ops      a = b op c, or a = op b for the unary ones
+//   OP_VECTOR          a = vector of wide elements, whose operands
+//                      follow, two to each of the next instructions. They
+//                      are 16 bits: operands as above, or spill slots
+//                      past REG_OPERANDS.
+//   OP_GET_GLOBAL      a = the global at wide site
+//   OP_SET_GLOBAL      the global at wide site = a, which is read
+//   OP_JMP             forward by wide instructions past the next
+//   OP_JMP_FALSE       the same, if a is falsy
+//   OP_RET             a is the result
+//   REG_OP_MOVE        a = b
+//   REG_OP_LOAD        a = the constant at wide, past the window
+//   REG_OP_SPILL       spill slot wide = a
+//   REG_OP_RELOAD      a = spill slot wide
+typedef union {
+    struct {
+        uint8_t op;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+    };
+    uint8_t bytes[4];
+} Reg_instr;
+
+#define REG_WIDE(instr) ((instr).b | ((instr).c << 8))
+
+// Besides those of opcodes.h, which mean the same here
+enum {
+    REG_OP_MOVE = OP_COUNT,
+    REG_OP_LOAD,
+    REG_OP_SPILL,
+    REG_OP_RELOAD,
+};
+
+typedef struct {
+    Box box; // constants, sites and arenas; its code stays empty
+    Reg_instr *code;
+    unsigned count;
+    unsigned capacity;
+    unsigned registers; // how many of the window the code uses
+    unsigned spills;    // and how many spill slots
+} Reg_box;
+
+void reg_box_init(Reg_box *rbox);
+
+// Empties rbox while keeping its allocations, like box_reset
+void reg_box_reset(Reg_box *rbox);
+
+// Returns the index of the instruction
+unsigned reg_box_write(Reg_box *rbox, Reg_instr instr);
+
+void reg_box_free(Reg_box *rbox);
+
+#endif // COG_REGBOX_H
@@ -0,0 +1,37 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// The register machine, which runs the code of a Reg_box
+
+#ifndef COG_REGVM_H
+#define COG_REGVM_H
+
+#include "regbox.h"
+#include "vm.h"
+
+// Executes the code of rbox in env, leaving its result in env->ret like
+// execute() does. Budgets, deadlines and slices don't apply: jumps only
+// go forward, so the code reaches its end having run each instruction
+// once at most.
+Cog_result reg_execute(Cog_env *env, const Reg_box *rbox);
+
+#endif // COG_REGVM_H
@@ -0,0 +1,63 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Round-robin scheduling of suspended executions on one thread
+//
+// Environments with a slice set stop every so often with RES_SUSPENDED.
+// Handed over to a scheduler, each one gets its turn to run another
+// slice, in order, until it finishes one way or another.
+
+#ifndef COG_SCHED_H
+#define COG_SCHED_H
+
+#include "common.h"
+#include "vm.h"
+
+typedef struct {
+    Cog_env *env;
+    void *data; // whatever the owner needs to find its way back
+    Cog_result result;
+} Sched_task;
+
+// A queue of tasks, kept as a ring
+typedef struct {
+    Sched_task *tasks;
+    unsigned head;
+    unsigned count;
+    unsigned capacity;
+} Scheduler;
+
+void sched_init(Scheduler *sched);
+
+// Queues env, whose execution was just suspended
+void sched_add(Scheduler *sched, Cog_env *env, void *data);
+
+// Drops env from the queue, leaving its execution unfinished
+void sched_remove(Scheduler *sched, Cog_env *env);
+
+// Gives the task at the front one more slice, queueing it again at the
+// back if it still isn't over. Returns true and fills in done if it is.
+bool sched_step(Scheduler *sched, Sched_task *done);
+
+void sched_free(Scheduler *sched);
+
+#endif // COG_SCHED_H
@@ -0,0 +1,68 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Long-running evaluation server on a Unix domain socket
+//
+// Both directions carry a stream of frames: a 32 bit little-endian
+// length, counting the type byte and the payload, then a type byte and
+// the payload. Each request gets exactly one response, in order, and
+// all responses to the requests found in one read are sent together.
+// Compiled boxes are shared by all connections and live as long as the
+// server; each connection evaluates on an environment of its own.
+//
+// Given a slice, long evaluations are suspended every so many
+// instructions and interleaved with everything else the server does,
+// so that one connection can't hold up all the others. A connection
+// whose evaluation is suspended has its later requests wait their turn.
+
+#ifndef COG_SERVER_H
+#define COG_SERVER_H
+
+#include "common.h"
+#include "stats.h"
+
+#define SERVER_HEADER_SIZE 5
+#define SERVER_MAX_FRAME (1 << 24)
+#define SERVER_MAX_BOXES 65536
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE (1 << 16)
+
+typedef enum {
+    // requests
+    FRAME_EVAL = 0x01,    // source -> value
+    FRAME_COMPILE = 0x02, // source -> box id
+    FRAME_RUN = 0x03,     // 32 bit little-endian box id -> value
+
+    // responses
+    FRAME_VALUE = 0x81,   // text of the value
+    FRAME_ID = 0x82,      // 32 bit little-endian box id
+    FRAME_ERROR = 0xFF,   // error message
+} Frame_t;
+
+// Serves requests on a socket bound to path until interrupted by
+// SIGINT or SIGTERM, switching between evaluations every slice
+// instructions unless slice is 0. Unless stats is NULL, compilations
+// and executions are timed into it. Returns false if the socket can't
+// be set up.
+bool server_run(const char *path, uint64_t slice, Cog_stats *stats);
+
+#endif // COG_SERVER_H
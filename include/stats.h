@@ -0,0 +1,111 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Latency histograms for the phases of evaluating an expression
+
+#ifndef COG_STATS_H
+#define COG_STATS_H
+
+#include <stdio.h>
+
+#include "common.h"
+#include "perf.h"
+
+// Each power of two is split into 2^COG_HISTOGRAM_SUB_BITS linear
+// buckets, so recorded values are off by at most 1/16 (6.25%)
+#define COG_HISTOGRAM_SUB_BITS 4
+#define COG_HISTOGRAM_SUB_BUCKETS (1 << COG_HISTOGRAM_SUB_BITS)
+#define COG_HISTOGRAM_BUCKETS (64 * COG_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[COG_HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} Cog_histogram;
+
+typedef enum {
+    PHASE_LEX,     // a separate pass of the lexer alone
+    PHASE_COMPILE, // the compiler, including the lexing it drives
+    PHASE_EXECUTE,
+    PHASE_COUNT,
+} Phase;
+
+typedef struct {
+    Cog_histogram phases[PHASE_COUNT];
+    // hardware events, counted only after cog_stats_count_events
+    Cog_perf *perf;
+    Cog_perf_sample mark; // the counters as the current phase began
+    Cog_perf_sample events[PHASE_COUNT];
+    Cog_perf_sample last[PHASE_COUNT]; // the latest run of each phase
+} Cog_stats;
+
+void cog_histogram_init(Cog_histogram *hist);
+
+void cog_histogram_record(Cog_histogram *hist, uint64_t value);
+
+void cog_histogram_merge(Cog_histogram *into, const Cog_histogram *from);
+
+// The value below which a fraction p of the recorded values fall, to
+// the precision of the buckets
+uint64_t cog_histogram_percentile(const Cog_histogram *hist, double p);
+
+void cog_stats_init(Cog_stats *stats);
+
+// Forgets everything recorded, but keeps counting events if it was
+void cog_stats_reset(Cog_stats *stats);
+
+// Also counts hardware events for every phase from now on, on the
+// calling thread. Returns false if no counter is available.
+bool cog_stats_count_events(Cog_stats *stats);
+
+void cog_stats_free(Cog_stats *stats);
+
+void cog_stats_merge(Cog_stats *into, const Cog_stats *from);
+
+// Monotonic time in nanoseconds
+uint64_t cog_stats_clock(void);
+
+// Marks the start of a phase, returning the time it started
+uint64_t cog_stats_start(Cog_stats *stats);
+
+// Records the time from since until now for phase, and returns now, so
+// that consecutive phases can be timed back to back
+uint64_t cog_stats_record(Cog_stats *stats, Phase phase, uint64_t since);
+
+// Times a lexer-only pass over source
+void cog_stats_time_lexer(Cog_stats *stats, const char *source, size_t length);
+
+// Writes counts, p50, p90, p99 and max of every phase as JSON, along
+// with the mean of every hardware event counted
+void cog_stats_write_json(const Cog_stats *stats, FILE *file);
+
+// Writes the events counted by the latest compile and execute
+void cog_stats_print_events(const Cog_stats *stats, FILE *file);
+
+// Makes SIGUSR1 request a dump of the statistics
+void cog_stats_handle_signal(void);
+
+// Whether a dump was requested since the last call
+bool cog_stats_dump_requested(void);
+
+#endif // COG_STATS_H
@@ -0,0 +1,41 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Symbols: names interned once and for all, so that two of them are the
+// same symbol exactly when they are the same pointer
+
+#ifndef COG_SYMBOL_H
+#define COG_SYMBOL_H
+
+#include "common.h"
+
+typedef struct {
+    uint32_t hash;
+    uint32_t length;
+    char chars[]; // NUL-terminated
+} Cog_symbol;
+
+// Returns the one symbol named by the length bytes at chars, creating it
+// if needed. Symbols are never freed. Safe to call from any thread.
+const Cog_symbol *cog_symbol_intern(const char *chars, size_t length);
+
+#endif // COG_SYMBOL_H
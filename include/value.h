@@ -24,21 +24,47 @@
 #define COG_VALUE_H
 
 #include "common.h"
+#include "symbol.h"
 
 typedef enum {
-    TYPE_NUMBER,
+    TYPE_NUMBER, // a double
+    TYPE_INT,    // see number.h
     TYPE_BOOLEAN,
     TYPE_NONE,
+    TYPE_SYMBOL,
+    TYPE_SHORT_STRING, // see object.h
+    TYPE_STRING,
+    TYPE_VECTOR, // see object.h
 } Cog_type;
 
+typedef struct Cog_string Cog_string;
+typedef struct Cog_vector Cog_vector;
+
 typedef struct {
     Cog_type type;
     union {
         double number;
+        int64_t integer;
         bool boolean;
+        const Cog_symbol *symbol;
+        Cog_string *string;
+        Cog_vector *vector;
+        char chars[8];
     } as;
 } Cog_value;
 
+// Large enough for the text of any value but a symbol, a string or a
+// vector,
+// including the terminator
+#define COG_VALUE_FORMAT_MAX 32
+
+// How many bytes the text of value takes, including the terminator
+size_t cog_value_format_size(Cog_value value);
+
+// Writes the text of value into buffer, which must hold at least
+// cog_value_format_size(value) bytes, and returns its length
+size_t cog_value_format(Cog_value value, char *buffer);
+
 void cog_value_print(Cog_value value);
 
 bool cog_values_equal(Cog_value a, Cog_value b);
@@ -47,24 +73,57 @@ bool cog_values_equal(Cog_value a, Cog_value b);
 
 #define IS_NUMBER(value) ((value).type == TYPE_NUMBER)
 
+#define IS_INT(value) ((value).type == TYPE_INT)
+
+// either kind of number
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
+
 #define IS_BOOLEAN(value) ((value).type == TYPE_BOOLEAN)
 
 #define IS_NONE(value) ((value).type == TYPE_NONE)
 
+#define IS_SYMBOL(value) ((value).type == TYPE_SYMBOL)
+
+#define IS_STRING(value) \
+    ((value).type == TYPE_STRING || (value).type == TYPE_SHORT_STRING)
+
+#define IS_VECTOR(value) ((value).type == TYPE_VECTOR)
+
 // conversion: C value -> Cog value
 
 #define COG_NUMBER(n) ((Cog_value) { TYPE_NUMBER, .as.number = (n) })
 
+#define COG_INT(i) ((Cog_value) { TYPE_INT, .as.integer = (i) })
+
 #define COG_BOOLEAN(b) ((Cog_value) { TYPE_BOOLEAN, .as.boolean = (b) })
 
 #define COG_NONE ((Cog_value) { TYPE_NONE, .as.number = 0 })
 
+#define COG_SYMBOL(s) ((Cog_value) { TYPE_SYMBOL, .as.symbol = (s) })
+
+// only for long strings; see cog_string_value
+#define COG_STRING(s) ((Cog_value) { TYPE_STRING, .as.string = (s) })
+
+#define COG_VECTOR(v) ((Cog_value) { TYPE_VECTOR, .as.vector = (v) })
+
 // conversion: Cog value -> C value
 
 #define TO_DOUBLE(value) ((value).as.number)
 
+#define TO_INT(value) ((value).as.integer)
+
+// either kind of number, as a double
+#define AS_DOUBLE(value) \
+    (IS_INT(value) ? (double) TO_INT(value) : TO_DOUBLE(value))
+
 #define TO_BOOL(value) ((value).as.boolean)
 
+#define TO_SYMBOL(value) ((value).as.symbol)
+
+#define TO_STRING(value) ((value).as.string)
+
+#define TO_VECTOR(value) ((value).as.vector)
+
 #define IS_TRUTHY(value) \
     ((!IS_NONE(value) && !IS_BOOLEAN(value)) || TO_BOOL(value))
 
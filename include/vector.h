@@ -0,0 +1,67 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Arithmetic and comparisons on vectors, element by element, and their
+// reductions. The kernels come in SSE2 and AVX2 flavors on x86, picked
+// once by what the CPU supports, and in plain C for everything else.
+
+#ifndef COG_VECTOR_H
+#define COG_VECTOR_H
+
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+typedef enum {
+    VECTOR_ADD,
+    VECTOR_SUB,
+    VECTOR_MUL,
+    VECTOR_DIV,
+    VECTOR_LT, // comparisons give masks
+    VECTOR_GT,
+    VECTOR_EQ,
+    VECTOR_OP_COUNT,
+} Vector_op;
+
+// a op b, for two vectors of the same length or a vector and a number on
+// either side, which goes with every element. The result is allocated
+// from arena; false means the operands don't go together
+bool cog_vector_op(Cog_arena *arena, Vector_op op, Cog_value a, Cog_value b,
+        Cog_value *result);
+
+// The mask with 1 where the vector has 0 and 0 elsewhere
+Cog_value cog_vector_not(Cog_arena *arena, Cog_value vector);
+
+double cog_vector_sum(const Cog_vector *vector);
+
+double cog_vector_mean(const Cog_vector *vector);
+
+// NaNs are skipped; an empty vector has the infinity of the other side
+double cog_vector_min(const Cog_vector *vector);
+
+double cog_vector_max(const Cog_vector *vector);
+
+// Which kernels are in use: "avx2", "sse2" or "plain"
+const char *cog_vector_kernels(void);
+
+#endif // COG_VECTOR_H
@@ -24,22 +24,98 @@
 #define COG_VM_H
 
 #include "box.h"
+#include "globals.h"
+#include "memory.h"
+#include "profile.h"
 #include "value.h"
 
+// The budget of an environment that may run forever
+#define COG_BUDGET_UNLIMITED UINT64_MAX
+
+// Deepest nesting of calls, which fail past it
+#define COG_FRAMES_MAX 256
+
+// A call in progress: where to carry on once it returns, and where its
+// arguments start on the stack
+typedef struct {
+    uint8_t *ret_ip;
+    unsigned base;
+} Cog_frame;
+
 typedef struct {
     uint8_t *ip;
+    const Box *box; // being executed, if the execution was stopped midway
+    unsigned block; // the next block of box to be entered, barring jumps
     Cog_array stack;
+    // Set aside along with the environment, so calls allocate nothing
+    Cog_frame frames[COG_FRAMES_MAX];
+    unsigned frame_count;
+    Cog_value ret; // result of the last execution
+    // Results set aside by the last execution of a box compiled from
+    // many expressions (see compile_many), one per expression, in order
+    Cog_array results;
+    // Objects made by the current execution, ret among them, which are
+    // freed as the next one starts
+    Cog_arena arena;
+    // Where global variables are found: a table of its own, unless
+    // given another with cog_env_use_globals
+    Cog_globals *globals;
+    Cog_globals own_globals;
+    // Values of global variables that the current execution replaced,
+    // which it may still hold, freed as the next one starts
+    Cog_array retired;
+    // Instructions left to run, across executions, and the monotonic
+    // time in nanoseconds past which to stop, if not 0. Both are only
+    // checked as each block of the box is entered.
+    uint64_t budget;
+    uint64_t deadline;
+    // Instructions each call to execute() or resume() may run before
+    // suspending, or 0 to run to the end
+    uint64_t slice;
+#ifdef COG_PROFILE
+    Cog_profile *profile; // executions of profile->box are recorded here
+#endif
 } Cog_env;
 
 typedef enum {
     RES_OK,
     RES_ERROR,
+    // These three stop the execution at the start of a block, from
+    // where resume() can carry it on
+    RES_BUDGET_EXHAUSTED,
+    RES_DEADLINE_PASSED,
+    RES_SUSPENDED, // the slice ran out
 } Cog_result;
 
 void cog_env_init(Cog_env *env);
 
+// Makes env find global variables in globals, which may be shared
+void cog_env_use_globals(Cog_env *env, Cog_globals *globals);
+
+// Limits the instructions env may run from now on
+void cog_env_set_budget(Cog_env *env, uint64_t budget);
+
+// Stops executions of env once timeout nanoseconds have passed, or
+// never if timeout is 0
+void cog_env_set_timeout(Cog_env *env, uint64_t timeout);
+
+// Makes every call to execute() or resume() on env run about slice
+// instructions at most, but always at least one block
+void cog_env_set_slice(Cog_env *env, uint64_t slice);
+
+// Empties what the last execution left behind, as another starts
+void cog_env_clear(Cog_env *env);
+
+// Sets a global variable from an execution, keeping what it replaces
+// until the execution is over
+void cog_env_set_global(Cog_env *env, uint32_t slot, Cog_value value);
+
 Cog_result execute(Cog_env *env, const Box *box);
 
+// Carries on with an execution that was stopped before its end, which
+// fails if there is none. The box must not have changed in between.
+Cog_result resume(Cog_env *env);
+
 void cog_env_free(Cog_env *env);
 
 #endif // COG_VM_H
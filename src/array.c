@@ -40,6 +40,7 @@ int cog_array_push(Cog_array *arr, Cog_value value) {
         int new_capacity = arr->capacity * COG_ARRAY_GROWTH_FACTOR;
         arr->data = cog_realloc(arr->data, arr->capacity * sizeof(Cog_value), 
                 new_capacity * sizeof(Cog_value));
+        arr->capacity = new_capacity;
     }
     int index = arr->count++;
     arr->data[index] = value;
@@ -52,6 +53,11 @@ Cog_value cog_array_get(const Cog_array *arr, int index) {
     return arr->data[index];
 }
 
+void cog_array_set(Cog_array *arr, int index, Cog_value value) {
+    if(index >= 0 && index < arr->count)
+        arr->data[index] = value;
+}
+
 Cog_value cog_array_pop(Cog_array *arr) {
     if(arr->count == 0)
         return COG_NONE;
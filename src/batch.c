@@ -0,0 +1,417 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "box.h"
+#include "common.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "memory.h"
+#include "output.h"
+#include "stats.h"
+#include "vm.h"
+
+// Input files
+
+bool batch_file_open(Batch_file *file, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        eprintf("(!) Could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) < 0) {
+        eprintf("(!) Could not read %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    file->data = "";
+    file->size = 0;
+    file->fd = -1;
+    if(!S_ISREG(info.st_mode)) {
+        file->fd = fd;
+        return true;
+    }
+    file->size = (size_t) info.st_size;
+    // empty files can't be mapped
+    if(file->size > 0) {
+        void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) {
+            eprintf("(!) Could not map %s: %s\n", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        // we only ever walk forward through the file
+        posix_madvise(data, file->size, POSIX_MADV_SEQUENTIAL);
+        file->data = data;
+    }
+    // the mapping stays valid without the descriptor
+    close(fd);
+    return true;
+}
+
+void batch_file_close(Batch_file *file) {
+    if(file->size > 0)
+        munmap((void*) file->data, file->size);
+    if(file->fd >= 0)
+        close(file->fd);
+    file->fd = -1;
+    file->data = "";
+    file->size = 0;
+}
+
+// Evaluation
+
+// Runs the code in box, if it compiled, and writes its result. Time is
+// when compiling started.
+static void batch_output(Cog_env *env, Box *box, bool compiled, uint64_t time,
+        Cog_output *out, Cog_stats *stats) {
+    if(stats != NULL)
+        time = cog_stats_record(stats, PHASE_COMPILE, time);
+    if(compiled) {
+        Cog_result res = execute(env, box);
+        if(stats != NULL)
+            cog_stats_record(stats, PHASE_EXECUTE, time);
+        if(res == RES_OK) {
+            cog_output_value(out, env->ret);
+            cog_output_char(out, '\n');
+            return;
+        }
+        eprintf("(!) Runtime error ocurred!\n");
+    }
+    cog_output_write(out, "error\n", 6);
+}
+
+void batch_eval_line(Cog_env *env, Box *box, const char *line, size_t length,
+        Cog_output *out, Cog_stats *stats) {
+    // tolerate DOS line endings
+    if(length > 0 && line[length - 1] == '\r')
+        --length;
+    if(length == 0) {
+        cog_output_char(out, '\n');
+        return;
+    }
+    box_reset(box);
+    uint64_t time = 0;
+    if(stats != NULL) {
+        cog_stats_time_lexer(stats, line, length);
+        time = cog_stats_start(stats);
+    }
+    batch_output(env, box, compile(line, length, box), time, out, stats);
+}
+
+void batch_eval_lines(Cog_env *env, Box *box, const char *data, size_t size,
+        Cog_output *out, Cog_stats *stats) {
+    const char *ptr = data;
+    const char *end = data + size;
+    while(ptr < end) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        const char *line_end = newline != NULL ? newline : end;
+        batch_eval_line(env, box, ptr, line_end - ptr, out, stats);
+        ptr = line_end + 1;
+    }
+}
+
+// Input that can't be mapped is read in blocks of this size
+#define BATCH_BLOCK_SIZE (64 * 1024)
+
+// A line of input that is read in blocks, which is lexed block by block
+typedef struct {
+    Lexer_stream lexer;
+    Token_buffer tokens;
+    Cog_arena arena;
+    size_t length;
+    char last; // character
+    char **blocks; // that the line so far has tokens in
+    int block_count;
+    int block_capacity;
+    char *spare; // block, to be read into next
+} Batch_stream;
+
+static char *stream_block(Batch_stream *st) {
+    char *block = st->spare;
+    st->spare = NULL;
+    return block != NULL ? block : cog_realloc(NULL, 0, BATCH_BLOCK_SIZE);
+}
+
+static void stream_release(Batch_stream *st, char *block) {
+    if(st->spare == NULL)
+        st->spare = block;
+    else
+        free(block);
+}
+
+static void stream_feed(Batch_stream *st, const char *piece, size_t length) {
+    if(length == 0)
+        return;
+    lexer_stream_feed(&st->lexer, piece, length);
+    st->length += length;
+    st->last = piece[length - 1];
+}
+
+// Evaluates the line, once it has all been fed, and starts the next
+static void stream_eval(Batch_stream *st, Cog_env *env, Box *box,
+        Cog_output *out, Cog_stats *stats) {
+    lexer_stream_finish(&st->lexer);
+    // as with whole lines, DOS line endings are tolerated
+    if(st->length == 0 || (st->length == 1 && st->last == '\r')) {
+        cog_output_char(out, '\n');
+    } else {
+        box_reset(box);
+        uint64_t time = stats != NULL ? cog_stats_start(stats) : 0;
+        batch_output(env, box, compile_tokens(&st->tokens, box), time, out, stats);
+    }
+    for(int i = 0; i < st->block_count; ++i)
+        stream_release(st, st->blocks[i]);
+    st->block_count = 0;
+    st->length = 0;
+    cog_arena_reset(&st->arena);
+    lexer_stream_init(&st->lexer, &st->tokens, &st->arena);
+}
+
+// Evaluates every line read from fd, in order, without copying them
+// out of the blocks they are read into, which are kept for as long as
+// the line at their end is not over
+static bool batch_eval_stream(Cog_env *env, Box *box, int fd,
+        Cog_output *out, Cog_stats *stats) {
+    Batch_stream st;
+    cog_arena_init(&st.arena);
+    lexer_stream_init(&st.lexer, &st.tokens, &st.arena);
+    st.length = 0;
+    st.last = '\0';
+    st.blocks = NULL;
+    st.block_count = st.block_capacity = 0;
+    st.spare = NULL;
+    bool alright = true;
+    while(true) {
+        char *block = stream_block(&st);
+        ssize_t size = read(fd, block, BATCH_BLOCK_SIZE);
+        if(size <= 0) {
+            stream_release(&st, block);
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size < 0) {
+                eprintf("(!) Could not read input: %s\n", strerror(errno));
+                alright = false;
+            }
+            break;
+        }
+        const char *ptr = block;
+        const char *end = block + size;
+        const char *newline;
+        while((newline = memchr(ptr, '\n', end - ptr)) != NULL) {
+            stream_feed(&st, ptr, newline - ptr);
+            stream_eval(&st, env, box, out, stats);
+            if(stats != NULL && cog_stats_dump_requested())
+                cog_stats_write_json(stats, stderr);
+            ptr = newline + 1;
+        }
+        if(ptr == end) {
+            stream_release(&st, block);
+            continue;
+        }
+        // the rest of the block starts a line that goes on into the next
+        stream_feed(&st, ptr, end - ptr);
+        if(st.block_count == st.block_capacity) {
+            int capacity = st.block_capacity == 0 ? 4 : 2 * st.block_capacity;
+            st.blocks = cog_realloc(st.blocks, st.block_capacity * sizeof(char*),
+                    capacity * sizeof(char*));
+            st.block_capacity = capacity;
+        }
+        st.blocks[st.block_count++] = block;
+    }
+    // a last line without a newline
+    if(st.length > 0)
+        stream_eval(&st, env, box, out, stats);
+    lexer_stream_finish(&st.lexer);
+    for(int i = 0; i < st.block_count; ++i)
+        free(st.blocks[i]);
+    free(st.blocks);
+    free(st.spare);
+    cog_arena_free(&st.arena);
+    return alright;
+}
+
+bool batch_run_file(const Batch_file *file, Cog_output *out, Cog_stats *stats) {
+    Cog_env env;
+    cog_env_init(&env);
+    Box box;
+    box_init(&box);
+    bool alright = true;
+    if(file->fd >= 0)
+        alright = batch_eval_stream(&env, &box, file->fd, out, stats);
+    const char *ptr = file->data;
+    const char *end = file->data + file->size;
+    while(ptr < end) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        const char *line_end = newline != NULL ? newline : end;
+        batch_eval_line(&env, &box, ptr, line_end - ptr, out, stats);
+        if(stats != NULL && cog_stats_dump_requested())
+            cog_stats_write_json(stats, stderr);
+        ptr = line_end + 1;
+    }
+    box_free(&box);
+    cog_env_free(&env);
+    return alright;
+}
+
+bool batch_run(const char *path, Cog_output *out, Cog_stats *stats) {
+    Batch_file file;
+    if(!batch_file_open(&file, path))
+        return false;
+    bool alright = batch_run_file(&file, out, stats);
+    batch_file_close(&file);
+    return alright;
+}
+
+// Reads all that is left of input that can't be mapped, for evaluations
+// that need every line at once. Returns NULL, after reporting why, if
+// it can't.
+static char *read_whole(int fd, size_t *size) {
+    size_t capacity = BATCH_BLOCK_SIZE;
+    char *data = cog_realloc(NULL, 0, capacity);
+    *size = 0;
+    while(true) {
+        if(*size == capacity) {
+            data = cog_realloc(data, capacity, 2 * capacity);
+            capacity *= 2;
+        }
+        ssize_t count = read(fd, data + *size, capacity - *size);
+        if(count < 0 && errno == EINTR)
+            continue;
+        if(count < 0) {
+            eprintf("(!) Could not read input: %s\n", strerror(errno));
+            free(data);
+            return NULL;
+        }
+        if(count == 0)
+            return data;
+        *size += (size_t) count;
+    }
+}
+
+bool batch_run_rules(const char *path, Cog_output *out, Cog_stats *stats) {
+    Batch_file file;
+    if(!batch_file_open(&file, path))
+        return false;
+    const char *data = file.data;
+    size_t size = file.size;
+    char *whole = NULL;
+    if(file.fd >= 0) {
+        whole = read_whole(file.fd, &size);
+        if(whole == NULL) {
+            batch_file_close(&file);
+            return false;
+        }
+        data = whole;
+    }
+    // every line, so that results can be matched with them, but only
+    // those with something in them are compiled
+    int line_count = 0, rule_count = 0, capacity = 0;
+    const char **sources = NULL;
+    size_t *lengths = NULL;
+    int *rules = NULL; // of each line, or -1
+    const char *ptr = data;
+    const char *end = data + size;
+    while(ptr < end) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        const char *line_end = newline != NULL ? newline : end;
+        size_t length = line_end - ptr;
+        if(length > 0 && ptr[length - 1] == '\r')
+            --length;
+        if(line_count == capacity) {
+            int new_capacity = capacity == 0 ? 64 : 2 * capacity;
+            sources = cog_realloc(sources, capacity * sizeof(const char*),
+                    new_capacity * sizeof(const char*));
+            lengths = cog_realloc(lengths, capacity * sizeof(size_t),
+                    new_capacity * sizeof(size_t));
+            rules = cog_realloc(rules, capacity * sizeof(int),
+                    new_capacity * sizeof(int));
+            capacity = new_capacity;
+        }
+        rules[line_count++] = length > 0 ? rule_count : -1;
+        if(length > 0) {
+            sources[rule_count] = ptr;
+            lengths[rule_count++] = length;
+        }
+        ptr = line_end + 1;
+    }
+
+    // Rules go into as many boxes as their code takes, run one after
+    // another; results are held until the last one has run, so that an
+    // error anywhere still fails them all
+    Cog_env env;
+    cog_env_init(&env);
+    Box box;
+    box_init(&box);
+    Cog_output held;
+    cog_output_init(&held, NULL, COG_OUTPUT_CAPACITY);
+    bool alright = true;
+    int line = 0;
+    for(int first = 0; alright && first < rule_count;) {
+        box_reset(&box);
+        uint64_t time = stats != NULL ? cog_stats_start(stats) : 0;
+        int fitting = compile_many_fitting(sources + first, lengths + first,
+                rule_count - first, &box);
+        if(stats != NULL)
+            time = cog_stats_record(stats, PHASE_COMPILE, time);
+        alright = fitting > 0;
+        if(alright) {
+            alright = execute(&env, &box) == RES_OK;
+            if(stats != NULL)
+                cog_stats_record(stats, PHASE_EXECUTE, time);
+            if(!alright)
+                eprintf("(!) Runtime error ocurred!\n");
+        }
+        for(; alright && line < line_count && rules[line] < first + fitting; ++line) {
+            if(rules[line] >= 0)
+                cog_output_value(&held, cog_array_get(&env.results, rules[line] - first));
+            cog_output_char(&held, '\n');
+        }
+        first += fitting;
+    }
+    // empty lines after the last rule
+    for(; alright && line < line_count; ++line)
+        cog_output_char(&held, '\n');
+    if(alright)
+        cog_output_write(out, held.data, held.count);
+    cog_output_free(&held);
+    free(rules);
+    free(lengths);
+    free(sources);
+    free(whole);
+    box_free(&box);
+    cog_env_free(&env);
+    batch_file_close(&file);
+    return alright;
+}
@@ -21,34 +21,143 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "box.h"
 #include "common.h"
 #include "memory.h"
+#include "opcodes.h"
 
 void box_init(Box *box) {
     box->code = (uint8_t*) cog_realloc(NULL, 0, BOX_CODE_INITIAL_CAPACITY * sizeof(uint8_t));
     cog_array_init(&box->constants, -1);
+    cog_arena_init(&box->arena);
+    box->sites = NULL;
+    box->site_count = 0;
+    box->site_capacity = 0;
     box->capacity = BOX_CODE_INITIAL_CAPACITY;
     box->count = 0;
+    box->blocks = NULL;
+    box->block_count = 0;
+    box->block_capacity = 0;
+    cog_arena_init(&box->ir_arena);
+}
+
+void box_reset(Box *box) {
+    box->count = 0;
+    box->constants.count = 0;
+    cog_arena_reset(&box->arena);
+    box->site_count = 0;
+    box->block_count = 0;
 }
 
 void box_code_write(Box *box, uint8_t byte) {
     if(box->count + 1 > box->capacity) {
         int new_capacity = box->capacity * BOX_CODE_GROWTH_FACTOR;
         box->code = cog_realloc(box->code, box->capacity, new_capacity);
+        box->capacity = new_capacity;
     }
     box->code[box->count++] = byte;
 }
 
-uint8_t box_value_write(Box *box, Cog_value value) {
-    int index = cog_array_push(&box->constants, value);
-    // NOTE this cast is unsafe, but works for now
-    return (uint8_t) index;
+int box_value_write(Box *box, Cog_value value) {
+    return cog_array_push(&box->constants, value);
+}
+
+int box_site_write(Box *box, const Cog_symbol *name) {
+    if(box->site_count + 1 > box->site_capacity) {
+        unsigned new_capacity = box->site_capacity == 0 ? 4
+            : box->site_capacity * BOX_CODE_GROWTH_FACTOR;
+        box->sites = cog_realloc(box->sites, box->site_capacity * sizeof(Box_site),
+                new_capacity * sizeof(Box_site));
+        box->site_capacity = new_capacity;
+    }
+    box->sites[box->site_count] = (Box_site) { name, 0, 0 };
+    return box->site_count++;
+}
+
+unsigned box_instruction_length(uint8_t op) {
+    switch(op) {
+        case OP_PSH: return 2;
+        case OP_GET_LOCAL: return 2;
+        case OP_SET_LOCAL: return 2;
+        case OP_GET_GLOBAL: return 3;
+        case OP_SET_GLOBAL: return 3;
+        case OP_VECTOR: return 3;
+        case OP_JMP: return 3;
+        case OP_JMP_FALSE: return 3;
+        case OP_PSH_LONG: return 4;
+        case OP_CALL: return 4;
+        case OP_TAIL_CALL: return 4;
+        default: return 1;
+    }
+}
+
+static void add_block(Box *box, unsigned end, unsigned cost) {
+    if(box->block_count + 1 > box->block_capacity) {
+        unsigned new_capacity = box->block_capacity == 0 ? 4
+            : box->block_capacity * BOX_CODE_GROWTH_FACTOR;
+        box->blocks = cog_realloc(box->blocks, box->block_capacity * sizeof(Box_block),
+                new_capacity * sizeof(Box_block));
+        box->block_capacity = new_capacity;
+    }
+    box->blocks[box->block_count++] = (Box_block) { end, cost };
+}
+
+unsigned box_jump_target(const Box *box, unsigned offset) {
+    const uint8_t *code = &box->code[offset];
+    if(code[0] == OP_CALL || code[0] == OP_TAIL_CALL)
+        return code[1] | (code[2] << 8);
+    return offset + 3 + (code[1] | (code[2] << 8));
+}
+
+// Calls count, as jumps to the function and back to after them
+static bool is_jump(uint8_t op) {
+    return op == OP_JMP || op == OP_JMP_FALSE || op == OP_CALL || op == OP_TAIL_CALL;
+}
+
+void box_mark_blocks(Box *box) {
+    box->block_count = 0;
+    // blocks start wherever a jump lands...
+    bool *starts = cog_realloc(NULL, 0, box->count + 1);
+    memset(starts, 0, box->count + 1);
+    for(unsigned offset = 0; offset < box->count;
+            offset += box_instruction_length(box->code[offset])) {
+        if(is_jump(box->code[offset]))
+            starts[box_jump_target(box, offset)] = true;
+    }
+    unsigned offset = 0, cost = 0;
+    while(offset < box->count) {
+        if(cost > 0 && starts[offset]) {
+            add_block(box, offset, cost);
+            cost = 0;
+        }
+        uint8_t op = box->code[offset];
+        offset += box_instruction_length(op);
+        ++cost;
+        // ...and end after every jump
+        if(cost == BOX_BLOCK_MAX_LENGTH || op == OP_RET || is_jump(op)
+                || offset >= box->count) {
+            add_block(box, offset, cost);
+            cost = 0;
+        }
+    }
+    free(starts);
 }
 
 void box_free(Box *box) {
     free(box->code);
+    cog_arena_free(&box->arena);
+    cog_arena_free(&box->ir_arena);
+    free(box->sites);
+    box->sites = NULL;
+    box->site_count = 0;
+    box->site_capacity = 0;
+    free(box->blocks);
+    box->blocks = NULL;
+    box->block_count = 0;
+    box->block_capacity = 0;
+    cog_array_free(&box->constants);
     box->capacity = 0;
     box->count = 0;
 }
@@ -20,48 +20,91 @@
    <https://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "box.h"
 #include "common.h"
 #include "compiler.h"
+#include "dag.h"
+#include "intrinsic.h"
+#include "ir.h"
 #include "lexer.h"
+#include "memory.h"
+#include "object.h"
 #include "opcodes.h"
+#include "optimize.h"
+#include "passes.h"
+#include "regalloc.h"
+#include "regbox.h"
+#include "symbol.h"
+
+// Deepest nesting of subexpressions accepted before giving up, which
+// keeps the recursive descent well within the bounds of the C stack
+#define COMPILER_MAX_DEPTH 1024
+
+// Variables in scope at once; their slots are 8 bit operands as well
+#define COMPILER_MAX_LOCALS 256
+
+static int opt_level = PASSES_MAX_LEVEL;
 
 // Parser data structure
 
+// A variable bound by let, a parameter (the index-th of the function
+// it's bound to), or a function
+typedef struct {
+    const char *name;
+    int length;
+    Ir_node *binding;
+    int index;
+    bool function;
+} Local;
+
 typedef struct {
     Token current;
     Token prev;
-    Lexer lex;
+    Token_buffer tokens;
+    unsigned next; // of the tokens, after current
+    int depth;
+    Local locals[COMPILER_MAX_LOCALS];
+    int local_count;
+    int frame_start; // the first local of the function being compiled
     bool panic;
     bool had_error;
 } Parser;
 
-static void parser_init(Parser *pr, const char *source) {
+// The tokens are to be lexed up front, all of them
+static void parser_init(Parser *pr) {
+    pr->next = 0;
+    pr->depth = 0;
+    pr->local_count = 0;
+    pr->frame_start = 0;
     pr->panic = false;
     pr->had_error = false;
-    lexer_init(&pr->lex, source);
 }
-
 // Error reporting
 
 static void parse_error(Parser *pr, const char *format, ...) {
     if(pr->panic) return; // ignore errors on panic mode
     pr->panic = pr->had_error = true;
-    // show error message
-    eprintf("(!) ");
+    // the message is put together first and written in one go, so that
+    // errors from concurrent compilations don't get mixed up
+    char message[256];
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vsnprintf(message, sizeof(message), format, args);
     va_end(args);
     // provide location information
-    if(pr->current.type == TOKEN_END)
-        eprintf(" (END)\n");
-    else
-        eprintf(" (%d:%d)\n", pr->current.line, pr->current.col);
+    if(pr->current.type == TOKEN_END) {
+        eprintf("(!) %s (END)\n", message);
+        return;
+    }
+    int line, col;
+    token_buffer_position(&pr->tokens, pr->next - 1, &line, &col);
+    eprintf("(!) %s (%d:%d)\n", message, line, col);
 }
 
 // Core functions
@@ -70,9 +113,12 @@ static void advance(Parser *pr) {
     pr->prev = pr->current;
     // report bad tokens
     while(true) {
-        pr->current = lexer_get_token(&pr->lex);
+        pr->current = token_buffer_get(&pr->tokens, pr->next);
+        // the end stays current once reached
+        if(pr->current.type == TOKEN_END) break;
+        ++pr->next;
         if(pr->current.type != TOKEN_ERR) break;
-        parse_error(pr, pr->current.start);
+        parse_error(pr, "%s", pr->current.start);
     }
 }
 
@@ -89,73 +135,418 @@ static void expect(Parser *pr, Token_t type) {
         parse_error(pr, "expected token of type %d", type);
 }
 
+
+// Helpers
+
+// Ints that don't fit become doubles. strtod and strtoll need a
+// terminated string, but the source may not have a terminator right
+// after the token (or at all).
+static Cog_value token_number(const Token *tok) {
+    char short_text[64];
+    char *text = tok->offset < (int) sizeof(short_text) ? short_text
+        : cog_realloc(NULL, 0, tok->offset + 1);
+    memcpy(text, tok->start, tok->offset);
+    text[tok->offset] = '\0';
+    Cog_value value;
+    errno = 0;
+    long long integer = tok->type == TOKEN_INT ? strtoll(text, NULL, 10) : 0;
+    if(tok->type == TOKEN_INT && errno != ERANGE)
+        value = COG_INT(integer);
+    else
+        value = COG_NUMBER(strtod(text, NULL));
+    if(text != short_text)
+        free(text);
+    return value;
+}
+
+static Ir_node *make_global(Ir *ir, Ir_tag tag, const Token *name, Ir_node *value) {
+    Ir_node *node = ir_node(ir, tag, tag == IR_SET_GLOBAL ? 1 : 0);
+    node->as.name = cog_symbol_intern(name->start, name->offset);
+    if(tag == IR_SET_GLOBAL)
+        node->operands[0] = value;
+    ir_finish(ir, node);
+    return node;
+}
+
+// Parses expressions separated by commas, up to but not including the
+// closing token, into an array the caller frees
+static Ir_node **parse_items(Parser *pr, Ir *ir, Token_t close, unsigned *count);
+
+// Whether the token after the current one is of the given type
+static bool next_is(const Parser *pr, Token_t type) {
+    return pr->tokens.types[pr->next] == type;
+}
+
+// The innermost variable called by the token, or NULL
+static const Local *resolve_local(const Parser *pr, const Token *name) {
+    for(int i = pr->local_count - 1; i >= 0; --i) {
+        const Local *local = &pr->locals[i];
+        if(local->length == name->offset
+                && memcmp(local->name, name->start, name->offset) == 0)
+            return local;
+    }
+    return NULL;
+}
+
 // Parsing functions
 
-static void parse_disj(Parser *pr, Box *box);
+static Ir_node *parse_disj(Parser *pr, Ir *ir);
+
+static Ir_node *parse_expr(Parser *pr, Ir *ir) {
+    return parse_disj(pr, ir);
+}
+
+static Ir_node **parse_items(Parser *pr, Ir *ir, Token_t close, unsigned *count) {
+    Ir_node **items = NULL;
+    unsigned capacity = 0;
+    *count = 0;
+    if(pr->current.type == close)
+        return NULL;
+    do {
+        if(*count == capacity) {
+            unsigned new_capacity = capacity == 0 ? 8 : 2 * capacity;
+            items = cog_realloc(items, capacity * sizeof(Ir_node*),
+                    new_capacity * sizeof(Ir_node*));
+            capacity = new_capacity;
+        }
+        items[(*count)++] = parse_expr(pr, ir);
+    } while(match(pr, TOKEN_COMMA) && !pr->had_error);
+    return items;
+}
+
+// if condition then value else value
+static Ir_node *parse_if(Parser *pr, Ir *ir) {
+    Ir_node *node = ir_node(ir, IR_IF, 3);
+    node->operands[0] = parse_expr(pr, ir);
+    if(!match(pr, TOKEN_THEN)) {
+        parse_error(pr, "Expected 'then' after the condition");
+        return NULL;
+    }
+    node->operands[1] = parse_expr(pr, ir);
+    if(!match(pr, TOKEN_ELSE)) {
+        parse_error(pr, "Expected 'else' after the first branch");
+        return NULL;
+    }
+    node->operands[2] = parse_expr(pr, ir);
+    ir_finish(ir, node);
+    return node;
+}
+
+// The instruction of the intrinsic called by the token
+static Op_code intrinsic_op(Token_t type) {
+    switch(type) {
+        case TOKEN_SQRT: return OP_SQRT;
+        case TOKEN_ABS: return OP_ABS;
+        case TOKEN_FLOOR: return OP_FLOOR;
+        case TOKEN_EXP: return OP_EXP;
+        case TOKEN_LOG: return OP_LOG;
+        case TOKEN_MIN: return OP_MIN;
+        case TOKEN_MAX: return OP_MAX;
+        case TOKEN_POW: return OP_POW;
+        case TOKEN_SUM: return OP_SUM;
+        default: return OP_MEAN;
+    }
+}
+
+// name(x) or name(x, y), which runs as a single instruction rather than
+// as a call
+static Ir_node *parse_intrinsic(Parser *pr, Ir *ir) {
+    Token name = pr->prev;
+    Op_code op = intrinsic_op(name.type);
+    // reductions of vectors take one argument too
+    int arity = cog_intrinsic_arity(op);
+    if(!match(pr, TOKEN_OPEN_PAREN)) {
+        parse_error(pr, "Expected '(' after '%.*s'", name.offset, name.start);
+        return NULL;
+    }
+    Ir_node *first = parse_expr(pr, ir), *second = NULL;
+    // min and max of a single vector are its least and greatest elements
+    if((op == OP_MIN || op == OP_MAX) && pr->current.type == TOKEN_CLOSE_PAREN) {
+        op = op == OP_MIN ? OP_MIN_OF : OP_MAX_OF;
+        arity = 0;
+    }
+    if(arity == 2) {
+        if(!match(pr, TOKEN_COMMA)) {
+            parse_error(pr, "'%.*s' takes two arguments", name.offset, name.start);
+            return NULL;
+        }
+        second = parse_expr(pr, ir);
+    }
+    if(pr->current.type == TOKEN_COMMA) {
+        parse_error(pr, "'%.*s' takes %s", name.offset, name.start,
+                arity == 2 ? "two arguments" : "one argument");
+        return NULL;
+    }
+    if(!match(pr, TOKEN_CLOSE_PAREN)) {
+        parse_error(pr, "Expected ')' after the arguments");
+        return NULL;
+    }
+    if(arity == 2)
+        return ir_binary(ir, op, first, second);
+    return ir_unary(ir, op, first);
+}
+
+// [x, y, ...] with numbers for elements
+static Ir_node *parse_vector(Parser *pr, Ir *ir) {
+    unsigned length;
+    Ir_node **elements = parse_items(pr, ir, TOKEN_CLOSE_BRACKET, &length);
+    Ir_node *node = NULL;
+    if(length > UINT16_MAX) {
+        parse_error(pr, "Too many elements in one vector");
+    } else if(!match(pr, TOKEN_CLOSE_BRACKET)) {
+        parse_error(pr, "Expected ']' after the elements");
+    } else {
+        node = ir_node(ir, IR_OP, length);
+        node->op = OP_VECTOR;
+        if(length > 0)
+            memcpy(node->operands, elements, length * sizeof(Ir_node*));
+        ir_finish(ir, node);
+    }
+    free(elements);
+    return node;
+}
+
+// let name(a, b, ...) = value in body
+//
+// Functions don't see the values bound around them; they only take
+// arguments.
+static Ir_node *parse_function(Parser *pr, Ir *ir, const Token *name) {
+    if(pr->local_count == COMPILER_MAX_LOCALS) {
+        parse_error(pr, "Too many variables in one expression");
+        return NULL;
+    }
+    Ir_node *node = ir_node(ir, IR_FUNCTION, 2);
+    // in scope of its own body, for recursion
+    Local *function = &pr->locals[pr->local_count++];
+    *function = (Local) { name->start, name->offset, node, 0, true };
+    int outer_frame = pr->frame_start;
+    pr->frame_start = pr->local_count;
+    int arity = 0;
+    if(!match(pr, TOKEN_CLOSE_PAREN)) {
+        do {
+            if(!match(pr, TOKEN_ID)) {
+                parse_error(pr, "Expected a parameter name");
+                return NULL;
+            }
+            if(pr->local_count == COMPILER_MAX_LOCALS || arity > UINT8_MAX) {
+                parse_error(pr, "Too many parameters");
+                return NULL;
+            }
+            pr->locals[pr->local_count++] =
+                (Local) { pr->prev.start, pr->prev.offset, node, arity++, false };
+        } while(match(pr, TOKEN_COMMA));
+        if(!match(pr, TOKEN_CLOSE_PAREN)) {
+            parse_error(pr, "Expected ')' after the parameters");
+            return NULL;
+        }
+    }
+    node->index = arity;
+    if(!match(pr, TOKEN_EQUAL)) {
+        parse_error(pr, "Expected '=' after the parameters");
+        return NULL;
+    }
+    node->operands[0] = parse_expr(pr, ir);
+    pr->local_count = pr->frame_start;
+    pr->frame_start = outer_frame;
+    if(!match(pr, TOKEN_IN)) {
+        parse_error(pr, "Expected 'in' after the function");
+        return NULL;
+    }
+    node->operands[1] = parse_expr(pr, ir);
+    --pr->local_count;
+    ir_finish(ir, node);
+    return node;
+}
+
+// name(x, y, ...), for a function bound by let
+static Ir_node *parse_call(Parser *pr, Ir *ir, const Local *function) {
+    Token name = pr->prev;
+    advance(pr); // the parenthesis
+    unsigned count;
+    Ir_node **arguments = parse_items(pr, ir, TOKEN_CLOSE_PAREN, &count);
+    Ir_node *node = NULL;
+    if(!match(pr, TOKEN_CLOSE_PAREN)) {
+        parse_error(pr, "Expected ')' after the arguments");
+    } else if((int) count != function->binding->index) {
+        parse_error(pr, "'%.*s' takes %d arguments, not %u",
+                name.offset, name.start, function->binding->index, count);
+    } else {
+        node = ir_node(ir, IR_CALL, count);
+        node->as.binding = function->binding;
+        if(count > 0)
+            memcpy(node->operands, arguments, count * sizeof(Ir_node*));
+        ir_finish(ir, node);
+    }
+    free(arguments);
+    return node;
+}
 
-static void parse_expr(Parser *pr, Box *box) { 
-    parse_disj(pr, box); 
+// let name = value in body
+static Ir_node *parse_let(Parser *pr, Ir *ir) {
+    if(!match(pr, TOKEN_ID)) {
+        parse_error(pr, "Expected a name after 'let'");
+        return NULL;
+    }
+    Token name = pr->prev;
+    if(match(pr, TOKEN_OPEN_PAREN))
+        return parse_function(pr, ir, &name);
+    if(!match(pr, TOKEN_EQUAL)) {
+        parse_error(pr, "Expected '=' after the name being bound");
+        return NULL;
+    }
+    Ir_node *node = ir_node(ir, IR_LET, 2);
+    node->operands[0] = parse_expr(pr, ir);
+    if(!match(pr, TOKEN_IN)) {
+        parse_error(pr, "Expected 'in' after the value being bound");
+        return NULL;
+    }
+    if(pr->local_count == COMPILER_MAX_LOCALS) {
+        parse_error(pr, "Too many variables in one expression");
+        return NULL;
+    }
+    pr->locals[pr->local_count++] = (Local) { name.start, name.offset, node, 0, false };
+    node->operands[1] = parse_expr(pr, ir);
+    --pr->local_count;
+    ir_finish(ir, node);
+    return node;
 }
 
-static void parse_value(Parser *pr, Box *box) {
+static Ir_node *parse_value(Parser *pr, Ir *ir) {
     switch(pr->current.type) {
         case TOKEN_NUM:
+        case TOKEN_INT:
             advance(pr);
-            double val = strtod(pr->prev.start, NULL);
-            uint8_t i = box_value_write(box, COG_NUMBER(val));
-            box_code_write(box, OP_PSH);
-            box_code_write(box, i);
-            break;
+            return ir_constant(ir, token_number(&pr->prev));
+
+        case TOKEN_SYM:
+            advance(pr);
+            return ir_constant(ir, COG_SYMBOL(
+                        cog_symbol_intern(pr->prev.start, pr->prev.offset)));
+
+        case TOKEN_ID: {
+            // names not bound by let are global variables
+            bool assignment = next_is(pr, TOKEN_EQUAL);
+            bool call = next_is(pr, TOKEN_OPEN_PAREN);
+            advance(pr);
+            Token name = pr->prev;
+            const Local *local = resolve_local(pr, &name);
+            if(local != NULL && local->function) {
+                if(call)
+                    return parse_call(pr, ir, local);
+                parse_error(pr, "'%.*s' is a function, which can only be called",
+                        name.offset, name.start);
+            } else if(call) {
+                parse_error(pr, "'%.*s' is not a function", name.offset, name.start);
+            } else if(local != NULL && local - pr->locals < pr->frame_start) {
+                parse_error(pr, "Functions can't use '%.*s', which is bound outside of them",
+                        name.offset, name.start);
+            } else if(assignment) {
+                advance(pr);
+                if(local != NULL) {
+                    parse_error(pr, "Cannot assign to '%.*s', which is bound by let",
+                            name.offset, name.start);
+                    return NULL;
+                }
+                return make_global(ir, IR_SET_GLOBAL, &name, parse_expr(pr, ir));
+            } else if(local != NULL) {
+                Ir_node *node = ir_node(ir, IR_LOCAL, 0);
+                node->as.binding = local->binding;
+                node->index = local->index;
+                ir_finish(ir, node);
+                return node;
+            } else {
+                return make_global(ir, IR_GET_GLOBAL, &name, NULL);
+            }
+            return NULL;
+        }
+
+        case TOKEN_LET:
+            advance(pr);
+            return parse_let(pr, ir);
+
+        case TOKEN_IF:
+            advance(pr);
+            return parse_if(pr, ir);
+
+        case TOKEN_SQRT:
+        case TOKEN_ABS:
+        case TOKEN_FLOOR:
+        case TOKEN_EXP:
+        case TOKEN_LOG:
+        case TOKEN_MIN:
+        case TOKEN_MAX:
+        case TOKEN_POW:
+        case TOKEN_SUM:
+        case TOKEN_MEAN:
+            advance(pr);
+            return parse_intrinsic(pr, ir);
+
+        case TOKEN_OPEN_BRACKET:
+            advance(pr);
+            return parse_vector(pr, ir);
+
+        case TOKEN_STR:
+            advance(pr);
+            return ir_constant(ir, cog_string_value(&ir->box->arena,
+                        pr->prev.start, pr->prev.offset));
 
         case TOKEN_TRUE:
             advance(pr);
-            box_code_write(box, OP_PSH_TRUE);
-            break;
+            return ir_constant(ir, COG_BOOLEAN(true));
 
         case TOKEN_FALSE:
             advance(pr);
-            box_code_write(box, OP_PSH_FALSE);
-            break;
+            return ir_constant(ir, COG_BOOLEAN(false));
 
         case TOKEN_NONE:
             advance(pr);
-            box_code_write(box, OP_PSH_NONE);
-            break;
+            return ir_constant(ir, COG_NONE);
 
-        case TOKEN_OPEN_PAREN: // parenthesized expression
+        case TOKEN_OPEN_PAREN: { // parenthesized expression
             advance(pr);
-            parse_expr(pr, box);
+            Ir_node *node = parse_expr(pr, ir);
             expect(pr, TOKEN_CLOSE_PAREN);
-            break;
+            return node;
+        }
 
         default:
             parse_error(pr, "Missing operand");
+            return NULL;
     }
 }
 
-static void parse_unary(Parser *pr, Box *box) {
+static Ir_node *parse_unary(Parser *pr, Ir *ir) {
+    // Every level of nesting passes through here
+    if(pr->depth == COMPILER_MAX_DEPTH) {
+        parse_error(pr, "Expression nested too deeply");
+        while(pr->current.type != TOKEN_END)
+            advance(pr);
+        return NULL;
+    }
+    ++pr->depth;
+    Ir_node *node;
     switch(pr->current.type) {
         case TOKEN_MINUS:
             advance(pr);
-            parse_unary(pr, box);
-            box_code_write(box, OP_NEG);
+            node = ir_unary(ir, OP_NEG, parse_unary(pr, ir));
             break;
 
         case TOKEN_NOT:
             advance(pr);
-            parse_unary(pr, box);
-            box_code_write(box, OP_NOT);
+            node = ir_unary(ir, OP_NOT, parse_unary(pr, ir));
             break;
 
         default:
-            parse_value(pr, box);
+            node = parse_value(pr, ir);
             break;
     }
+    --pr->depth;
+    return node;
 }
 
-static void parse_prod(Parser *pr, Box *box) {
+static Ir_node *parse_prod(Parser *pr, Ir *ir) {
     Op_code op;
-    parse_unary(pr, box);
+    Ir_node *node = parse_unary(pr, ir);
     while(match(pr, TOKEN_STAR) || match(pr, TOKEN_SLASH)) {
         switch(pr->prev.type) {
             case TOKEN_STAR:
@@ -167,14 +558,14 @@ static void parse_prod(Parser *pr, Box *box) {
             default:
                 break;
         }
-        parse_unary(pr, box);
-        box_code_write(box, op);
+        node = ir_binary(ir, op, node, parse_unary(pr, ir));
     }
+    return node;
 }
 
-static void parse_sum(Parser *pr, Box *box) {
+static Ir_node *parse_sum(Parser *pr, Ir *ir) {
     Op_code op;
-    parse_prod(pr, box);
+    Ir_node *node = parse_prod(pr, ir);
     while(match(pr, TOKEN_PLUS) || match(pr, TOKEN_MINUS)) {
         switch(pr->prev.type) {
             case TOKEN_PLUS:
@@ -187,16 +578,16 @@ static void parse_sum(Parser *pr, Box *box) {
                 // unreachable
                 break;
         }
-        parse_prod(pr, box);
-        box_code_write(box, op);
+        node = ir_binary(ir, op, node, parse_prod(pr, ir));
     }
+    return node;
 }
 
 // <, >, >=, <=
-static void parse_comparison(Parser *pr, Box *box) {
+static Ir_node *parse_comparison(Parser *pr, Ir *ir) {
     Op_code op;
     bool negate = false;
-    parse_sum(pr, box);
+    Ir_node *node = parse_sum(pr, ir);
     while(match(pr, TOKEN_LESS) || match(pr, TOKEN_LESS_EQUAL) ||
             match(pr, TOKEN_GREATER) || match(pr, TOKEN_GREATER_EQUAL)) {
         switch(pr->prev.type) {
@@ -220,51 +611,135 @@ static void parse_comparison(Parser *pr, Box *box) {
                 // unreachable
                 break;
         }
-        parse_sum(pr, box);
-        box_code_write(box, op);
-        if(negate) box_code_write(box, OP_NOT);
+        node = ir_binary(ir, op, node, parse_sum(pr, ir));
+        if(negate) node = ir_unary(ir, OP_NOT, node);
     }
+    return node;
 }
 
 // ==, !=
-static void parse_equality(Parser *pr, Box *box) {
+static Ir_node *parse_equality(Parser *pr, Ir *ir) {
     bool negate = false;
-    parse_comparison(pr, box);
+    Ir_node *node = parse_comparison(pr, ir);
     while(match(pr, TOKEN_EQUAL_EQUAL) || match(pr, TOKEN_NOT_EQUAL)) {
         if(pr->prev.type == TOKEN_NOT_EQUAL)
             negate = true;
-        parse_comparison(pr, box);
-        box_code_write(box, OP_EQ);
-        if(negate) box_code_write(box, OP_NOT);
+        node = ir_binary(ir, OP_EQ, node, parse_comparison(pr, ir));
+        if(negate) node = ir_unary(ir, OP_NOT, node);
     }
+    return node;
 }
 
-static void parse_conj(Parser *pr, Box *box) {
-    parse_equality(pr, box);
-    while(match(pr, TOKEN_AND)) {
-        parse_equality(pr, box);
-        box_code_write(box, OP_AND);
-    }
+static Ir_node *parse_conj(Parser *pr, Ir *ir) {
+    Ir_node *node = parse_equality(pr, ir);
+    while(match(pr, TOKEN_AND))
+        node = ir_binary(ir, OP_AND, node, parse_equality(pr, ir));
+    return node;
 }
 
-static void parse_disj(Parser *pr, Box *box) {
-    parse_conj(pr, box);
-    while(match(pr, TOKEN_OR)) {
-        parse_conj(pr, box);
-        box_code_write(box, OP_OR);
-    }
+static Ir_node *parse_disj(Parser *pr, Ir *ir) {
+    Ir_node *node = parse_conj(pr, ir);
+    while(match(pr, TOKEN_OR))
+        node = ir_binary(ir, OP_OR, node, parse_conj(pr, ir));
+    return node;
 }
 
 // Public interface
 
-bool compile(const char *source, Box *box) {
+void compile_set_level(int level) {
+    opt_level = level < 0 ? 0 : level > PASSES_MAX_LEVEL ? PASSES_MAX_LEVEL : level;
+}
+
+// Parses the tokens of the parser into the IR of box, and optimizes it.
+// Returns its root, or NULL after reporting what is wrong with it.
+static Ir_node *parse_tokens(Parser *pr, Box *box, Ir *ir) {
+    ir_init(ir, box, &box->ir_arena);
+    advance(pr);
+    Ir_node *root = parse_expr(pr, ir);
+    if(pr->current.type != TOKEN_END)
+        parse_error(pr, "Malformed expression");
+    if(ir->too_deep)
+        parse_error(pr, "Expression nested too deeply");
+    if(pr->had_error)
+        return NULL;
+    return passes_run(ir, root, opt_level);
+}
+
+// Lexes the whole source into the IR arena of box, and parses that
+static Ir_node *build_ir(const char *source, size_t length, Box *box, Ir *ir) {
+    Parser parser;
+    cog_arena_reset(&box->ir_arena);
+    parser_init(&parser);
+    lexer_tokenize(&parser.tokens, source, length, &box->ir_arena);
+    return parse_tokens(&parser, box, ir);
+}
+
+// Compiles one expression onto the end of the code of box, up to and
+// including its ret
+static bool compile_expression(const char *source, size_t length, Box *box) {
+    Ir ir;
+    Ir_node *root = build_ir(source, length, box, &ir);
+    return root != NULL && ir_lower(&ir, root);
+}
+
+// Finishes the code of box, once every expression in it is compiled
+static bool compile_finish(Box *box, bool alright) {
+    if(alright)
+        optimize_jumps(box, opt_level);
+    box_mark_blocks(box);
+    return alright;
+}
+
+bool compile(const char *source, size_t length, Box *box) {
+    return compile_finish(box, compile_expression(source, length, box));
+}
+
+bool compile_tokens(const Token_buffer *tokens, Box *box) {
     Parser parser;
-    parser_init(&parser, source);
-    advance(&parser);
-    parse_expr(&parser, box);
-    if(parser.current.type != TOKEN_END)
-        parse_error(&parser, "Malformed expression");
-    box_code_write(box, OP_RET);
-
-    return !parser.had_error;
+    Ir ir;
+    cog_arena_reset(&box->ir_arena);
+    parser_init(&parser);
+    parser.tokens = *tokens;
+    Ir_node *root = parse_tokens(&parser, box, &ir);
+    return compile_finish(box, root != NULL && ir_lower(&ir, root));
+}
+
+bool compile_many(const char *const *sources, const size_t *lengths, int count,
+        Box *box) {
+    Dag_region *regions = cog_realloc(NULL, 0, (count + 1) * sizeof(Dag_region));
+    bool alright = true;
+    for(int i = 0; i < count; ++i) {
+        regions[i].start = box->count;
+        alright = compile_expression(sources[i], lengths[i], box) && alright;
+        regions[i].end = box->count;
+    }
+    if(alright)
+        alright = dag_combine(box, regions, count);
+    free(regions);
+
+    return compile_finish(box, alright);
+}
+
+int compile_many_fitting(const char *const *sources, const size_t *lengths, int count,
+        Box *box) {
+    Dag_region *regions = cog_realloc(NULL, 0, (count + 1) * sizeof(Dag_region));
+    bool alright = true;
+    int fitting = 0;
+    while(fitting < count && (fitting == 0 || box->count < COMPILER_MANY_CODE_BUDGET)) {
+        regions[fitting].start = box->count;
+        alright = compile_expression(sources[fitting], lengths[fitting], box) && alright;
+        regions[fitting].end = box->count;
+        ++fitting;
+    }
+    if(alright)
+        alright = dag_combine(box, regions, fitting);
+    free(regions);
+
+    return compile_finish(box, alright) ? fitting : 0;
+}
+
+bool compile_registers(const char *source, size_t length, Reg_box *rbox) {
+    Ir ir;
+    Ir_node *root = build_ir(source, length, &rbox->box, &ir);
+    return root != NULL && reg_lower(&ir, root, rbox);
 }
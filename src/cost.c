@@ -0,0 +1,469 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "box.h"
+#include "common.h"
+#include "cost.h"
+#include "memory.h"
+#include "object.h"
+#include "opcodes.h"
+#include "value.h"
+
+// What each instruction costs, relative to a psh. These come from
+// fitting the times of a few thousand generated expressions without
+// branches to how many of each instruction they run. The execute
+// benchmarks of bench/ print how many nanoseconds a unit comes to for
+// each shape of corpus, which stays close across shapes for as long as
+// these hold.
+static const double weights[OP_COUNT] = {
+    [OP_NEG] = 0.5,
+    [OP_ADD] = 0.5,
+    [OP_SUB] = 0.5,
+    [OP_MUL] = 0.5,
+    [OP_DIV] = 1.3,
+    [OP_SQRT] = 1.0,
+    [OP_ABS] = 1.0,
+    [OP_FLOOR] = 1.0,
+    [OP_EXP] = 1.3,
+    [OP_LOG] = 1.3,
+    [OP_MIN] = 1.0,
+    [OP_MAX] = 1.0,
+    [OP_POW] = 1.3,
+    [OP_VECTOR] = 1.0,
+    [OP_SUM] = 1.0,
+    [OP_MEAN] = 1.0,
+    [OP_MIN_OF] = 1.0,
+    [OP_MAX_OF] = 1.0,
+    [OP_NOT] = 1.0,
+    [OP_EQ] = 2.0,
+    [OP_LT] = 1.0,
+    [OP_GT] = 1.0,
+    [OP_AND] = 1.0,
+    [OP_OR] = 1.0,
+    [OP_PSH] = 1.0,
+    [OP_PSH_LONG] = 1.0,
+    [OP_PSH_TRUE] = 1.0,
+    [OP_PSH_FALSE] = 1.0,
+    [OP_PSH_NONE] = 1.0,
+    [OP_GET_LOCAL] = 1.3,
+    [OP_SET_LOCAL] = 0.3,
+    [OP_GET_GLOBAL] = 1.0,
+    [OP_SET_GLOBAL] = 1.5,
+    [OP_JMP] = 0.8,
+    [OP_JMP_FALSE] = 1.0,
+    [OP_CALL] = 2.0,
+    [OP_TAIL_CALL] = 2.0,
+    [OP_RET] = 0.6,
+    [OP_RESULT] = 1.0,
+};
+
+// On top of those, for each object made, and each element of a vector
+// or byte of a string worked on
+#define COST_OBJECT 4.0
+#define COST_ELEMENT 0.025
+#define COST_BYTE 0.02
+
+// Vectors whose length can't be told from the code are taken to be
+// this long
+#define COST_GUESSED_LENGTH 16
+
+// How the stack changes, for all but vector and the calls, whose
+// operands say
+static const int effects[OP_COUNT] = {
+    [OP_NEG] = 0,
+    [OP_ADD] = -1,
+    [OP_SUB] = -1,
+    [OP_MUL] = -1,
+    [OP_DIV] = -1,
+    [OP_SQRT] = 0,
+    [OP_ABS] = 0,
+    [OP_FLOOR] = 0,
+    [OP_EXP] = 0,
+    [OP_LOG] = 0,
+    [OP_MIN] = -1,
+    [OP_MAX] = -1,
+    [OP_POW] = -1,
+    [OP_SUM] = 0,
+    [OP_MEAN] = 0,
+    [OP_MIN_OF] = 0,
+    [OP_MAX_OF] = 0,
+    [OP_NOT] = 0,
+    [OP_EQ] = -1,
+    [OP_LT] = -1,
+    [OP_GT] = -1,
+    [OP_AND] = -1,
+    [OP_OR] = -1,
+    [OP_PSH] = 1,
+    [OP_PSH_LONG] = 1,
+    [OP_PSH_TRUE] = 1,
+    [OP_PSH_FALSE] = 1,
+    [OP_PSH_NONE] = 1,
+    [OP_GET_LOCAL] = 1,
+    [OP_SET_LOCAL] = -1,
+    [OP_GET_GLOBAL] = 1,
+    [OP_SET_GLOBAL] = 0,
+    [OP_JMP] = 0,
+    [OP_JMP_FALSE] = -1,
+    [OP_RET] = -1,
+    [OP_RESULT] = -1,
+};
+
+// What little is known of a value on the stack, which is enough to cost
+// the work done on each element of vectors and each byte of strings
+typedef enum {
+    COST_SCALAR, // or unknown
+    COST_VECTOR,
+    COST_STRING,
+} Cost_kind;
+
+typedef struct {
+    Cost_kind kind;
+    uint32_t length;
+} Cost_value;
+
+// The values on the stack, as they are along the code taken in order.
+// Where ways through the code join, only the height is kept track of,
+// and values that were not there are taken to be scalars.
+typedef struct {
+    Cost_value *values;
+    int count;
+    int capacity;
+} Cost_stack;
+
+// The most that the ways into an instruction add up to
+typedef struct {
+    unsigned owner; // the entry of the code it belongs to, plus one
+    int height; // of the stack as it starts
+    double cost;
+    unsigned instructions;
+} Cost_site;
+
+// The most that the ways through a function, or the whole code, add up
+// to, relative to where its frame starts on the stack
+typedef struct {
+    unsigned entry;
+    double cost;
+    unsigned instructions;
+    unsigned stack;
+    bool active; // being worked out, so calling it again is recursion
+} Cost_function;
+
+typedef struct {
+    const Box *box;
+    Cost_site *sites; // one for every offset into the code
+    Cost_function *functions;
+    int function_count;
+    int function_capacity;
+    bool bounded;
+} Analysis;
+
+static unsigned operand16(const Box *box, unsigned offset) {
+    return box->code[offset + 1] | (box->code[offset + 2] << 8);
+}
+
+// What is known of the constant pushed by the instruction at offset
+static Cost_value constant_at(const Box *box, unsigned offset) {
+    unsigned index = box->code[offset + 1];
+    if(box->code[offset] == OP_PSH_LONG)
+        index = operand16(box, offset) | (box->code[offset + 3] << 16);
+    Cog_value value = cog_array_get(&box->constants, index);
+    if(IS_VECTOR(value))
+        return (Cost_value) { COST_VECTOR, TO_VECTOR(value)->length };
+    if(IS_STRING(value)) {
+        size_t length;
+        cog_string_chars(&value, &length);
+        return (Cost_value) { COST_STRING, (uint32_t) length };
+    }
+    return (Cost_value) { COST_SCALAR, 0 };
+}
+
+static const Cost_value scalar = { COST_SCALAR, 0 };
+
+// Makes the stack count values high, with scalars for any it gains
+static void stack_resize(Cost_stack *st, int count) {
+    // with room for one more, which any instruction pushes at most
+    if(count + 1 > st->capacity) {
+        int capacity = count + 1 > 2 * st->capacity ? count + 1 : 2 * st->capacity;
+        st->values = cog_realloc(st->values, st->capacity * sizeof(Cost_value),
+                capacity * sizeof(Cost_value));
+        st->capacity = capacity;
+    }
+    for(int i = st->count; i < count; ++i)
+        st->values[i] = scalar;
+    st->count = count;
+}
+
+static Cost_value stack_pop(Cost_stack *st) {
+    return st->count > 0 ? st->values[--st->count] : scalar;
+}
+
+static void stack_push(Cost_stack *st, Cost_value value) {
+    st->values[st->count++] = value;
+}
+
+// Plays the instruction at offset on the stack, as far as the values it
+// knows of go, and returns what it costs on top of its weight. The
+// stack is left for the caller to set to the right height after
+// instructions that make nothing of interest.
+static double play(Cost_stack *st, const Box *box, unsigned offset) {
+    uint8_t op = box->code[offset];
+    switch(op) {
+        case OP_PSH:
+        case OP_PSH_LONG:
+            stack_push(st, constant_at(box, offset));
+            return 0.0;
+        case OP_GET_LOCAL: {
+            int slot = box->code[offset + 1];
+            stack_push(st, slot < st->count ? st->values[slot] : scalar);
+            return 0.0;
+        }
+        case OP_SET_LOCAL: {
+            int slot = box->code[offset + 1];
+            Cost_value value = stack_pop(st);
+            if(slot < st->count)
+                st->values[slot] = value;
+            return 0.0;
+        }
+        case OP_VECTOR: {
+            unsigned length = operand16(box, offset);
+            for(unsigned i = 0; i < length; ++i)
+                stack_pop(st);
+            stack_push(st, (Cost_value) { COST_VECTOR, length });
+            return COST_OBJECT + COST_ELEMENT * length;
+        }
+        case OP_SUM:
+        case OP_MEAN:
+        case OP_MIN_OF:
+        case OP_MAX_OF: {
+            Cost_value value = stack_pop(st);
+            stack_push(st, scalar);
+            return COST_ELEMENT * (value.kind == COST_VECTOR ? value.length
+                    : COST_GUESSED_LENGTH);
+        }
+        case OP_NEG:
+        case OP_NOT:
+        case OP_SQRT:
+        case OP_ABS:
+        case OP_FLOOR:
+        case OP_EXP:
+        case OP_LOG: {
+            // vectors are worked on element by element into new ones
+            Cost_value value = stack_pop(st);
+            if(value.kind != COST_VECTOR) {
+                stack_push(st, scalar);
+                return 0.0;
+            }
+            stack_push(st, value);
+            return COST_OBJECT + COST_ELEMENT * value.length;
+        }
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_POW:
+        case OP_EQ:
+        case OP_LT:
+        case OP_GT:
+        case OP_AND:
+        case OP_OR: {
+            Cost_value b = stack_pop(st);
+            Cost_value a = stack_pop(st);
+            if(a.kind == COST_VECTOR || b.kind == COST_VECTOR) {
+                uint32_t length = a.length > b.length ? a.length : b.length;
+                stack_push(st, (Cost_value) { COST_VECTOR, length });
+                return COST_OBJECT + COST_ELEMENT * length;
+            }
+            if(a.kind == COST_STRING && b.kind == COST_STRING) {
+                if(op == OP_ADD) {
+                    stack_push(st, (Cost_value) { COST_STRING, a.length + b.length });
+                    return COST_OBJECT + COST_BYTE * (a.length + b.length);
+                }
+                stack_push(st, scalar);
+                return COST_BYTE * (a.length < b.length ? a.length : b.length);
+            }
+            stack_push(st, scalar);
+            return 0.0;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            // nothing is known of what functions return
+            stack_resize(st, st->count - box->code[offset + 3]);
+            return 0.0;
+        default:
+            return 0.0;
+    }
+}
+
+// Makes a way into the instruction at offset, of the code at owner
+static void reach(Analysis *an, unsigned offset, unsigned owner, int height,
+        double cost, unsigned instructions) {
+    if(offset >= an->box->count)
+        return;
+    Cost_site *site = &an->sites[offset];
+    if(site->owner != owner) {
+        site->owner = owner;
+        site->height = height;
+        site->cost = cost;
+        site->instructions = instructions;
+        return;
+    }
+    if(height > site->height) site->height = height;
+    if(cost > site->cost) site->cost = cost;
+    if(instructions > site->instructions) site->instructions = instructions;
+}
+
+static const Cost_function *walk(Analysis *an, unsigned entry, int height);
+
+// The function at entry, worked out the first time it's called
+static Cost_function function_at(Analysis *an, unsigned entry, int arguments) {
+    for(int i = 0; i < an->function_count; ++i) {
+        if(an->functions[i].entry != entry)
+            continue;
+        if(an->functions[i].active) {
+            // calls that recurse are only counted once
+            an->bounded = false;
+            return (Cost_function) { entry, 0.0, 0, 0, true };
+        }
+        return an->functions[i];
+    }
+    return *walk(an, entry, arguments);
+}
+
+// Follows every way through the code from entry, each of which only
+// ever jumps forward, so that the instructions can be taken in order.
+// Instructions outside of this code, such as those of the functions
+// defined in it, are never reached on the way.
+static const Cost_function *walk(Analysis *an, unsigned entry, int height) {
+    if(an->function_count == an->function_capacity) {
+        int capacity = an->function_capacity == 0 ? 4 : 2 * an->function_capacity;
+        an->functions = cog_realloc(an->functions,
+                an->function_capacity * sizeof(Cost_function),
+                capacity * sizeof(Cost_function));
+        an->function_capacity = capacity;
+    }
+    int index = an->function_count++;
+    an->functions[index] = (Cost_function) { entry, 0.0, 0, height, true };
+    Cost_function fn = an->functions[index];
+
+    const Box *box = an->box;
+    unsigned owner = entry + 1;
+    reach(an, entry, owner, height, 0.0, 0);
+    Cost_stack st = { NULL, 0, 0 };
+    for(unsigned offset = entry; offset < box->count;
+            offset += box_instruction_length(box->code[offset])) {
+        const Cost_site *site = &an->sites[offset];
+        if(site->owner != owner)
+            continue;
+        uint8_t op = box->code[offset];
+        unsigned next = offset + box_instruction_length(op);
+        int h = site->height;
+        double cost = site->cost + weights[op];
+        unsigned instructions = site->instructions + 1;
+        int effect = effects[op];
+        bool falls_through = true;
+        stack_resize(&st, h);
+        cost += play(&st, box, offset);
+        switch(op) {
+            case OP_VECTOR:
+                effect = 1 - (int) operand16(box, offset);
+                break;
+            case OP_JMP:
+                reach(an, box_jump_target(box, offset), owner, h, cost, instructions);
+                falls_through = false;
+                break;
+            case OP_JMP_FALSE:
+                reach(an, box_jump_target(box, offset), owner, h - 1, cost, instructions);
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL: {
+                // the arguments start the frame of the function
+                int arguments = box->code[offset + 3];
+                Cost_function callee = function_at(an, box_jump_target(box, offset),
+                        arguments);
+                cost += callee.cost;
+                instructions += callee.instructions;
+                // a tail call takes over the frame it's made from
+                int base = op == OP_CALL ? h - arguments : 0;
+                if(base + (int) callee.stack > (int) fn.stack)
+                    fn.stack = base + callee.stack;
+                effect = 1 - arguments;
+                falls_through = op == OP_CALL;
+                break;
+            }
+            case OP_RET:
+                falls_through = false;
+                break;
+        }
+        if(h + effect > (int) fn.stack)
+            fn.stack = h + effect;
+        stack_resize(&st, h + effect);
+        if(falls_through) {
+            reach(an, next, owner, h + effect, cost, instructions);
+        } else {
+            if(cost > fn.cost) fn.cost = cost;
+            if(instructions > fn.instructions) fn.instructions = instructions;
+        }
+    }
+    free(st.values);
+    fn.active = false;
+    an->functions[index] = fn;
+    return &an->functions[index];
+}
+
+// What the constants take up, with the objects they point to
+static size_t constant_bytes(const Box *box) {
+    size_t bytes = box->constants.count * sizeof(Cog_value);
+    for(int i = 0; i < box->constants.count; ++i) {
+        Cog_value value = cog_array_get(&box->constants, i);
+        if(IS_VECTOR(value))
+            bytes += sizeof(Cog_vector) + TO_VECTOR(value)->length * sizeof(double);
+        else if(value.type == TYPE_STRING)
+            bytes += sizeof(Cog_string) + TO_STRING(value)->length + 1;
+    }
+    return bytes;
+}
+
+void cost_estimate(const Box *box, Cost_estimate *est) {
+    Analysis an;
+    an.box = box;
+    an.sites = cog_realloc(NULL, 0, box->count * sizeof(Cost_site));
+    memset(an.sites, 0, box->count * sizeof(Cost_site));
+    an.functions = NULL;
+    an.function_count = an.function_capacity = 0;
+    an.bounded = true;
+
+    const Cost_function *main = walk(&an, 0, 0);
+    est->cost = main->cost;
+    est->instructions = main->instructions;
+    est->max_stack = main->stack;
+    est->constants = box->constants.count;
+    est->constant_bytes = constant_bytes(box);
+    est->bounded = an.bounded;
+
+    free(an.functions);
+    free(an.sites);
+}
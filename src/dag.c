@@ -0,0 +1,459 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Each expression whose code runs straight through, without jumps,
+// calls or assignments, is replayed on a stack of nodes rather than of
+// values: every instruction gives the node of its result, made of the
+// nodes of its operands. Nodes are hash-consed, so an instruction that
+// repeats one seen before on the same operands gets the same node back,
+// and all of these expressions end up in one DAG. Variables bound by
+// let are just other names for nodes on the way; those never used are
+// never computed. Code is then generated anew from the DAG, and nodes
+// used more than once are computed the first time they are needed and
+// kept in a slot of the frame, where later uses find them.
+//
+// The other expressions keep their code, which is moved out of the way
+// and called as a function of no arguments, so that their variables are
+// still where the code expects them relative to the frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "box.h"
+#include "common.h"
+#include "dag.h"
+#include "memory.h"
+#include "object.h"
+#include "opcodes.h"
+#include "value.h"
+
+#define DAG_INITIAL_CAPACITY 64
+
+// Slots are 8 bit operands; past them, shared nodes are recomputed
+#define DAG_MAX_SLOTS 256
+
+typedef struct {
+    uint8_t op;        // OP_PSH for either kind of push
+    uint32_t operand;  // index of the constant or site, or vector length
+    uint32_t hash;
+    unsigned first;    // of its inputs in the input array
+    unsigned arity;
+    unsigned uses;     // by other nodes and as results
+    int slot;          // where its value is kept, or -1
+    unsigned visited;  // the last walk that went through it
+} Node;
+
+typedef struct {
+    const Box *box;
+    Node *nodes;
+    unsigned count;
+    unsigned capacity;
+    unsigned *inputs;
+    unsigned input_count;
+    unsigned input_capacity;
+    unsigned *table;   // index of a node plus one, or 0 where free
+    unsigned table_capacity;
+    int slots;         // taken so far
+    unsigned walk;
+} Dag;
+
+// Decoding
+
+static unsigned operand16(const uint8_t *code) {
+    return code[1] | (code[2] << 8);
+}
+
+// Whether the code of an expression made only of op runs straight
+// through, without side effects
+static bool is_straight(uint8_t op) {
+    switch(op) {
+        case OP_SET_GLOBAL:
+        case OP_JMP:
+        case OP_JMP_FALSE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_RESULT:
+            return false;
+        default:
+            return op < OP_COUNT;
+    }
+}
+
+// How many values op takes off the stack to make its result
+static unsigned arity(uint8_t op, const uint8_t *code) {
+    switch(op) {
+        case OP_PSH:
+        case OP_PSH_LONG:
+        case OP_PSH_TRUE:
+        case OP_PSH_FALSE:
+        case OP_PSH_NONE:
+        case OP_GET_GLOBAL:
+            return 0;
+        case OP_NEG:
+        case OP_NOT:
+        case OP_SQRT:
+        case OP_ABS:
+        case OP_FLOOR:
+        case OP_EXP:
+        case OP_LOG:
+        case OP_SUM:
+        case OP_MEAN:
+        case OP_MIN_OF:
+        case OP_MAX_OF:
+            return 1;
+        case OP_VECTOR:
+            return operand16(code);
+        default:
+            return 2;
+    }
+}
+
+// Hash-consing
+
+// Constants are the same only if nothing could tell them apart, which
+// rules out 1 and 1.0, or 0.0 and -0.0
+static bool same_constant(Cog_value a, Cog_value b) {
+    if(a.type != b.type)
+        return false;
+    switch(a.type) {
+        case TYPE_NUMBER:
+        case TYPE_INT:
+            return memcmp(&a.as.integer, &b.as.integer, sizeof(int64_t)) == 0;
+        case TYPE_BOOLEAN:
+            return TO_BOOL(a) == TO_BOOL(b);
+        case TYPE_NONE:
+            return true;
+        case TYPE_SYMBOL:
+            return TO_SYMBOL(a) == TO_SYMBOL(b);
+        case TYPE_SHORT_STRING:
+        case TYPE_STRING:
+            return cog_strings_equal(a, b);
+        case TYPE_VECTOR: {
+            const Cog_vector *x = TO_VECTOR(a), *y = TO_VECTOR(b);
+            return x->length == y->length && memcmp(x->elements, y->elements,
+                    x->length * sizeof(double)) == 0;
+        }
+    }
+    return false;
+}
+
+static uint32_t constant_hash(Cog_value value) {
+    switch(value.type) {
+        case TYPE_NUMBER:
+        case TYPE_INT:
+            return cog_hash_bytes((const char*) &value.as.integer, sizeof(int64_t));
+        case TYPE_BOOLEAN:
+            return TO_BOOL(value);
+        case TYPE_SYMBOL:
+            return TO_SYMBOL(value)->hash;
+        case TYPE_SHORT_STRING:
+        case TYPE_STRING: {
+            size_t length;
+            const char *chars = cog_string_chars(&value, &length);
+            return cog_hash_bytes(chars, length);
+        }
+        case TYPE_VECTOR:
+            return cog_hash_bytes((const char*) TO_VECTOR(value)->elements,
+                    TO_VECTOR(value)->length * sizeof(double));
+        default:
+            return 0;
+    }
+}
+
+static bool same_operand(const Dag *dag, uint8_t op, uint32_t a, uint32_t b) {
+    if(op == OP_PSH) {
+        return same_constant(cog_array_get(&dag->box->constants, a),
+                cog_array_get(&dag->box->constants, b));
+    }
+    if(op == OP_GET_GLOBAL)
+        return dag->box->sites[a].name == dag->box->sites[b].name;
+    return a == b;
+}
+
+static uint32_t node_hash(const Dag *dag, uint8_t op, uint32_t operand,
+        const unsigned *inputs, unsigned count) {
+    uint32_t hash = op;
+    if(op == OP_PSH)
+        hash ^= constant_hash(cog_array_get(&dag->box->constants, operand));
+    else if(op == OP_GET_GLOBAL)
+        hash ^= dag->box->sites[operand].name->hash;
+    else
+        hash ^= operand;
+    for(unsigned i = 0; i < count; ++i)
+        hash = (hash ^ inputs[i]) * 16777619u;
+    return hash * 2654435761u;
+}
+
+static void dag_grow_table(Dag *dag) {
+    unsigned capacity = dag->table_capacity * 2;
+    unsigned *table = cog_realloc(NULL, 0, capacity * sizeof(unsigned));
+    memset(table, 0, capacity * sizeof(unsigned));
+    for(unsigned i = 0; i < dag->count; ++i) {
+        unsigned at = dag->nodes[i].hash & (capacity - 1);
+        while(table[at] != 0)
+            at = (at + 1) & (capacity - 1);
+        table[at] = i + 1;
+    }
+    free(dag->table);
+    dag->table = table;
+    dag->table_capacity = capacity;
+}
+
+// Returns the node of op applied to the count nodes at inputs, made
+// anew only if there isn't one already
+static unsigned dag_node(Dag *dag, uint8_t op, uint32_t operand,
+        const unsigned *inputs, unsigned count) {
+    uint32_t hash = node_hash(dag, op, operand, inputs, count);
+    unsigned mask = dag->table_capacity - 1;
+    unsigned at = hash & mask;
+    for(; dag->table[at] != 0; at = (at + 1) & mask) {
+        const Node *node = &dag->nodes[dag->table[at] - 1];
+        if(node->hash == hash && node->op == op && node->arity == count
+                && same_operand(dag, op, node->operand, operand)
+                && memcmp(&dag->inputs[node->first], inputs,
+                    count * sizeof(unsigned)) == 0)
+            return dag->table[at] - 1;
+    }
+
+    if(dag->count == dag->capacity) {
+        dag->nodes = cog_realloc(dag->nodes, dag->capacity * sizeof(Node),
+                2 * dag->capacity * sizeof(Node));
+        dag->capacity *= 2;
+    }
+    while(dag->input_count + count > dag->input_capacity) {
+        dag->inputs = cog_realloc(dag->inputs, dag->input_capacity * sizeof(unsigned),
+                2 * dag->input_capacity * sizeof(unsigned));
+        dag->input_capacity *= 2;
+    }
+    unsigned index = dag->count++;
+    dag->nodes[index] = (Node) { op, operand, hash, dag->input_count, count, 0, -1, 0 };
+    for(unsigned i = 0; i < count; ++i) {
+        dag->inputs[dag->input_count++] = inputs[i];
+        ++dag->nodes[inputs[i]].uses;
+    }
+    dag->table[at] = index + 1;
+    // kept at most half full
+    if(2 * dag->count > dag->table_capacity)
+        dag_grow_table(dag);
+    return index;
+}
+
+// Replays the code of a region on a stack of nodes, setting root to the
+// node of its result. Returns false if the code doesn't run straight
+// through, leaving the DAG as it was.
+static bool dag_replay(Dag *dag, const uint8_t *code, const Dag_region *region,
+        unsigned *root) {
+    unsigned length = 0;
+    for(unsigned offset = region->start; offset < region->end;
+            offset += box_instruction_length(code[offset])) {
+        if(!is_straight(code[offset]))
+            return false;
+        ++length;
+    }
+    // no instruction pushes more than one value
+    unsigned *stack = cog_realloc(NULL, 0, (length + 1) * sizeof(unsigned));
+    unsigned height = 0;
+    for(unsigned offset = region->start; offset < region->end;
+            offset += box_instruction_length(code[offset])) {
+        const uint8_t *inst = &code[offset];
+        uint8_t op = inst[0];
+        uint32_t operand = 0;
+        switch(op) {
+            case OP_GET_LOCAL:
+                stack[height] = stack[inst[1]];
+                ++height;
+                continue;
+            case OP_SET_LOCAL:
+                stack[inst[1]] = stack[--height];
+                continue;
+            case OP_RET:
+                *root = stack[--height];
+                ++dag->nodes[*root].uses;
+                continue;
+            case OP_PSH:
+                operand = inst[1];
+                break;
+            case OP_PSH_LONG:
+                op = OP_PSH;
+                operand = inst[1] | (inst[2] << 8) | ((uint32_t) inst[3] << 16);
+                break;
+            case OP_GET_GLOBAL:
+            case OP_VECTOR:
+                operand = operand16(inst);
+                break;
+        }
+        unsigned count = arity(op, inst);
+        height -= count;
+        stack[height] = dag_node(dag, op, operand, &stack[height], count);
+        ++height;
+    }
+    free(stack);
+    return true;
+}
+
+// Code generation
+
+static void write16(Box *box, unsigned operand) {
+    box_code_write(box, (uint8_t) (operand & 0xFF));
+    box_code_write(box, (uint8_t) ((operand >> 8) & 0xFF));
+}
+
+// Whether the node is worth a slot: used more than once, and more than
+// a push itself
+static bool is_shared(const Node *node) {
+    return node->uses > 1 && node->arity > 0;
+}
+
+// Writes code that pushes the value of the node
+static void dag_emit(Dag *dag, Box *box, unsigned index) {
+    const Node *node = &dag->nodes[index];
+    if(node->slot >= 0) {
+        box_code_write(box, OP_GET_LOCAL);
+        box_code_write(box, (uint8_t) node->slot);
+        return;
+    }
+    for(unsigned i = 0; i < node->arity; ++i)
+        dag_emit(dag, box, dag->inputs[node->first + i]);
+    if(node->op == OP_PSH && node->operand > UINT8_MAX) {
+        box_code_write(box, OP_PSH_LONG);
+        write16(box, node->operand & 0xFFFF);
+        box_code_write(box, (uint8_t) (node->operand >> 16));
+        return;
+    }
+    box_code_write(box, node->op);
+    if(node->op == OP_PSH)
+        box_code_write(box, (uint8_t) node->operand);
+    else if(node->op == OP_GET_GLOBAL || node->op == OP_VECTOR)
+        write16(box, node->operand);
+}
+
+// Computes the shared nodes below index that aren't kept yet, innermost
+// first, leaving each in a slot of its own
+static void dag_keep(Dag *dag, Box *box, unsigned index) {
+    Node *node = &dag->nodes[index];
+    if(node->visited == dag->walk || node->slot >= 0)
+        return;
+    node->visited = dag->walk;
+    for(unsigned i = 0; i < node->arity; ++i)
+        dag_keep(dag, box, dag->inputs[node->first + i]);
+    if(is_shared(node) && dag->slots < DAG_MAX_SLOTS) {
+        dag_emit(dag, box, index);
+        node->slot = dag->slots++;
+    }
+}
+
+// Makes every node be computed again the next time it is needed
+static void dag_forget(Dag *dag) {
+    for(unsigned i = 0; i < dag->count; ++i)
+        dag->nodes[i].slot = -1;
+}
+
+static bool writes_globals(const uint8_t *code, const Dag_region *region) {
+    for(unsigned offset = region->start; offset < region->end;
+            offset += box_instruction_length(code[offset])) {
+        if(code[offset] == OP_SET_GLOBAL)
+            return true;
+    }
+    return false;
+}
+
+// Public interface
+
+bool dag_combine(Box *box, const Dag_region *regions, int count) {
+    Dag dag;
+    dag.box = box;
+    dag.count = dag.input_count = 0;
+    dag.capacity = dag.input_capacity = DAG_INITIAL_CAPACITY;
+    dag.table_capacity = 2 * DAG_INITIAL_CAPACITY;
+    dag.nodes = cog_realloc(NULL, 0, dag.capacity * sizeof(Node));
+    dag.inputs = cog_realloc(NULL, 0, dag.input_capacity * sizeof(unsigned));
+    dag.table = cog_realloc(NULL, 0, dag.table_capacity * sizeof(unsigned));
+    memset(dag.table, 0, dag.table_capacity * sizeof(unsigned));
+    dag.slots = 0;
+    dag.walk = 0;
+
+    // the old code is read while the new one is written over it
+    unsigned size = box->count;
+    uint8_t *code = cog_realloc(NULL, 0, size + 1);
+    memcpy(code, box->code, size);
+    // roots of the straight expressions, and where the others are
+    // called from
+    unsigned *roots = cog_realloc(NULL, 0, (count + 1) * sizeof(unsigned));
+    bool *straight = cog_realloc(NULL, 0, count + 1);
+    for(int i = 0; i < count; ++i)
+        straight[i] = dag_replay(&dag, code, &regions[i], &roots[i]);
+
+    box->count = 0;
+    for(int i = 0; i < count; ++i) {
+        if(straight[i]) {
+            ++dag.walk;
+            dag_keep(&dag, box, roots[i]);
+            dag_emit(&dag, box, roots[i]);
+        } else {
+            roots[i] = box->count;
+            box_code_write(box, OP_CALL);
+            write16(box, 0); // until the region is in place
+            box_code_write(box, 0);
+            // what was kept may have been made with other values
+            if(writes_globals(code, &regions[i]))
+                dag_forget(&dag);
+        }
+        box_code_write(box, OP_RESULT);
+    }
+    box_code_write(box, OP_PSH_NONE);
+    box_code_write(box, OP_RET);
+
+    bool alright = true;
+    for(int i = 0; i < count && alright; ++i) {
+        if(straight[i])
+            continue;
+        const Dag_region *region = &regions[i];
+        unsigned entry = box->count;
+        for(unsigned offset = region->start; offset < region->end; ) {
+            unsigned length = box_instruction_length(code[offset]);
+            unsigned at = box->count;
+            for(unsigned j = 0; j < length; ++j)
+                box_code_write(box, code[offset + j]);
+            if(code[offset] == OP_CALL || code[offset] == OP_TAIL_CALL) {
+                unsigned target = operand16(&code[offset]) - region->start + entry;
+                box->code[at + 1] = (uint8_t) (target & 0xFF);
+                box->code[at + 2] = (uint8_t) ((target >> 8) & 0xFF);
+                alright = alright && target <= UINT16_MAX;
+            }
+            offset += length;
+        }
+        box->code[roots[i] + 1] = (uint8_t) (entry & 0xFF);
+        box->code[roots[i] + 2] = (uint8_t) ((entry >> 8) & 0xFF);
+        alright = alright && entry <= UINT16_MAX;
+    }
+    if(!alright)
+        eprintf("(!) Too much code in one set of expressions\n");
+
+    free(straight);
+    free(roots);
+    free(code);
+    free(dag.table);
+    free(dag.inputs);
+    free(dag.nodes);
+    return alright;
+}
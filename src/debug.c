@@ -24,74 +24,152 @@
 
 #include "box.h"
 #include "common.h"
+#include "cost.h"
 #include "debug.h"
 #include "opcodes.h"
+#include "profile.h"
 #include "value.h"
 
+const char *op_name(uint8_t op) {
+    switch(op) {
+        case OP_NEG: return "neg";
+        case OP_ADD: return "add";
+        case OP_SUB: return "sub";
+        case OP_MUL: return "mul";
+        case OP_DIV: return "div";
+        case OP_SQRT: return "sqrt";
+        case OP_ABS: return "abs";
+        case OP_FLOOR: return "floor";
+        case OP_EXP: return "exp";
+        case OP_LOG: return "log";
+        case OP_MIN: return "min";
+        case OP_MAX: return "max";
+        case OP_POW: return "pow";
+        case OP_VECTOR: return "vector";
+        case OP_SUM: return "sum";
+        case OP_MEAN: return "mean";
+        case OP_MIN_OF: return "min_of";
+        case OP_MAX_OF: return "max_of";
+        case OP_NOT: return "not";
+        case OP_EQ: return "eq";
+        case OP_LT: return "lt";
+        case OP_GT: return "gt";
+        case OP_AND: return "and";
+        case OP_OR: return "or";
+        case OP_PSH: return "psh";
+        case OP_PSH_LONG: return "psh";
+        case OP_PSH_TRUE: return "psh true";
+        case OP_PSH_FALSE: return "psh false";
+        case OP_PSH_NONE: return "psh none";
+        case OP_GET_LOCAL: return "get_local";
+        case OP_SET_LOCAL: return "set_local";
+        case OP_GET_GLOBAL: return "get_global";
+        case OP_SET_GLOBAL: return "set_global";
+        case OP_JMP: return "jmp";
+        case OP_JMP_FALSE: return "jmp_false";
+        case OP_CALL: return "call";
+        case OP_TAIL_CALL: return "tail_call";
+        case OP_RET: return "ret";
+        case OP_RESULT: return "result";
+        default: return "???";
+    }
+}
+
 static int disassemble_inst(const Box *box, uint8_t *ptr) {
-    uint8_t addr;
+    printf("%04u  ", (unsigned) (ptr - box->code));
     switch(*ptr) {
-        case OP_NEG:
-            printf("neg\n");
-            return 1;
-        case OP_ADD:
-            printf("add\n");
-            return 1;
-        case OP_SUB:
-            printf("sub\n");
-            return 1;
-        case OP_MUL:
-            printf("mul\n");
-            return 1;
-        case OP_DIV:
-            printf("div\n");
-            return 1;
-        case OP_NOT:
-            printf("not\n");
-            return 1;
-        case OP_EQ:
-            printf("eq\n");
-            return 1;
-        case OP_LT:
-            printf("lt\n");
-            return 1;
-        case OP_GT:
-            printf("gt\n");
-            return 1;
-        case OP_AND:
-            printf("and\n");
-            return 1;
-        case OP_OR:
-            printf("or\n");
-            return 1;
-        case OP_PSH:
-            addr = *(++ptr);
-            Cog_value value = cog_array_get(&box->constants, addr);
+        case OP_PSH: {
+            Cog_value value = cog_array_get(&box->constants, ptr[1]);
             printf("psh ");
             cog_value_print(value);
             printf("\n");
             return 2;
-        case OP_PSH_TRUE:
-            printf("psh true\n");
-            return 1;
-        case OP_PSH_FALSE:
-            printf("psh false\n");
-            return 1;
-        case OP_PSH_NONE:
-            printf("psh none\n");
-            return 1;
-        case OP_RET:
-            printf("ret\n");
-            return 1;
+        }
+        case OP_PSH_LONG: {
+            int index = ptr[1] | (ptr[2] << 8) | (ptr[3] << 16);
+            printf("psh ");
+            cog_value_print(cog_array_get(&box->constants, index));
+            printf("\n");
+            return 4;
+        }
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            printf("%s %d\n", op_name(*ptr), ptr[1]);
+            return 2;
+        case OP_JMP:
+        case OP_JMP_FALSE: {
+            unsigned target = (ptr - box->code) + 3 + (ptr[1] | (ptr[2] << 8));
+            printf("%s -> %04u\n", op_name(*ptr), target);
+            return 3;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            printf("%s -> %04u (%d)\n", op_name(*ptr), ptr[1] | (ptr[2] << 8), ptr[3]);
+            return 4;
+        case OP_VECTOR:
+            printf("%s %d\n", op_name(*ptr), ptr[1] | (ptr[2] << 8));
+            return 3;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL: {
+            const Box_site *site = &box->sites[ptr[1] | (ptr[2] << 8)];
+            printf("%s %s\n", op_name(*ptr), site->name->chars);
+            return 3;
+        }
         default:
-            printf("???\n");
+            // everything else is a lone opcode
+            printf("%s\n", op_name(*ptr));
             return 1;
     }
+}
 
+// The static estimate of what running box costs (see cost.h)
+static void print_cost(const Box *box) {
+    Cost_estimate est;
+    cost_estimate(box, &est);
+    printf("; cost %.1f%s over %u instructions, stack %u, %u constants in %zu bytes\n",
+            est.cost, est.bounded ? "" : " or more", est.instructions, est.max_stack,
+            est.constants, est.constant_bytes);
 }
 
 void disassemble(const Box *box) {
+    print_cost(box);
     uint8_t *ptr = box->code;
     while(ptr != &box->code[box->count])
         ptr += disassemble_inst(box, ptr);
 }
+
+void disassemble_profiled(const Box *box, const Cog_profile *prof) {
+    uint64_t total = 0;
+    for(unsigned i = 0; i < box->count && i < prof->size; ++i)
+        total += prof->cycles[i];
+    print_cost(box);
+    printf("%7s %10s %12s  %s\n", "cycles", "count", "cycles/run", "instruction");
+
+    uint8_t *ptr = box->code;
+    while(ptr != &box->code[box->count]) {
+        unsigned offset = ptr - box->code;
+        uint64_t count = 0, cycles = 0;
+        if(prof->box == box && offset < prof->size) {
+            count = prof->counts[offset];
+            cycles = prof->cycles[offset];
+        }
+        printf("%6.2f%% %10llu %12.1f  ", total ? 100.0 * cycles / total : 0.0,
+                (unsigned long long) count, count ? (double) cycles / count : 0.0);
+        ptr += disassemble_inst(box, ptr);
+    }
+}
+
+void print_opcode_profile(const Cog_profile *prof) {
+    uint64_t total = 0;
+    for(int op = 0; op < OP_COUNT; ++op)
+        total += prof->op_cycles[op];
+    printf("%-10s %7s %12s %12s\n", "opcode", "cycles", "count", "cycles/op");
+    for(int op = 0; op < OP_COUNT; ++op) {
+        if(prof->op_counts[op] == 0)
+            continue;
+        printf("%-10s %6.2f%% %12llu %12.1f\n", op_name(op),
+                total ? 100.0 * prof->op_cycles[op] / total : 0.0,
+                (unsigned long long) prof->op_counts[op],
+                (double) prof->op_cycles[op] / prof->op_counts[op]);
+    }
+}
@@ -0,0 +1,347 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Grisu2, from Florian Loitsch's "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers" (PLDI 2010). The digits it
+// produces always read back as the original double and are the
+// shortest such digits for all but a tiny fraction of inputs, where
+// one extra digit may be emitted.
+
+#include <math.h>
+#include <string.h>
+
+#include "common.h"
+#include "dtoa.h"
+
+// "Do-it-yourself" floating point: f * 2^e, with a full 64 bit
+// significand and no implicit bit
+typedef struct {
+    uint64_t f;
+    int e;
+} Diy_fp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK 0x7FF0000000000000ull
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define DP_HIDDEN_BIT 0x0010000000000000ull
+
+// Normalized powers of ten from 10^-348 to 10^340, in steps of 8
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+    0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+    0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+    0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+    0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+    0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+    0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+    0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+    0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+    0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+    0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+    0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+    0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+    0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+    0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+    0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+    0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+    0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+    0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+    0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+    0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+    0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t powers_of_ten[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+    10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+    100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+// Diy_fp arithmetic
+
+static Diy_fp diy_from_double(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_e = (int) ((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+    if(biased_e != 0)
+        return (Diy_fp) { significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS };
+    // subnormal
+    return (Diy_fp) { significand, DP_MIN_EXPONENT + 1 };
+}
+
+static Diy_fp diy_sub(Diy_fp x, Diy_fp y) {
+    return (Diy_fp) { x.f - y.f, x.e };
+}
+
+// Rounded upper half of the 128 bit product
+static Diy_fp diy_mul(Diy_fp x, Diy_fp y) {
+    const uint64_t m32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & m32;
+    uint64_t c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    tmp += 1u << 31;
+    return (Diy_fp) { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
+}
+
+static Diy_fp diy_normalize(Diy_fp x) {
+    while(!(x.f & (1ull << 63))) {
+        x.f <<= 1;
+        --x.e;
+    }
+    return x;
+}
+
+// Computes the boundaries m- and m+ of v, the midpoints to its
+// neighbouring doubles, sharing the exponent of the normalized m+
+static void diy_boundaries(Diy_fp v, Diy_fp *minus, Diy_fp *plus) {
+    Diy_fp pl = { (v.f << 1) + 1, v.e - 1 };
+    while(!(pl.f & (DP_HIDDEN_BIT << 1))) {
+        pl.f <<= 1;
+        --pl.e;
+    }
+    pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+    pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+    // the lower gap is half as wide at powers of two
+    Diy_fp mi = (v.f == DP_HIDDEN_BIT)
+        ? (Diy_fp) { (v.f << 2) - 1, v.e - 2 }
+        : (Diy_fp) { (v.f << 1) - 1, v.e - 1 };
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+// Picks a cached power c = 10^-K such that c * 2^e lands in [2^-60, 2^-32]
+static Diy_fp cached_power(int e, int *K) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int) dk;
+    if(dk - k > 0.0) ++k;
+    unsigned index = (unsigned) ((k >> 3) + 1);
+    *K = -(-348 + (int) (index << 3));
+    return (Diy_fp) { cached_powers_f[index], cached_powers_e[index] };
+}
+
+// Digit generation
+
+static int count_digits(uint32_t n) {
+    int count = 1;
+    while(n >= 10) {
+        n /= 10;
+        ++count;
+    }
+    return count;
+}
+
+// Nudges the last digit towards w while staying inside the rounding
+// interval, so that the result is the closest of the shortest digits
+static void grisu_round(char *buffer, int length, uint64_t delta, uint64_t rest,
+        uint64_t ten_kappa, uint64_t wp_w) {
+    while(rest < wp_w && delta - rest >= ten_kappa
+            && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        --buffer[length - 1];
+        rest += ten_kappa;
+    }
+}
+
+static int digit_gen(Diy_fp w, Diy_fp mp, uint64_t delta, char *buffer, int *K) {
+    const Diy_fp one = { 1ull << -mp.e, mp.e };
+    const Diy_fp wp_w = diy_sub(mp, w);
+    uint32_t p1 = (uint32_t) (mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits(p1);
+    int length = 0;
+
+    // integral part
+    while(kappa > 0) {
+        uint32_t div = (uint32_t) powers_of_ten[kappa - 1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if(d || length)
+            buffer[length++] = (char) ('0' + d);
+        --kappa;
+        uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+        if(rest <= delta) {
+            *K += kappa;
+            grisu_round(buffer, length, delta, rest, powers_of_ten[kappa] << -one.e, wp_w.f);
+            return length;
+        }
+    }
+
+    // fractional part
+    while(true) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char) (p2 >> -one.e);
+        if(d || length)
+            buffer[length++] = (char) ('0' + d);
+        p2 &= one.f - 1;
+        --kappa;
+        if(p2 < delta) {
+            *K += kappa;
+            int index = -kappa;
+            grisu_round(buffer, length, delta, p2, one.f,
+                    wp_w.f * (index < 20 ? powers_of_ten[index] : 0));
+            return length;
+        }
+    }
+}
+
+// Produces the digits of a positive, finite value, such that
+// value = digits * 10^K
+static int grisu2(double value, char *buffer, int *K) {
+    Diy_fp v = diy_from_double(value);
+    Diy_fp w_m, w_p;
+    diy_boundaries(v, &w_m, &w_p);
+
+    const Diy_fp c_mk = cached_power(w_p.e, K);
+    const Diy_fp W = diy_mul(diy_normalize(v), c_mk);
+    Diy_fp Wp = diy_mul(w_p, c_mk);
+    Diy_fp Wm = diy_mul(w_m, c_mk);
+    // account for the imprecision of the products
+    ++Wm.f;
+    --Wp.f;
+    return digit_gen(W, Wp, Wp.f - Wm.f, buffer, K);
+}
+
+// Text layout
+
+static size_t write_exponent(char *buffer, int exp) {
+    char *ptr = buffer;
+    *ptr++ = 'e';
+    if(exp < 0) {
+        *ptr++ = '-';
+        exp = -exp;
+    } else {
+        *ptr++ = '+';
+    }
+    // at least two digits, like printf
+    if(exp >= 100) {
+        *ptr++ = (char) ('0' + exp / 100);
+        exp %= 100;
+    }
+    *ptr++ = (char) ('0' + exp / 10);
+    *ptr++ = (char) ('0' + exp % 10);
+    return ptr - buffer;
+}
+
+// Lays out length digits, scaled by 10^K, in either fixed or
+// scientific notation
+static size_t prettify(char *buffer, int length, int K) {
+    // position of the decimal point relative to the first digit
+    const int kk = length + K;
+
+    if(kk >= length && kk <= 21) {
+        // integer, padded with zeros: 1234e7 -> 12340000000
+        memset(buffer + length, '0', kk - length);
+        return kk;
+    }
+    if(kk > 0 && kk <= 21) {
+        // 1234e-2 -> 12.34
+        memmove(buffer + kk + 1, buffer + kk, length - kk);
+        buffer[kk] = '.';
+        return length + 1;
+    }
+    if(kk > -6 && kk <= 0) {
+        // 1234e-6 -> 0.001234
+        const int offset = 2 - kk;
+        memmove(buffer + offset, buffer, length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', offset - 2);
+        return length + offset;
+    }
+    if(length == 1) {
+        // 1e30
+        return 1 + write_exponent(buffer + 1, kk - 1);
+    }
+    // 1234e30 -> 1.234e+33
+    memmove(buffer + 2, buffer + 1, length - 1);
+    buffer[1] = '.';
+    return length + 1 + write_exponent(buffer + length + 1, kk - 1);
+}
+
+static size_t write_integer(char *buffer, uint64_t n) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + n % 10);
+        n /= 10;
+    } while(n != 0);
+    for(int i = 0; i < count; ++i)
+        buffer[i] = digits[count - i - 1];
+    return count;
+}
+
+// Public interface
+
+size_t cog_dtoa(double value, char *buffer) {
+    char *ptr = buffer;
+    if(isnan(value)) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if(signbit(value)) {
+        *ptr++ = '-';
+        value = -value;
+    }
+
+    size_t length;
+    if(isinf(value)) {
+        memcpy(ptr, "inf", 3);
+        length = 3;
+    } else if(value < 9007199254740992.0 && value == (double) (uint64_t) value) {
+        // integers below 2^53 are exact, so their digits are the answer
+        length = write_integer(ptr, (uint64_t) value);
+    } else {
+        int K;
+        int digits = grisu2(value, ptr, &K);
+        length = prettify(ptr, digits, K);
+    }
+    ptr[length] = '\0';
+    return (ptr - buffer) + length;
+}
@@ -0,0 +1,145 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "globals.h"
+#include "memory.h"
+#include "object.h"
+#include "symbol.h"
+#include "value.h"
+
+#define GLOBALS_INITIAL_CAPACITY 16
+
+static atomic_uint_least32_t next_id = 1;
+
+void cog_globals_init(Cog_globals *globals) {
+    globals->id = (uint32_t) atomic_fetch_add(&next_id, 1);
+    globals->index = NULL;
+    globals->index_capacity = 0;
+    globals->slots = NULL;
+    globals->count = 0;
+    globals->capacity = 0;
+}
+
+static uint32_t *find_entry(const Cog_globals *globals, uint32_t *index,
+        uint32_t capacity, const Cog_symbol *name) {
+    uint32_t mask = capacity - 1;
+    uint32_t i = name->hash & mask;
+    // names are interned, so they're told apart by pointer
+    while(index[i] != 0 && globals->slots[index[i] - 1].name != name)
+        i = (i + 1) & mask;
+    return &index[i];
+}
+
+static void grow_index(Cog_globals *globals) {
+    uint32_t capacity = globals->index_capacity == 0 ? GLOBALS_INITIAL_CAPACITY
+        : globals->index_capacity * 2;
+    uint32_t *index = cog_realloc(NULL, 0, capacity * sizeof(uint32_t));
+    memset(index, 0, capacity * sizeof(uint32_t));
+    // the slots themselves stay where they are
+    for(uint32_t slot = 0; slot < globals->count; ++slot)
+        *find_entry(globals, index, capacity, globals->slots[slot].name) = slot + 1;
+    free(globals->index);
+    globals->index = index;
+    globals->index_capacity = capacity;
+}
+
+uint32_t cog_globals_slot(Cog_globals *globals, const Cog_symbol *name) {
+    if((globals->count + 1) * 4 > globals->index_capacity * 3)
+        grow_index(globals);
+    uint32_t *entry = find_entry(globals, globals->index, globals->index_capacity, name);
+    if(*entry != 0)
+        return *entry - 1;
+
+    if(globals->count == globals->capacity) {
+        uint32_t capacity = globals->capacity == 0 ? GLOBALS_INITIAL_CAPACITY
+            : globals->capacity * 2;
+        globals->slots = cog_realloc(globals->slots, globals->capacity * sizeof(Cog_global),
+                capacity * sizeof(Cog_global));
+        globals->capacity = capacity;
+    }
+    uint32_t slot = globals->count++;
+    globals->slots[slot] = (Cog_global) { name, COG_NONE, false };
+    *entry = slot + 1;
+    return slot;
+}
+
+uint32_t cog_globals_lookup(Cog_globals *globals, const char *name, size_t length) {
+    return cog_globals_slot(globals, cog_symbol_intern(name, length));
+}
+
+// Vectors and long strings that weren't interned are owned by the table
+static bool owned(Cog_value value) {
+    return IS_VECTOR(value)
+        || (value.type == TYPE_STRING && !TO_STRING(value)->interned);
+}
+
+void cog_globals_release(Cog_value value) {
+    if(!owned(value))
+        return;
+    if(IS_VECTOR(value))
+        free(TO_VECTOR(value));
+    else
+        free(TO_STRING(value));
+}
+
+bool cog_globals_replace(Cog_globals *globals, uint32_t slot, Cog_value value,
+        Cog_value *old) {
+    Cog_global *global = &globals->slots[slot];
+    // the copy is made first, as value may well be the old one
+    if(IS_VECTOR(value)) {
+        value = cog_vector_copy(NULL, value);
+    } else if(owned(value)) {
+        size_t length;
+        const char *chars = cog_string_chars(&value, &length);
+        value = cog_string_value(NULL, chars, length);
+    }
+    bool replaced = global->defined && owned(global->value);
+    if(replaced)
+        *old = global->value;
+    global->value = value;
+    global->defined = true;
+    return replaced;
+}
+
+void cog_globals_set(Cog_globals *globals, uint32_t slot, Cog_value value) {
+    Cog_value old;
+    if(cog_globals_replace(globals, slot, value, &old))
+        cog_globals_release(old);
+}
+
+void cog_globals_free(Cog_globals *globals) {
+    for(uint32_t slot = 0; slot < globals->count; ++slot) {
+        Cog_global *global = &globals->slots[slot];
+        if(global->defined)
+            cog_globals_release(global->value);
+    }
+    free(globals->index);
+    free(globals->slots);
+    globals->index = NULL;
+    globals->slots = NULL;
+    globals->count = globals->capacity = globals->index_capacity = 0;
+}
@@ -0,0 +1,405 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "box.h"
+#include "common.h"
+#include "ir.h"
+#include "memory.h"
+#include "object.h"
+#include "opcodes.h"
+#include "value.h"
+
+void ir_init(Ir *ir, Box *box, Cog_arena *arena) {
+    ir->box = box;
+    ir->arena = arena;
+    ir->too_deep = false;
+}
+
+// Construction
+
+Ir_node *ir_node(Ir *ir, Ir_tag tag, unsigned count) {
+    Ir_node *node = cog_arena_alloc(ir->arena, sizeof(Ir_node));
+    memset(node, 0, sizeof(Ir_node));
+    node->tag = tag;
+    node->type = IR_TYPE_ANY;
+    node->count = count;
+    node->depth = 1;
+    node->slot = -1;
+    if(count > 0) {
+        node->operands = cog_arena_alloc(ir->arena, count * sizeof(Ir_node*));
+        memset(node->operands, 0, count * sizeof(Ir_node*));
+    }
+    return node;
+}
+
+static Ir_type constant_type(Cog_value value) {
+    switch(value.type) {
+        case TYPE_INT: return IR_TYPE_INT;
+        case TYPE_NUMBER: return IR_TYPE_DOUBLE;
+        case TYPE_BOOLEAN: return IR_TYPE_BOOLEAN;
+        case TYPE_VECTOR: return IR_TYPE_VECTOR;
+        default: return IR_TYPE_ANY;
+    }
+}
+
+Ir_node *ir_constant(Ir *ir, Cog_value value) {
+    Ir_node *node = ir_node(ir, IR_CONSTANT, 0);
+    node->as.value = value;
+    node->type = constant_type(value);
+    return node;
+}
+
+Ir_node *ir_unary(Ir *ir, Op_code op, Ir_node *a) {
+    Ir_node *node = ir_node(ir, IR_OP, 1);
+    node->op = op;
+    node->operands[0] = a;
+    ir_finish(ir, node);
+    return node;
+}
+
+Ir_node *ir_binary(Ir *ir, Op_code op, Ir_node *a, Ir_node *b) {
+    Ir_node *node = ir_node(ir, IR_OP, 2);
+    node->op = op;
+    node->operands[0] = a;
+    node->operands[1] = b;
+    ir_finish(ir, node);
+    return node;
+}
+
+// Types
+
+static bool is_number(Ir_type type) {
+    return type == IR_TYPE_INT || type == IR_TYPE_DOUBLE || type == IR_TYPE_NUMBER;
+}
+
+bool ir_is_number(const Ir_node *node) {
+    return is_number(node->type);
+}
+
+static Ir_type type_of(const Ir_node *node) {
+    return node != NULL ? node->type : IR_TYPE_ANY;
+}
+
+// What two values of these types make together
+static Ir_type join(Ir_type a, Ir_type b) {
+    if(a == b)
+        return a;
+    if(is_number(a) && is_number(b))
+        return IR_TYPE_NUMBER;
+    return IR_TYPE_ANY;
+}
+
+// Ints that overflow become doubles, which may then cancel out into
+// anything; vectors win over numbers
+static Ir_type arithmetic_type(Ir_type a, Ir_type b) {
+    if(a == IR_TYPE_VECTOR || b == IR_TYPE_VECTOR)
+        return (a == IR_TYPE_VECTOR || is_number(a))
+            && (b == IR_TYPE_VECTOR || is_number(b)) ? IR_TYPE_VECTOR : IR_TYPE_ANY;
+    if(!is_number(a) || !is_number(b))
+        return IR_TYPE_ANY;
+    if(a == IR_TYPE_DOUBLE || b == IR_TYPE_DOUBLE)
+        return IR_TYPE_DOUBLE;
+    return IR_TYPE_NUMBER;
+}
+
+// How many elements the vector a node makes has, when that is known at
+// compile time, or -1
+static long vector_length(const Ir_node *node) {
+    if(node->tag == IR_CONSTANT && IS_VECTOR(node->as.value))
+        return (long) TO_VECTOR(node->as.value)->length;
+    if(node->tag == IR_OP && node->op == OP_VECTOR)
+        return (long) node->count;
+    return -1;
+}
+
+// Types describe values of nodes that don't fail: those that only take
+// numbers give numbers, whatever their operands turn out to be
+static Ir_type op_type(const Ir_node *node) {
+    Ir_type a = node->count > 0 ? type_of(node->operands[0]) : IR_TYPE_ANY;
+    Ir_type b = node->count > 1 ? type_of(node->operands[1]) : IR_TYPE_ANY;
+    switch(node->op) {
+        case OP_NEG:
+        case OP_ABS:
+            // the smallest int overflows, into a double past the range
+            return is_number(a) ? a : IR_TYPE_NUMBER;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            return arithmetic_type(a, b);
+        case OP_DIV:
+            if(is_number(a) && is_number(b))
+                return IR_TYPE_DOUBLE;
+            return arithmetic_type(a, b);
+        case OP_FLOOR:
+            // doubles too big to fit stay doubles
+            return IR_TYPE_INT;
+        case OP_MIN:
+        case OP_MAX:
+            return is_number(a) && is_number(b) ? join(a, b) : IR_TYPE_NUMBER;
+        case OP_SQRT:
+        case OP_EXP:
+        case OP_LOG:
+        case OP_POW:
+        case OP_SUM:
+        case OP_MEAN:
+        case OP_MIN_OF:
+        case OP_MAX_OF:
+            return IR_TYPE_DOUBLE;
+        case OP_VECTOR:
+            return IR_TYPE_VECTOR;
+        case OP_NOT:
+            return a == IR_TYPE_VECTOR || a == IR_TYPE_ANY ? a : IR_TYPE_BOOLEAN;
+        case OP_EQ:
+        case OP_LT:
+        case OP_GT:
+            // vectors compare into masks, but only with numbers or with
+            // vectors as long as them; == is false for anything else
+            if(a == IR_TYPE_VECTOR || b == IR_TYPE_VECTOR) {
+                if((a == IR_TYPE_VECTOR && is_number(b))
+                        || (is_number(a) && b == IR_TYPE_VECTOR))
+                    return IR_TYPE_VECTOR;
+                long length = vector_length(node->operands[0]);
+                if(a == b && length >= 0 && length == vector_length(node->operands[1]))
+                    return IR_TYPE_VECTOR;
+                return IR_TYPE_ANY;
+            }
+            if(a == IR_TYPE_ANY || b == IR_TYPE_ANY)
+                return IR_TYPE_ANY;
+            return IR_TYPE_BOOLEAN;
+        case OP_AND:
+        case OP_OR:
+            return IR_TYPE_BOOLEAN;
+        default:
+            return IR_TYPE_ANY;
+    }
+}
+
+void ir_finish(Ir *ir, Ir_node *node) {
+    uint32_t depth = 0;
+    for(unsigned i = 0; i < node->count; ++i) {
+        if(node->operands[i] != NULL && node->operands[i]->depth > depth)
+            depth = node->operands[i]->depth;
+    }
+    node->depth = depth + 1;
+    if(node->depth > IR_MAX_DEPTH)
+        ir->too_deep = true;
+    switch(node->tag) {
+        case IR_OP:
+            node->type = op_type(node);
+            break;
+        case IR_LOCAL:
+            // parameters could be anything
+            node->type = node->as.binding->tag == IR_LET
+                ? type_of(node->as.binding->operands[0]) : IR_TYPE_ANY;
+            break;
+        case IR_SET_GLOBAL:
+            node->type = type_of(node->operands[0]);
+            break;
+        case IR_LET:
+            node->type = type_of(node->operands[1]);
+            break;
+        case IR_IF:
+            node->type = join(type_of(node->operands[1]), type_of(node->operands[2]));
+            break;
+        case IR_FUNCTION:
+            node->type = type_of(node->operands[1]);
+            break;
+        default:
+            break;
+    }
+}
+
+// Lowering
+
+typedef struct {
+    Box *box;
+    int height; // of the frame when the code so far has run
+    bool failed;
+} Lowering;
+
+static void fail(Lowering *lo, const char *message) {
+    if(!lo->failed)
+        eprintf("(!) %s\n", message);
+    lo->failed = true;
+}
+
+static void write_op(Lowering *lo, Op_code op, int effect) {
+    box_code_write(lo->box, op);
+    lo->height += effect;
+}
+
+static void write16(Lowering *lo, unsigned operand) {
+    box_code_write(lo->box, (uint8_t) (operand & 0xFF));
+    box_code_write(lo->box, (uint8_t) ((operand >> 8) & 0xFF));
+}
+
+static void lower_constant(Lowering *lo, Cog_value value) {
+    if(IS_BOOLEAN(value)) {
+        write_op(lo, TO_BOOL(value) ? OP_PSH_TRUE : OP_PSH_FALSE, 1);
+        return;
+    }
+    if(IS_NONE(value)) {
+        write_op(lo, OP_PSH_NONE, 1);
+        return;
+    }
+    int i = box_value_write(lo->box, value);
+    if(i <= UINT8_MAX) {
+        write_op(lo, OP_PSH, 1);
+        box_code_write(lo->box, (uint8_t) i);
+    } else if(i <= 0xFFFFFF) {
+        write_op(lo, OP_PSH_LONG, 1);
+        write16(lo, i & 0xFFFF);
+        box_code_write(lo->box, (uint8_t) ((i >> 16) & 0xFF));
+    } else {
+        fail(lo, "Too many constants in one expression");
+    }
+}
+
+static void lower_global(Lowering *lo, Op_code op, const Cog_symbol *name, int effect) {
+    int site = box_site_write(lo->box, name);
+    if(site >= BOX_MAX_SITES) {
+        fail(lo, "Too many variables in one expression");
+        return;
+    }
+    write_op(lo, op, effect);
+    write16(lo, site);
+}
+
+// Writes a jump with room for its offset, returning where that is
+static unsigned lower_jump(Lowering *lo, Op_code op, int effect) {
+    write_op(lo, op, effect);
+    write16(lo, 0);
+    return lo->box->count - 2;
+}
+
+// Makes the jump whose offset is at operand land on the next instruction
+static void patch_jump(Lowering *lo, unsigned operand) {
+    unsigned offset = lo->box->count - (operand + 2);
+    if(offset > UINT16_MAX) {
+        fail(lo, "Branch too long to jump over");
+        return;
+    }
+    lo->box->code[operand] = (uint8_t) (offset & 0xFF);
+    lo->box->code[operand + 1] = (uint8_t) ((offset >> 8) & 0xFF);
+}
+
+static void lower(Lowering *lo, Ir_node *node) {
+    switch(node->tag) {
+        case IR_CONSTANT:
+            lower_constant(lo, node->as.value);
+            break;
+
+        case IR_OP:
+            for(unsigned i = 0; i < node->count; ++i)
+                lower(lo, node->operands[i]);
+            write_op(lo, node->op, 1 - (int) node->count);
+            if(node->op == OP_VECTOR)
+                write16(lo, node->count);
+            break;
+
+        case IR_LOCAL: {
+            const Ir_node *binding = node->as.binding;
+            write_op(lo, OP_GET_LOCAL, 1);
+            box_code_write(lo->box, (uint8_t) (binding->tag == IR_LET
+                        ? binding->slot : node->index));
+            break;
+        }
+
+        case IR_GET_GLOBAL:
+            lower_global(lo, OP_GET_GLOBAL, node->as.name, 1);
+            break;
+
+        case IR_SET_GLOBAL:
+            lower(lo, node->operands[0]);
+            lower_global(lo, OP_SET_GLOBAL, node->as.name, 0);
+            break;
+
+        // The value stays on the stack while the body runs, where the
+        // body finds it by its slot; then the result of the body takes
+        // its place
+        case IR_LET:
+            lower(lo, node->operands[0]);
+            node->slot = lo->height - 1;
+            if(node->slot > UINT8_MAX) {
+                fail(lo, "Too many variables in one expression");
+                return;
+            }
+            lower(lo, node->operands[1]);
+            write_op(lo, OP_SET_LOCAL, -1);
+            box_code_write(lo->box, (uint8_t) node->slot);
+            break;
+
+        case IR_IF: {
+            lower(lo, node->operands[0]);
+            unsigned to_else = lower_jump(lo, OP_JMP_FALSE, -1);
+            // each branch leaves one value where the condition was
+            int height = lo->height;
+            lower(lo, node->operands[1]);
+            unsigned to_end = lower_jump(lo, OP_JMP, 0);
+            patch_jump(lo, to_else);
+            lo->height = height;
+            lower(lo, node->operands[2]);
+            patch_jump(lo, to_end);
+            break;
+        }
+
+        // The code of the function goes right here, to be jumped over. A
+        // call pushes the arguments and a frame, which makes them the
+        // first slots of the function.
+        case IR_FUNCTION: {
+            unsigned over = lower_jump(lo, OP_JMP, 0);
+            if(lo->box->count > UINT16_MAX) {
+                fail(lo, "Function too far into the expression");
+                return;
+            }
+            node->slot = lo->box->count;
+            int height = lo->height;
+            lo->height = node->index;
+            lower(lo, node->operands[0]);
+            write_op(lo, OP_RET, -1);
+            lo->height = height;
+            patch_jump(lo, over);
+            lower(lo, node->operands[1]);
+            break;
+        }
+
+        case IR_CALL: {
+            for(unsigned i = 0; i < node->count; ++i)
+                lower(lo, node->operands[i]);
+            unsigned entry = node->as.binding->slot;
+            write_op(lo, OP_CALL, 1 - (int) node->count);
+            write16(lo, entry);
+            box_code_write(lo->box, (uint8_t) node->count);
+            break;
+        }
+    }
+}
+
+bool ir_lower(Ir *ir, Ir_node *root) {
+    Lowering lo = { ir->box, 0, false };
+    lower(&lo, root);
+    write_op(&lo, OP_RET, -1);
+    return !lo.failed;
+}
@@ -20,13 +20,16 @@
    <https://www.gnu.org/licenses/>.
 */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
 #include "lexer.h"
+#include "memory.h"
 
 // Core functions and definitions
 
+// What peek sees past the end
 #define END '\0'
 
 static bool is_space(char ch) {
@@ -62,15 +65,17 @@ static char advance(Lexer *lex) {
 }
 
 static char peek(const Lexer *lex) {
+    if(lex->current == lex->end)
+        return END;
     return lex->current[0];
 }
 
 static bool at_end(const Lexer *lex) {
-    return lex->current[0] == END;
+    return lex->current == lex->end;
 }
 
 static bool match(Lexer *lex, char ch) {
-    if(lex->current[0] == ch) {
+    if(peek(lex) == ch) {
         ++lex->current;
         return true;
     }
@@ -79,44 +84,49 @@ static bool match(Lexer *lex, char ch) {
 
 // Lexing functions
 
-// Most general token creation function
-static Token make_token(const Lexer *lex, Token_t type) {
-    Token tok;
-    tok.type = type;
-    tok.start = lex->start;
-    tok.offset = lex->current - lex->start;
-    tok.line = lex->line;
-    tok.col = lex->col;
-    return tok;
+// Most general token creation function: the token runs from start up to
+// the current character
+static Token_t make_token(Lexer *lex, Token_t type) {
+    lex->length = lex->current - lex->start;
+    return type;
 }
 
-// Report errors by emiting tokens
-static Token error_token(const Lexer *lex, const char *text) {
-    Token err;
-    err.type = TOKEN_ERR;
-    err.start = text;
-    err.offset = strlen(text);
-    err.line = lex->line;
-    err.col = lex->col;
-    return err;
+typedef enum {
+    ERROR_INVALID_SYMBOL,
+    ERROR_UNTERMINATED_STRING,
+    ERROR_BANG,
+    ERROR_UNRECOGNIZED,
+} Lexer_error;
+
+static const char *const error_messages[] = {
+    [ERROR_INVALID_SYMBOL] = "Invalid symbol",
+    [ERROR_UNTERMINATED_STRING] = "Unterminated string",
+    [ERROR_BANG] = "Unexpected '!'; do you mean 'not'?",
+    [ERROR_UNRECOGNIZED] = "Unrecognized character!",
+};
+
+// Report errors by emiting tokens, whose length says which error it is
+static Token_t error_token(Lexer *lex, Lexer_error error) {
+    lex->length = error;
+    return TOKEN_ERR;
 }
 
-static Token number_token(Lexer *lex) {
+static Token_t number_token(Lexer *lex) {
     // Integer part
     while(is_digit(peek(lex)))
         advance(lex);
-    // Optional decimal part
+    // Optional decimal part, without which it's an int
     if(match(lex, '.')) {
         while(is_digit(peek(lex)))
             advance(lex);
+        return make_token(lex, TOKEN_NUM);
     }
-    return make_token(lex, TOKEN_NUM);
+    return make_token(lex, TOKEN_INT);
 }
 
-static Token symbol_token(Lexer *lex) {
+static Token_t symbol_token(Lexer *lex) {
     // We've already consumed the double colon
     // It should not be included in the symbol, so:
-    ++lex->col;
     ++lex->start;
     // Now we essentially lex an identifier
     if(is_valid_first(peek(lex))) {
@@ -125,10 +135,25 @@ static Token symbol_token(Lexer *lex) {
             advance(lex);
         return make_token(lex, TOKEN_SYM);
     }
-    return error_token(lex, "Invalid symbol");
+    return error_token(lex, ERROR_INVALID_SYMBOL);
 }
 
-static Token id_or_keyword_token(Lexer *lex) {
+static Token_t string_token(Lexer *lex) {
+    // As with symbols, the opening quote is left out...
+    ++lex->start;
+    while(peek(lex) != '"') {
+        // strings don't span lines
+        if(at_end(lex) || peek(lex) == '\n')
+            return error_token(lex, ERROR_UNTERMINATED_STRING);
+        advance(lex);
+    }
+    // ...and so is the closing one, which is still consumed
+    make_token(lex, TOKEN_STR);
+    advance(lex);
+    return TOKEN_STR;
+}
+
+static Token_t id_or_keyword_token(Lexer *lex) {
     // We've already consumed the first character
     // Now we consume the rest...
     while(is_valid_rest(peek(lex)))
@@ -138,20 +163,85 @@ static Token id_or_keyword_token(Lexer *lex) {
     int length = lex->current - lex->start;
     switch(lex->start[0]) {
         case 'a':
-            // Can be 'and'
+            // Can be 'and'...
             if(length == 3
                     && lex->start[1] == 'n'
                     && lex->start[2] == 'd')
                 return make_token(lex, TOKEN_AND);
+            // ...or 'abs'
+            else if(length == 3
+                    && lex->start[1] == 'b'
+                    && lex->start[2] == 's')
+                return make_token(lex, TOKEN_ABS);
+            break;
+        case 'e':
+            // Can be 'else'...
+            if(length == 4
+                    && lex->start[1] == 'l'
+                    && lex->start[2] == 's'
+                    && lex->start[3] == 'e')
+                return make_token(lex, TOKEN_ELSE);
+            // ...or 'exp'
+            else if(length == 3
+                    && lex->start[1] == 'x'
+                    && lex->start[2] == 'p')
+                return make_token(lex, TOKEN_EXP);
             break;
         case 'f':
-            // Can be 'false'
+            // Can be 'false'...
             if(length == 5
                     && lex->start[1] == 'a'
                     && lex->start[2] == 'l'
                     && lex->start[3] == 's'
                     && lex->start[4] == 'e')
                 return make_token(lex, TOKEN_FALSE);
+            // ...or 'floor'
+            else if(length == 5
+                    && lex->start[1] == 'l'
+                    && lex->start[2] == 'o'
+                    && lex->start[3] == 'o'
+                    && lex->start[4] == 'r')
+                return make_token(lex, TOKEN_FLOOR);
+            break;
+        case 'i':
+            // Can be 'in'...
+            if(length == 2
+                    && lex->start[1] == 'n')
+                return make_token(lex, TOKEN_IN);
+            // ...or 'if'
+            else if(length == 2
+                    && lex->start[1] == 'f')
+                return make_token(lex, TOKEN_IF);
+            break;
+        case 'l':
+            // Can be 'let'...
+            if(length == 3
+                    && lex->start[1] == 'e'
+                    && lex->start[2] == 't')
+                return make_token(lex, TOKEN_LET);
+            // ...or 'log'
+            else if(length == 3
+                    && lex->start[1] == 'o'
+                    && lex->start[2] == 'g')
+                return make_token(lex, TOKEN_LOG);
+            break;
+        case 'm':
+            // Can be 'min'...
+            if(length == 3
+                    && lex->start[1] == 'i'
+                    && lex->start[2] == 'n')
+                return make_token(lex, TOKEN_MIN);
+            // ...or 'mean'...
+            else if(length == 4
+                    && lex->start[1] == 'e'
+                    && lex->start[2] == 'a'
+                    && lex->start[3] == 'n')
+                return make_token(lex, TOKEN_MEAN);
+            // ...or 'max'
+            else if(length == 3
+                    && lex->start[1] == 'a'
+                    && lex->start[2] == 'x')
+                return make_token(lex, TOKEN_MAX);
             break;
         case 'n':
             // Can be 'not'...
@@ -166,58 +256,84 @@ static Token id_or_keyword_token(Lexer *lex) {
                     && lex->start[3] == 'e')
                 return make_token(lex, TOKEN_NONE);
             break;
+        case 'o':
+            // Can be 'or'
+            if(length == 2
+                    && lex->start[1] == 'r')
+                return make_token(lex, TOKEN_OR);
+            break;
+        case 'p':
+            // Can be 'pow'
+            if(length == 3
+                    && lex->start[1] == 'o'
+                    && lex->start[2] == 'w')
+                return make_token(lex, TOKEN_POW);
+            break;
+        case 's':
+            // Can be 'sqrt'...
+            if(length == 4
+                    && lex->start[1] == 'q'
+                    && lex->start[2] == 'r'
+                    && lex->start[3] == 't')
+                return make_token(lex, TOKEN_SQRT);
+            // ...or 'sum'
+            else if(length == 3
+                    && lex->start[1] == 'u'
+                    && lex->start[2] == 'm')
+                return make_token(lex, TOKEN_SUM);
+            break;
         case 't':
-            // Can be 'true'
+            // Can be 'true'...
             if(length == 4
                     && lex->start[1] == 'r'
                     && lex->start[2] == 'u'
                     && lex->start[3] == 'e')
                 return make_token(lex, TOKEN_TRUE);
+            // ...or 'then'
+            else if(length == 4
+                    && lex->start[1] == 'h'
+                    && lex->start[2] == 'e'
+                    && lex->start[3] == 'n')
+                return make_token(lex, TOKEN_THEN);
             break;
     }
 
     // Can only be an identifier
-    return error_token(lex, "Variables are currently not supported");
+    return make_token(lex, TOKEN_ID);
 }
 
-// Skips whitespace and comments, appropriately resetting the column
-// count when a newline is detected
-static void skip_whitespace(Lexer *lex) {
+// Skips whitespace and comments, keeping track of where lines start
+// when asked to. Inlined into every caller, so tokenizing pays nothing
+// for lines. Returns whether the end cut a comment short.
+static COG_ALWAYS_INLINE bool skip_whitespace(Lexer *lex, bool track_lines) {
     char ch;
     while(is_space(peek(lex)) || peek(lex) == '#') {
-        ++lex->col;
         ch = advance(lex);
         switch(ch) {
             case '\n':
-                ++lex->line;
-                // reset column count at newlines
-                lex->col = 1;
+                if(track_lines) {
+                    ++lex->line;
+                    lex->line_start = lex->current;
+                }
                 break;
             case '#':
                 // Python-style comments
                 while(peek(lex) != '\n' && !at_end(lex))
                     advance(lex);
-                // reset column count at newlines
-                lex->col = 1;
+                if(at_end(lex))
+                    return true;
                 break;
         }
     }
+    return false;
 }
 
-// Public interface
-
-void lexer_init(Lexer *lex, const char *source) {
-    lex->start = lex->current = source;
-    lex->line = lex->col = 1;
-}
-
-Token lexer_get_token(Lexer *lex) {
-    // take into account the movement done when lexing the last token
-    lex->col += lex->current - lex->start;
-
-    // skip whitespace and reset the starting point
-    skip_whitespace(lex);
+// Lexes the token after the whitespace, leaving it between start and
+// start + length, unless it's an error
+static Token_t scan(Lexer *lex) {
     lex->start = lex->current;
+    if(at_end(lex))
+        return make_token(lex, TOKEN_END);
 
     char ch = advance(lex);
     // Tokens of small length
@@ -229,7 +345,9 @@ Token lexer_get_token(Lexer *lex) {
         case '/': return make_token(lex, TOKEN_SLASH);
         case '(': return make_token(lex, TOKEN_OPEN_PAREN);
         case ')': return make_token(lex, TOKEN_CLOSE_PAREN);
-        case END: return make_token(lex, TOKEN_END);
+        case '[': return make_token(lex, TOKEN_OPEN_BRACKET);
+        case ']': return make_token(lex, TOKEN_CLOSE_BRACKET);
+        case ',': return make_token(lex, TOKEN_COMMA);
 
         // Possibly double character tokens
         case '<':
@@ -250,7 +368,7 @@ Token lexer_get_token(Lexer *lex) {
         case '!':
             if(match(lex, '='))
                 return make_token(lex, TOKEN_NOT_EQUAL);
-            return error_token(lex, "Unexpected '!'; do you mean 'not'?");
+            return error_token(lex, ERROR_BANG);
 
     }
 
@@ -262,9 +380,300 @@ Token lexer_get_token(Lexer *lex) {
         // It can only be a symbol
         return symbol_token(lex);
 
+    if(ch == '"')
+        return string_token(lex);
+
     if(is_valid_first(ch))
         // It can be an identifier or a keyword
         return id_or_keyword_token(lex);
 
-    return error_token(lex, "Unrecognized character!");
+    return error_token(lex, ERROR_UNRECOGNIZED);
+}
+
+// Token buffers
+
+static void buffer_init(Token_buffer *buf, unsigned capacity, Cog_arena *arena) {
+    buf->arena = arena;
+    buf->count = 0;
+    buf->capacity = capacity;
+    buf->types = cog_arena_alloc(arena, capacity * sizeof(uint8_t));
+    buf->starts = cog_arena_alloc(arena, capacity * sizeof(uint32_t));
+    buf->lengths = cog_arena_alloc(arena, capacity * sizeof(uint32_t));
+    buf->newlines = NULL;
+    buf->newline_count = buf->newline_capacity = 0;
+    buf->indexed = false;
+    buf->segments = NULL;
+    buf->segment_count = buf->segment_capacity = 0;
+}
+
+static void buffer_grow(Token_buffer *buf) {
+    unsigned capacity = buf->capacity * 2;
+    uint8_t *types = cog_arena_alloc(buf->arena, capacity * sizeof(uint8_t));
+    uint32_t *starts = cog_arena_alloc(buf->arena, capacity * sizeof(uint32_t));
+    uint32_t *lengths = cog_arena_alloc(buf->arena, capacity * sizeof(uint32_t));
+    memcpy(types, buf->types, buf->count * sizeof(uint8_t));
+    memcpy(starts, buf->starts, buf->count * sizeof(uint32_t));
+    memcpy(lengths, buf->lengths, buf->count * sizeof(uint32_t));
+    buf->types = types;
+    buf->starts = starts;
+    buf->lengths = lengths;
+    buf->capacity = capacity;
+}
+
+static inline void buffer_push(Token_buffer *buf, Token_t type, uint32_t start,
+        uint32_t length) {
+    if(buf->count == buf->capacity)
+        buffer_grow(buf);
+    buf->types[buf->count] = (uint8_t) type;
+    buf->starts[buf->count] = start;
+    buf->lengths[buf->count] = length;
+    ++buf->count;
+}
+
+// Offsets of every newline in the source, for positions to be looked up
+static void index_newlines(Token_buffer *buf) {
+    unsigned count = 0;
+    for(const char *p = buf->source; (p = memchr(p, '\n', buf->end - p)) != NULL; ++p)
+        ++count;
+    buf->newlines = cog_arena_alloc(buf->arena, (count + 1) * sizeof(uint32_t));
+    buf->newline_count = 0;
+    for(const char *p = buf->source; (p = memchr(p, '\n', buf->end - p)) != NULL; ++p)
+        buf->newlines[buf->newline_count++] = p - buf->source;
+    buf->indexed = true;
+}
+
+// Public interface
+
+void lexer_init(Lexer *lex, const char *source, size_t length) {
+    lex->start = lex->current = lex->line_start = source;
+    lex->end = source + length;
+    lex->line = 1;
+    lex->length = 0;
+}
+
+Token lexer_get_token(Lexer *lex) {
+    skip_whitespace(lex, true);
+    Token tok;
+    tok.type = scan(lex);
+    tok.start = lex->start;
+    tok.offset = lex->length;
+    tok.line = lex->line;
+    tok.col = lex->start - lex->line_start + 1;
+    if(tok.type == TOKEN_ERR) {
+        tok.start = error_messages[lex->length];
+        tok.offset = strlen(tok.start);
+    }
+    return tok;
+}
+
+void lexer_tokenize(Token_buffer *buf, const char *source, size_t length,
+        Cog_arena *arena) {
+    if(length > UINT32_MAX)
+        length = UINT32_MAX;
+    // about one token for every two characters, to begin with, which
+    // few sources go past
+    buffer_init(buf, length / 2 + 16, arena);
+    buf->source = source;
+    buf->end = source + length;
+
+    Lexer lex;
+    lexer_init(&lex, source, length);
+    Token_t type;
+    do {
+        skip_whitespace(&lex, false);
+        type = scan(&lex);
+        buffer_push(buf, type, lex.start - source, lex.length);
+    } while(type != TOKEN_END);
+}
+
+// Streams
+
+// Where the next piece of the source is, with the newlines in it, which
+// are indexed as they come, since the pieces may be gone by the time
+// positions are looked up
+static void stream_segment(Lexer_stream *ls, const char *piece, size_t length) {
+    Token_buffer *buf = ls->buf;
+    for(const char *p = piece; (p = memchr(p, '\n', piece + length - p)) != NULL; ++p) {
+        if(buf->newline_count == buf->newline_capacity) {
+            unsigned capacity = buf->newline_capacity * 2;
+            uint32_t *newlines = cog_arena_alloc(buf->arena, capacity * sizeof(uint32_t));
+            memcpy(newlines, buf->newlines, buf->newline_count * sizeof(uint32_t));
+            buf->newlines = newlines;
+            buf->newline_capacity = capacity;
+        }
+        buf->newlines[buf->newline_count++] = ls->offset + (p - piece);
+    }
+}
+
+static void stream_text(Lexer_stream *ls, uint32_t offset, const char *data) {
+    Token_buffer *buf = ls->buf;
+    if(buf->segment_count == buf->segment_capacity) {
+        unsigned capacity = buf->segment_capacity * 2;
+        Token_segment *segments = cog_arena_alloc(buf->arena,
+                capacity * sizeof(Token_segment));
+        memcpy(segments, buf->segments, buf->segment_count * sizeof(Token_segment));
+        buf->segments = segments;
+        buf->segment_capacity = capacity;
+    }
+    buf->segments[buf->segment_count].offset = offset;
+    buf->segments[buf->segment_count].data = data;
+    ++buf->segment_count;
+}
+
+static void carry_append(Lexer_stream *ls, const char *data, size_t length) {
+    if(ls->carry_length + length > ls->carry_capacity) {
+        size_t capacity = ls->carry_capacity * 2 + length + 32;
+        ls->carry = cog_realloc(ls->carry, ls->carry_capacity, capacity);
+        ls->carry_capacity = capacity;
+    }
+    memcpy(ls->carry + ls->carry_length, data, length);
+    ls->carry_length += length;
+}
+
+// Moves the carried token, lexed as lex has it, into the buffer, with
+// its text copied to where it will last
+static void carry_emit(Lexer_stream *ls, const Lexer *lex, Token_t type) {
+    size_t length = lex->current - ls->carry;
+    char *copy = cog_arena_alloc(ls->buf->arena, length);
+    memcpy(copy, ls->carry, length);
+    stream_text(ls, ls->carry_offset, copy);
+    buffer_push(ls->buf, type, ls->carry_offset + (lex->start - ls->carry), lex->length);
+    ls->carry_length = 0;
+}
+
+// Lexes the rest of the carried token from the start of the piece, and
+// returns how much of the piece it took. Only as much of the piece is
+// copied as the token might need, which is doubled until it ends
+// before what has been copied does.
+static size_t carry_resume(Lexer_stream *ls, const char *piece, size_t length) {
+    size_t carried = ls->carry_length;
+    size_t taken = 0;
+    while(taken < length) {
+        size_t more = ls->carry_length < 16 ? 16 : ls->carry_length;
+        if(more > length - taken)
+            more = length - taken;
+        carry_append(ls, piece + taken, more);
+        taken += more;
+        Lexer lex;
+        lexer_init(&lex, ls->carry, ls->carry_length);
+        Token_t type = scan(&lex);
+        if(!at_end(&lex)) {
+            size_t used = (lex.current - ls->carry) - carried;
+            carry_emit(ls, &lex, type);
+            return used;
+        }
+    }
+    // the token goes on into the next piece
+    return length;
+}
+
+void lexer_stream_init(Lexer_stream *ls, Token_buffer *buf, Cog_arena *arena) {
+    buffer_init(buf, 64, arena);
+    buf->source = buf->end = NULL;
+    buf->newline_capacity = 16;
+    buf->newlines = cog_arena_alloc(arena, buf->newline_capacity * sizeof(uint32_t));
+    buf->indexed = true; // as it goes
+    buf->segment_capacity = 4;
+    buf->segments = cog_arena_alloc(arena, buf->segment_capacity * sizeof(Token_segment));
+    ls->buf = buf;
+    ls->offset = 0;
+    ls->carry = NULL;
+    ls->carry_length = ls->carry_capacity = 0;
+    ls->carry_offset = 0;
+    ls->in_comment = false;
+}
+
+void lexer_stream_feed(Lexer_stream *ls, const char *piece, size_t length) {
+    if(length > UINT32_MAX - ls->offset)
+        length = UINT32_MAX - ls->offset;
+    if(length == 0)
+        return;
+    stream_segment(ls, piece, length);
+    Lexer lex;
+    lexer_init(&lex, piece, length);
+    if(ls->in_comment) {
+        const char *newline = memchr(piece, '\n', length);
+        if(newline == NULL) {
+            ls->offset += length;
+            return;
+        }
+        lex.current = newline;
+        ls->in_comment = false;
+    } else if(ls->carry_length > 0) {
+        lex.current += carry_resume(ls, piece, length);
+        if(ls->carry_length > 0) {
+            ls->offset += length;
+            return;
+        }
+    }
+    stream_text(ls, ls->offset, piece);
+    while(true) {
+        if(skip_whitespace(&lex, false)) {
+            ls->in_comment = true;
+            break;
+        }
+        if(at_end(&lex))
+            break;
+        const char *start = lex.current;
+        Token_t type = scan(&lex);
+        if(at_end(&lex)) {
+            // the next piece may have more of it
+            ls->carry_offset = ls->offset + (start - piece);
+            carry_append(ls, start, lex.end - start);
+            break;
+        }
+        buffer_push(ls->buf, type, ls->offset + (lex.start - piece), lex.length);
+    }
+    ls->offset += length;
+}
+
+void lexer_stream_finish(Lexer_stream *ls) {
+    if(ls->carry_length > 0) {
+        Lexer lex;
+        lexer_init(&lex, ls->carry, ls->carry_length);
+        carry_emit(ls, &lex, scan(&lex));
+    }
+    // the end has no text, but it's somewhere all the same
+    stream_text(ls, ls->offset, "");
+    buffer_push(ls->buf, TOKEN_END, ls->offset, 0);
+    free(ls->carry);
+    ls->carry = NULL;
+    ls->carry_capacity = 0;
+    ls->in_comment = false;
+}
+
+const char *lexer_error_message(uint32_t length) {
+    return error_messages[length];
+}
+
+const char *token_buffer_text(const Token_buffer *buf, uint32_t offset) {
+    // the last segment that starts at or before offset
+    unsigned low = 0, high = buf->segment_count;
+    while(high - low > 1) {
+        unsigned mid = low + (high - low) / 2;
+        if(buf->segments[mid].offset <= offset)
+            low = mid;
+        else
+            high = mid;
+    }
+    return buf->segments[low].data + (offset - buf->segments[low].offset);
+}
+
+void token_buffer_position(Token_buffer *buf, unsigned index, int *line, int *col) {
+    if(!buf->indexed)
+        index_newlines(buf);
+    // the newlines before the token, of which the last ends the line
+    // before its own
+    uint32_t offset = buf->starts[index];
+    unsigned low = 0, high = buf->newline_count;
+    while(low < high) {
+        unsigned mid = low + (high - low) / 2;
+        if(buf->newlines[mid] < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    uint32_t line_start = low == 0 ? 0 : buf->newlines[low - 1] + 1;
+    *line = low + 1;
+    *col = offset - line_start + 1;
 }
@@ -22,30 +22,188 @@
 
 // Yet another attempt to build a programming language
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "batch.h"
 #include "box.h"
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "memory.h"
+#include "output.h"
+#include "passes.h"
+#include "pipeline.h"
+#include "server.h"
+#include "stats.h"
 #include "value.h"
 #include "vm.h"
 
-int main(int argc, char *argv[]) {
-    char expr[1024];
+static void usage(const char *name) {
+    eprintf("usage: %s [-O0 | -O1 | -O2] [--profile] [--stats] [--perf-counters]"
+            " [--batch FILE [--jobs N] | --rules FILE | --serve SOCKET [--slice N]]\n", name);
+    eprintf("  --batch FILE  evaluate each line of FILE, writing one result per line\n");
+    eprintf("  --rules FILE  evaluate the lines of FILE together, computing what they\n"
+            "                have in common once\n");
+    eprintf("  --jobs N      evaluate FILE on N threads, or one per core if N is 0\n");
+    eprintf("  --serve PATH  answer requests on a Unix domain socket at PATH\n");
+    eprintf("  --slice N     take turns between evaluations every N instructions\n");
+    eprintf("  -O0, -O1, -O2 compile as written, folding constants, or also simplifying\n"
+            "                (the default)\n");
+    eprintf("  --profile     show where the time of each expression goes\n");
+    eprintf("  --stats       write latency percentiles of each phase to stderr as\n"
+            "                JSON on exit, and whenever SIGUSR1 arrives\n");
+    eprintf("  --perf-counters  also count cycles, instructions, branch misses and\n"
+            "                L1d misses in each phase, shown after every expression\n"
+            "                and averaged in the statistics\n");
+}
+
+// Reads expressions from stdin, one per line. When profiling, each
+// result is followed by its annotated disassembly, and the totals per
+// opcode are shown at the end. Hardware events, when counted, are shown
+// after every result too.
+static void repl(Cog_output *out, bool profile, Cog_stats *stats) {
     Cog_env env;
     cog_env_init(&env);
-    while(fgets(expr, 1024, stdin) != NULL) {
-        Box box;
-        box_init(&box);
-        bool alright = compile(expr, &box);
+#ifdef COG_PROFILE
+    Cog_profile prof;
+    cog_profile_init(&prof);
+    if(profile) env.profile = &prof;
+#else
+    (void) profile;
+#endif
+    Box box;
+    box_init(&box);
+    // Results are written out in bulk, except when someone is typing
+    // at the other end
+    bool interactive = isatty(fileno(stdin));
+    char *expr = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while((length = getline(&expr, &capacity, stdin)) != -1) {
+        box_reset(&box);
+        uint64_t time = 0;
+        if(stats != NULL) {
+            cog_stats_time_lexer(stats, expr, length);
+            time = cog_stats_start(stats);
+        }
+        bool alright = compile(expr, length, &box);
+        if(stats != NULL)
+            time = cog_stats_record(stats, PHASE_COMPILE, time);
         if(alright) {
+#ifdef COG_PROFILE
+            cog_profile_attach(&prof, &box);
+            if(stats != NULL) time = cog_stats_start(stats);
+#endif
             Cog_result res = execute(&env, &box);
-            if(res == RES_ERROR)
+            if(stats != NULL)
+                cog_stats_record(stats, PHASE_EXECUTE, time);
+            if(res != RES_OK)
                 eprintf("(!) Runtime error ocurred!\n");
+            else {
+                cog_output_write(out, "=> ", 3);
+                cog_output_value(out, env.ret);
+                cog_output_char(out, '\n');
+            }
+#ifdef COG_PROFILE
+            if(profile) {
+                cog_output_flush(out);
+                disassemble_profiled(&box, &prof);
+            }
+#endif
+        }
+        if(stats != NULL && stats->perf != NULL) {
+            cog_output_flush(out);
+            cog_stats_print_events(stats, stderr);
         }
-        box_free(&box);
+        if(stats != NULL && cog_stats_dump_requested())
+            cog_stats_write_json(stats, stderr);
+        if(interactive) cog_output_flush(out);
+    }
+#ifdef COG_PROFILE
+    if(profile) {
+        cog_output_flush(out);
+        print_opcode_profile(&prof);
     }
+    cog_profile_free(&prof);
+#endif
+    free(expr);
+    box_free(&box);
     cog_env_free(&env);
-    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *batch_path = NULL;
+    const char *rules_path = NULL;
+    const char *socket_path = NULL;
+    int jobs = 1;
+    uint64_t slice = 0;
+    bool profile = false;
+    bool perf_counters = false;
+    Cog_stats *stats = NULL;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0'
+                && argv[i][2] <= '0' + PASSES_MAX_LEVEL && argv[i][3] == '\0') {
+            compile_set_level(argv[i][2] - '0');
+        } else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if(strcmp(argv[i], "--rules") == 0 && i + 1 < argc) {
+            rules_path = argv[++i];
+        } else if(strcmp(argv[i], "--profile") == 0) {
+#ifndef COG_PROFILE
+            eprintf("(!) This cog was built without profiling; "
+                    "reconfigure with -Dprofile=true\n");
+            return 1;
+#endif
+            profile = true;
+        } else if(strcmp(argv[i], "--stats") == 0
+                || strcmp(argv[i], "--perf-counters") == 0) {
+            if(strcmp(argv[i], "--perf-counters") == 0)
+                perf_counters = true;
+            if(stats == NULL) {
+                stats = cog_realloc(NULL, 0, sizeof(Cog_stats));
+                cog_stats_init(stats);
+            }
+        } else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if(strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+            slice = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(stats != NULL)
+        cog_stats_handle_signal();
+    if(perf_counters && !cog_stats_count_events(stats))
+        eprintf("(!) Hardware performance counters are unavailable here; "
+                "only times will be reported\n");
+
+    Cog_output out;
+    cog_output_init(&out, stdout, COG_OUTPUT_CAPACITY);
+    bool alright = true;
+    if(socket_path != NULL)
+        alright = server_run(socket_path, slice, stats);
+    else if(rules_path != NULL)
+        alright = batch_run_rules(rules_path, &out, stats);
+    else if(batch_path != NULL && jobs != 1)
+        alright = pipeline_run(batch_path, jobs, &out, stats);
+    else if(batch_path != NULL)
+        alright = batch_run(batch_path, &out, stats);
+    else
+        repl(&out, profile, stats);
+    cog_output_flush(&out);
+    cog_output_free(&out);
+    if(stats != NULL) {
+        cog_stats_write_json(stats, stderr);
+        cog_stats_free(stats);
+        free(stats);
+    }
+    return alright ? 0 : 1;
 }
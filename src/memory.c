@@ -39,3 +39,60 @@ void *cog_realloc(void *ptr, size_t old_size, size_t new_size) {
     }
     return new_ptr;
 }
+
+void cog_arena_init(Cog_arena *arena) {
+    arena->chunks = NULL;
+}
+
+void *cog_arena_alloc(Cog_arena *arena, size_t size) {
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+    Cog_arena_chunk *chunk = arena->chunks;
+    if(chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > COG_ARENA_CHUNK_SIZE ? size : COG_ARENA_CHUNK_SIZE;
+        chunk = cog_realloc(NULL, 0, sizeof(Cog_arena_chunk) + chunk_size);
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    void *ptr = (char*) chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void cog_arena_reset(Cog_arena *arena) {
+    if(arena->chunks == NULL)
+        return;
+    // keep the biggest chunk
+    Cog_arena_chunk *kept = arena->chunks;
+    for(Cog_arena_chunk *c = arena->chunks->next; c != NULL; c = c->next)
+        if(c->size > kept->size) kept = c;
+    Cog_arena_chunk *chunk = arena->chunks;
+    while(chunk != NULL) {
+        Cog_arena_chunk *next = chunk->next;
+        if(chunk != kept) free(chunk);
+        chunk = next;
+    }
+    kept->next = NULL;
+    kept->used = 0;
+    arena->chunks = kept;
+}
+
+void cog_arena_free(Cog_arena *arena) {
+    Cog_arena_chunk *chunk = arena->chunks;
+    while(chunk != NULL) {
+        Cog_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+uint32_t cog_hash_bytes(const char *bytes, size_t length) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t) bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
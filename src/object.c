@@ -0,0 +1,210 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+#define INTERN_TABLE_INITIAL_CAPACITY 256
+
+static Cog_value short_string(const char *chars, size_t length) {
+    Cog_value value;
+    value.type = TYPE_SHORT_STRING;
+    memset(value.as.chars, 0, sizeof(value.as.chars));
+    memcpy(value.as.chars, chars, length);
+    value.as.chars[COG_SHORT_STRING_MAX] = (char) length;
+    return value;
+}
+
+// Leaves the contents to the caller
+static Cog_string *allocate_string(Cog_arena *arena, size_t length) {
+    size_t size = sizeof(Cog_string) + length + 1;
+    Cog_string *string = arena != NULL ? cog_arena_alloc(arena, size)
+        : cog_realloc(NULL, 0, size);
+    string->length = (uint32_t) length;
+    string->hash = 0;
+    string->interned = false;
+    string->chars[length] = '\0';
+    return string;
+}
+
+Cog_value cog_string_value(Cog_arena *arena, const char *chars, size_t length) {
+    if(length <= COG_SHORT_STRING_MAX)
+        return short_string(chars, length);
+    Cog_string *string = allocate_string(arena, length);
+    memcpy(string->chars, chars, length);
+    return COG_STRING(string);
+}
+
+const char *cog_string_chars(const Cog_value *value, size_t *length) {
+    if(value->type == TYPE_SHORT_STRING) {
+        *length = (uint8_t) value->as.chars[COG_SHORT_STRING_MAX];
+        return value->as.chars;
+    }
+    *length = TO_STRING(*value)->length;
+    return TO_STRING(*value)->chars;
+}
+
+uint32_t cog_string_hash(Cog_string *string) {
+    if(string->hash == 0) {
+        uint32_t hash = cog_hash_bytes(string->chars, string->length);
+        // 0 is taken to mean not yet computed
+        string->hash = hash != 0 ? hash : 1;
+    }
+    return string->hash;
+}
+
+Cog_value cog_string_concat(Cog_arena *arena, Cog_value a, Cog_value b) {
+    size_t a_length, b_length;
+    const char *a_chars = cog_string_chars(&a, &a_length);
+    const char *b_chars = cog_string_chars(&b, &b_length);
+    size_t length = a_length + b_length;
+    if(length <= COG_SHORT_STRING_MAX) {
+        Cog_value value = short_string(a_chars, a_length);
+        memcpy(value.as.chars + a_length, b_chars, b_length);
+        value.as.chars[COG_SHORT_STRING_MAX] = (char) length;
+        return value;
+    }
+    Cog_string *string = allocate_string(arena, length);
+    memcpy(string->chars, a_chars, a_length);
+    memcpy(string->chars + a_length, b_chars, b_length);
+    return COG_STRING(string);
+}
+
+bool cog_strings_equal(Cog_value a, Cog_value b) {
+    if(a.type != b.type)
+        return false;
+    if(a.type == TYPE_SHORT_STRING)
+        return cog_short_strings_equal(a, b);
+    Cog_string *x = TO_STRING(a), *y = TO_STRING(b);
+    if(x == y)
+        return true;
+    if((x->interned && y->interned) || x->length != y->length)
+        return false;
+    return cog_string_hash(x) == cog_string_hash(y)
+        && memcmp(x->chars, y->chars, x->length) == 0;
+}
+
+int cog_strings_compare(Cog_value a, Cog_value b) {
+    size_t a_length, b_length;
+    const char *a_chars = cog_string_chars(&a, &a_length);
+    const char *b_chars = cog_string_chars(&b, &b_length);
+    size_t length = a_length < b_length ? a_length : b_length;
+    int order = memcmp(a_chars, b_chars, length);
+    if(order != 0)
+        return order;
+    return a_length < b_length ? -1 : a_length > b_length;
+}
+
+// Vectors
+
+Cog_vector *cog_vector_new(Cog_arena *arena, size_t length) {
+    size_t size = sizeof(Cog_vector) + length * sizeof(double);
+    Cog_vector *vector = arena != NULL ? cog_arena_alloc(arena, size)
+        : cog_realloc(NULL, 0, size);
+    vector->length = (uint32_t) length;
+    return vector;
+}
+
+Cog_value cog_vector_copy(Cog_arena *arena, Cog_value vector) {
+    const Cog_vector *from = TO_VECTOR(vector);
+    Cog_vector *to = cog_vector_new(arena, from->length);
+    memcpy(to->elements, from->elements, from->length * sizeof(double));
+    return COG_VECTOR(to);
+}
+
+bool cog_vectors_equal(Cog_value a, Cog_value b) {
+    const Cog_vector *x = TO_VECTOR(a), *y = TO_VECTOR(b);
+    if(x->length != y->length)
+        return false;
+    for(uint32_t i = 0; i < x->length; ++i) {
+        if(x->elements[i] != y->elements[i])
+            return false;
+    }
+    return true;
+}
+
+// Interning
+
+// Open addressing with linear probing, as for symbols
+static struct {
+    pthread_mutex_t lock;
+    Cog_string **slots;
+    size_t capacity;
+    size_t count;
+} interned = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+static Cog_string **find_slot(Cog_string **slots, size_t capacity,
+        const char *chars, size_t length, uint32_t hash) {
+    size_t mask = capacity - 1;
+    size_t i = hash & mask;
+    while(slots[i] != NULL) {
+        Cog_string *string = slots[i];
+        if(string->hash == hash && string->length == length
+                && memcmp(string->chars, chars, length) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+static void grow(void) {
+    size_t capacity = interned.capacity == 0 ? INTERN_TABLE_INITIAL_CAPACITY
+        : interned.capacity * 2;
+    Cog_string **slots = cog_realloc(NULL, 0, capacity * sizeof(Cog_string*));
+    memset(slots, 0, capacity * sizeof(Cog_string*));
+    for(size_t i = 0; i < interned.capacity; ++i) {
+        Cog_string *string = interned.slots[i];
+        if(string != NULL)
+            *find_slot(slots, capacity, string->chars, string->length, string->hash) = string;
+    }
+    free(interned.slots);
+    interned.slots = slots;
+    interned.capacity = capacity;
+}
+
+Cog_value cog_string_intern(const char *chars, size_t length) {
+    if(length <= COG_SHORT_STRING_MAX)
+        return short_string(chars, length);
+    uint32_t hash = cog_hash_bytes(chars, length);
+    if(hash == 0) hash = 1;
+    pthread_mutex_lock(&interned.lock);
+    if((interned.count + 1) * 4 > interned.capacity * 3)
+        grow();
+    Cog_string **slot = find_slot(interned.slots, interned.capacity, chars, length, hash);
+    if(*slot == NULL) {
+        Cog_string *string = allocate_string(NULL, length);
+        memcpy(string->chars, chars, length);
+        string->hash = hash;
+        string->interned = true;
+        *slot = string;
+        ++interned.count;
+    }
+    Cog_string *string = *slot;
+    pthread_mutex_unlock(&interned.lock);
+    return COG_STRING(string);
+}
@@ -0,0 +1,297 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "box.h"
+#include "common.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "optimize.h"
+#include "value.h"
+
+typedef struct {
+    unsigned offset;
+    unsigned length;
+    unsigned target; // index of the instruction a jump or call lands on
+    uint8_t op;
+    bool landed_on;  // by some jump or call
+    bool dead;       // removed, so it falls through to the next one
+} Inst;
+
+typedef struct {
+    Inst *insts;
+    unsigned count;
+} Code;
+
+static bool is_call(uint8_t op) {
+    return op == OP_CALL || op == OP_TAIL_CALL;
+}
+
+static bool is_jump(uint8_t op) {
+    return op == OP_JMP || op == OP_JMP_FALSE || is_call(op);
+}
+
+// Returns false if there are no jumps to begin with, which is most of
+// the time; there are no calls without them either
+static bool decode(const Box *box, Code *code) {
+    unsigned count = 0;
+    bool jumps = false;
+    for(unsigned offset = 0; offset < box->count;
+            offset += box_instruction_length(box->code[offset])) {
+        jumps = jumps || is_jump(box->code[offset]);
+        ++count;
+    }
+    if(!jumps)
+        return false;
+
+    // instruction index by offset, for finding where jumps land
+    unsigned *index = cog_realloc(NULL, 0, (box->count + 1) * sizeof(unsigned));
+    code->insts = cog_realloc(NULL, 0, (count + 1) * sizeof(Inst));
+    code->count = count;
+    unsigned i = 0;
+    for(unsigned offset = 0; offset < box->count; ++i) {
+        Inst *inst = &code->insts[i];
+        inst->offset = offset;
+        inst->op = box->code[offset];
+        inst->length = box_instruction_length(inst->op);
+        inst->landed_on = inst->dead = false;
+        index[offset] = i;
+        offset += inst->length;
+    }
+    index[box->count] = count;
+    code->insts[count].offset = box->count;
+    for(i = 0; i < count; ++i) {
+        Inst *inst = &code->insts[i];
+        if(is_jump(inst->op)) {
+            inst->target = index[box_jump_target(box, inst->offset)];
+            code->insts[inst->target].landed_on = true;
+        }
+    }
+    free(index);
+    return true;
+}
+
+// The first instruction from i on that is still there
+static unsigned live_from(const Code *code, unsigned i) {
+    while(i < code->count && code->insts[i].dead)
+        ++i;
+    return i;
+}
+
+// Whether the instruction at i always, never or only sometimes pushes
+// a truthy value: 1, 0 or -1
+static int known_truth(const Box *box, const Inst *inst) {
+    const uint8_t *bytes = &box->code[inst->offset];
+    switch(inst->op) {
+        case OP_PSH_TRUE:
+            return 1;
+        case OP_PSH_FALSE:
+        case OP_PSH_NONE:
+            return 0;
+        case OP_PSH:
+            return IS_TRUTHY(cog_array_get(&box->constants, bytes[1]));
+        case OP_PSH_LONG:
+            return IS_TRUTHY(cog_array_get(&box->constants,
+                        bytes[1] | (bytes[2] << 8) | (bytes[3] << 16)));
+        default:
+            return -1;
+    }
+}
+
+static void settle_conditions(const Box *box, Code *code) {
+    for(unsigned i = 1; i < code->count; ++i) {
+        Inst *jump = &code->insts[i], *push = &code->insts[i - 1];
+        // anything landing on the jump itself brings its own condition
+        if(jump->op != OP_JMP_FALSE || jump->landed_on || push->dead)
+            continue;
+        int truth = known_truth(box, push);
+        if(truth == -1)
+            continue;
+        push->dead = true;
+        if(truth)
+            jump->dead = true;
+        else
+            jump->op = OP_JMP;
+    }
+}
+
+// Whether the jump at i can be made to land on target. Jumps and calls
+// only have 16 bits for it, and threading may take a jump further than
+// the compiler ever did; the code only shrinks, so what fits now fits
+// once it is encoded
+static bool within_reach(const Code *code, unsigned i, unsigned target) {
+    const Inst *jump = &code->insts[i];
+    unsigned offset = code->insts[target].offset;
+    if(is_call(jump->op))
+        return offset <= UINT16_MAX;
+    return offset >= jump->offset + 3 && offset - (jump->offset + 3) <= UINT16_MAX;
+}
+
+static void thread_jumps(Code *code) {
+    for(unsigned i = 0; i < code->count; ++i) {
+        Inst *jump = &code->insts[i];
+        if(jump->dead || !is_jump(jump->op))
+            continue;
+        unsigned target = live_from(code, jump->target);
+        // a cycle can't arise from forward jumps, but be sure anyway
+        for(unsigned hops = 0; hops < code->count; ++hops) {
+            if(target == code->count || code->insts[target].op != OP_JMP)
+                break;
+            unsigned next = live_from(code, code->insts[target].target);
+            if(!within_reach(code, i, next))
+                break;
+            target = next;
+        }
+        jump->target = target;
+        if(jump->op == OP_JMP && target < code->count
+                && code->insts[target].op == OP_RET) {
+            jump->op = OP_RET;
+            jump->length = 1;
+        }
+    }
+}
+
+// What a set_local leaves on top is what it found below the value it
+// popped, where let put its result anyway; right before a ret, that's
+// the same value as before
+static void drop_stores_before_ret(Code *code) {
+    for(unsigned i = code->count; i-- > 0;) {
+        Inst *inst = &code->insts[i];
+        if(inst->op != OP_SET_LOCAL || inst->dead)
+            continue;
+        unsigned next = live_from(code, i + 1);
+        if(next < code->count && code->insts[next].op == OP_RET)
+            inst->dead = true;
+    }
+}
+
+// A call right before a ret returns straight to the caller of the
+// function it is in, so it may as well hand its frame to the callee.
+// Jumps in between are followed, as they may not have been threaded.
+static void mark_tail_calls(Code *code) {
+    for(unsigned i = 0; i < code->count; ++i) {
+        Inst *inst = &code->insts[i];
+        if(inst->op != OP_CALL || inst->dead)
+            continue;
+        unsigned next = live_from(code, i + 1);
+        for(unsigned hops = 0; hops < code->count; ++hops) {
+            if(next == code->count || code->insts[next].op != OP_JMP)
+                break;
+            next = live_from(code, code->insts[next].target);
+        }
+        if(next < code->count && code->insts[next].op == OP_RET)
+            inst->op = OP_TAIL_CALL;
+    }
+}
+
+static void remove_unreachable(Code *code) {
+    bool *reached = cog_realloc(NULL, 0, code->count + 1);
+    memset(reached, 0, code->count + 1);
+    unsigned *pending = cog_realloc(NULL, 0, (2 * code->count + 1) * sizeof(unsigned));
+    unsigned count = 0;
+    pending[count++] = 0;
+    while(count > 0) {
+        unsigned i = live_from(code, pending[--count]);
+        if(i == code->count || reached[i])
+            continue;
+        reached[i] = true;
+        const Inst *inst = &code->insts[i];
+        if(is_jump(inst->op))
+            pending[count++] = inst->target;
+        if(inst->op != OP_JMP && inst->op != OP_TAIL_CALL && inst->op != OP_RET)
+            pending[count++] = i + 1;
+    }
+    for(unsigned i = 0; i < code->count; ++i) {
+        if(!reached[i])
+            code->insts[i].dead = true;
+    }
+    for(unsigned i = 0; i < code->count; ++i) {
+        Inst *inst = &code->insts[i];
+        // a jump to where it would have gone anyway
+        if(!inst->dead && inst->op == OP_JMP
+                && live_from(code, i + 1) == live_from(code, inst->target))
+            inst->dead = true;
+    }
+    free(pending);
+    free(reached);
+}
+
+static void encode(Box *box, const Code *code) {
+    // new offsets of the instructions that are left, and of the next
+    // one left for those that are not
+    unsigned *offsets = cog_realloc(NULL, 0, (code->count + 1) * sizeof(unsigned));
+    unsigned size = 0;
+    for(unsigned i = 0; i < code->count; ++i) {
+        offsets[i] = size;
+        if(!code->insts[i].dead)
+            size += code->insts[i].length;
+    }
+    offsets[code->count] = size;
+
+    uint8_t *bytes = cog_realloc(NULL, 0, size > 0 ? size : 1);
+    for(unsigned i = 0; i < code->count; ++i) {
+        const Inst *inst = &code->insts[i];
+        if(inst->dead)
+            continue;
+        uint8_t *out = &bytes[offsets[i]];
+        if(is_call(inst->op)) {
+            // functions are found by where they start, not how far
+            out[0] = inst->op;
+            out[1] = (uint8_t) (offsets[inst->target] & 0xFF);
+            out[2] = (uint8_t) ((offsets[inst->target] >> 8) & 0xFF);
+            out[3] = box->code[inst->offset + 3];
+        } else if(is_jump(inst->op)) {
+            unsigned distance = offsets[inst->target] - (offsets[i] + 3);
+            out[0] = inst->op;
+            out[1] = (uint8_t) (distance & 0xFF);
+            out[2] = (uint8_t) ((distance >> 8) & 0xFF);
+        } else if(inst->op == OP_RET) {
+            out[0] = OP_RET;
+        } else {
+            memcpy(out, &box->code[inst->offset], inst->length);
+        }
+    }
+    // the code only ever shrinks
+    memcpy(box->code, bytes, size);
+    box->count = size;
+    free(bytes);
+    free(offsets);
+}
+
+void optimize_jumps(Box *box, int level) {
+    Code code;
+    if(!decode(box, &code))
+        return;
+    if(level > 0)
+        settle_conditions(box, &code);
+    drop_stores_before_ret(&code);
+    if(level > 0)
+        thread_jumps(&code);
+    mark_tail_calls(&code);
+    if(level > 0)
+        remove_unreachable(&code);
+    encode(box, &code);
+    free(code.insts);
+}
@@ -0,0 +1,91 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+#include "output.h"
+#include "value.h"
+
+// Makes room for at least length more bytes, flushing when the output
+// is backed by a stream and growing the buffer otherwise
+static void reserve(Cog_output *out, size_t length) {
+    if(out->count + length <= out->capacity)
+        return;
+    if(out->stream != NULL) {
+        cog_output_flush(out);
+        if(length <= out->capacity)
+            return;
+    }
+    size_t new_capacity = out->capacity * COG_OUTPUT_GROWTH_FACTOR;
+    while(new_capacity < out->count + length)
+        new_capacity *= COG_OUTPUT_GROWTH_FACTOR;
+    out->data = cog_realloc(out->data, out->capacity, new_capacity);
+    out->capacity = new_capacity;
+}
+
+// Public interface
+
+void cog_output_init(Cog_output *out, FILE *stream, size_t capacity) {
+    if(capacity < COG_VALUE_FORMAT_MAX)
+        capacity = COG_OUTPUT_CAPACITY;
+    out->stream = stream;
+    out->count = 0;
+    out->capacity = capacity;
+    out->data = cog_realloc(NULL, 0, capacity);
+}
+
+void cog_output_write(Cog_output *out, const char *text, size_t length) {
+    reserve(out, length);
+    memcpy(out->data + out->count, text, length);
+    out->count += length;
+}
+
+void cog_output_char(Cog_output *out, char ch) {
+    reserve(out, 1);
+    out->data[out->count++] = ch;
+}
+
+void cog_output_value(Cog_output *out, Cog_value value) {
+    // format straight into the buffer
+    reserve(out, cog_value_format_size(value));
+    out->count += cog_value_format(value, out->data + out->count);
+}
+
+bool cog_output_flush(Cog_output *out) {
+    if(out->stream == NULL || out->count == 0)
+        return true;
+    size_t count = out->count;
+    out->count = 0;
+    return fwrite(out->data, 1, count, out->stream) == count
+        && fflush(out->stream) == 0;
+}
+
+void cog_output_free(Cog_output *out) {
+    free(out->data);
+    out->data = NULL;
+    out->capacity = 0;
+    out->count = 0;
+}
@@ -0,0 +1,373 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Each pass rewrites the tree from the leaves up, so every node is seen
+// with its operands already rewritten. Rewrites only ever replace a
+// node by one that computes the same value with the same type, which
+// the types of the nodes above can rely on.
+
+#include <float.h>
+#include <math.h>
+
+#include "common.h"
+#include "intrinsic.h"
+#include "ir.h"
+#include "number.h"
+#include "object.h"
+#include "opcodes.h"
+#include "passes.h"
+#include "value.h"
+
+// Reassociated int constants stay below this, so that where ints
+// overflow the doubles they become still come out the same (see
+// reassociate)
+#define PASSES_REASSOCIATE_MAX 512
+
+typedef Ir_node *(*Rewrite)(Ir *ir, Ir_node *node);
+
+typedef struct {
+    const char *name;
+    int level; // the lowest that runs it
+    Rewrite rewrite;
+} Pass;
+
+// Rewrites the operands of node, then node itself
+static Ir_node *walk(Ir *ir, Ir_node *node, Rewrite rewrite) {
+    bool changed = false;
+    for(unsigned i = 0; i < node->count; ++i) {
+        Ir_node *operand = walk(ir, node->operands[i], rewrite);
+        changed = changed || operand != node->operands[i];
+        node->operands[i] = operand;
+    }
+    if(changed)
+        ir_finish(ir, node);
+    return rewrite(ir, node);
+}
+
+// Helpers
+
+static bool is_constant(const Ir_node *node) {
+    return node->tag == IR_CONSTANT;
+}
+
+static bool is_int_constant(const Ir_node *node, int64_t value) {
+    return is_constant(node) && IS_INT(node->as.value) && TO_INT(node->as.value) == value;
+}
+
+static bool is_double_constant(const Ir_node *node, double value) {
+    return is_constant(node) && IS_NUMBER(node->as.value)
+        && TO_DOUBLE(node->as.value) == value && !signbit(TO_DOUBLE(node->as.value));
+}
+
+static bool is_op(const Ir_node *node, Op_code op) {
+    return node->tag == IR_OP && node->op == op;
+}
+
+// Constant folding
+
+// What op would compute out of numbers, the same way the VM does it
+static Cog_value fold_numbers(Op_code op, Cog_value a, Cog_value b) {
+    switch(op) {
+        case OP_NEG: return cog_number_neg(a);
+        case OP_ADD: return cog_number_add(a, b);
+        case OP_SUB: return cog_number_sub(a, b);
+        case OP_MUL: return cog_number_mul(a, b);
+        case OP_DIV: return cog_number_div(a, b);
+        default: return cog_intrinsic(op, a, b);
+    }
+}
+
+// Whether op on numbers can be worked out ahead of time
+static bool folds_numbers(Op_code op) {
+    switch(op) {
+        case OP_NEG:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            return true;
+        default:
+            return cog_intrinsic_arity(op) > 0;
+    }
+}
+
+// The comparison of two numbers, the same way the VM does it
+static bool compare_numbers(Op_code op, Cog_value a, Cog_value b) {
+    if(op == OP_EQ)
+        return cog_values_equal(a, b);
+    if(IS_INT(a) && IS_INT(b))
+        return op == OP_LT ? TO_INT(a) < TO_INT(b) : TO_INT(a) > TO_INT(b);
+    return op == OP_LT ? AS_DOUBLE(a) < AS_DOUBLE(b) : AS_DOUBLE(a) > AS_DOUBLE(b);
+}
+
+static Ir_node *fold(Ir *ir, Ir_node *node) {
+    if(node->tag == IR_IF && is_constant(node->operands[0]))
+        return node->operands[IS_TRUTHY(node->operands[0]->as.value) ? 1 : 2];
+    if(node->tag != IR_OP)
+        return node;
+    Ir_node **operands = node->operands;
+    for(unsigned i = 0; i < node->count; ++i) {
+        if(!is_constant(operands[i]))
+            return node;
+    }
+    Cog_value a = node->count > 0 ? operands[0]->as.value : COG_NONE;
+    Cog_value b = node->count > 1 ? operands[1]->as.value : COG_INT(0);
+    switch(node->op) {
+        case OP_VECTOR: {
+            for(unsigned i = 0; i < node->count; ++i) {
+                if(!IS_NUMERIC(operands[i]->as.value))
+                    return node;
+            }
+            Cog_vector *vector = cog_vector_new(&ir->box->arena, node->count);
+            for(unsigned i = 0; i < node->count; ++i)
+                vector->elements[i] = AS_DOUBLE(operands[i]->as.value);
+            return ir_constant(ir, COG_VECTOR(vector));
+        }
+        case OP_NOT:
+            if(IS_VECTOR(a))
+                return node;
+            return ir_constant(ir, COG_BOOLEAN(!IS_TRUTHY(a)));
+        case OP_AND:
+            return ir_constant(ir, COG_BOOLEAN(IS_TRUTHY(a) && IS_TRUTHY(b)));
+        case OP_OR:
+            return ir_constant(ir, COG_BOOLEAN(IS_TRUTHY(a) || IS_TRUTHY(b)));
+        case OP_EQ:
+        case OP_LT:
+        case OP_GT:
+            if(!IS_NUMERIC(a) || !IS_NUMERIC(b))
+                return node;
+            return ir_constant(ir, COG_BOOLEAN(compare_numbers(node->op, a, b)));
+        default:
+            if(!folds_numbers(node->op) || !IS_NUMERIC(a)
+                    || (node->count == 2 && !IS_NUMERIC(b)))
+                return node;
+            return ir_constant(ir, fold_numbers(node->op, a, b));
+    }
+}
+
+// Algebraic identities and strength reduction
+//
+// Only where the types of the operands make them exact: x + 0 is not x
+// if x is the double -0, nor x * 1.0 if x is an int
+
+// Whether x / c is always the same as x * (1 / c), which is when 1 / c
+// is exact: c is a power of two whose inverse is a normal double
+static bool has_exact_inverse(Cog_value c) {
+    if(!IS_NUMERIC(c))
+        return false;
+    double d = AS_DOUBLE(c);
+    int exponent;
+    if(!isfinite(d) || d == 0 || fabs(frexp(d, &exponent)) != 0.5)
+        return false;
+    double inverse = 1 / d;
+    return fabs(inverse) >= DBL_MIN && isfinite(inverse);
+}
+
+static Ir_node *simplify(Ir *ir, Ir_node *node) {
+    // let x = value in x
+    if(node->tag == IR_LET && node->operands[1]->tag == IR_LOCAL
+            && node->operands[1]->as.binding == node)
+        return node->operands[0];
+    if(node->tag != IR_OP)
+        return node;
+    Ir_node *x = node->operands[0];
+    Ir_node *y = node->count > 1 ? node->operands[1] : NULL;
+    bool exact = x->type == IR_TYPE_DOUBLE || x->type == IR_TYPE_VECTOR;
+    switch(node->op) {
+        case OP_MUL:
+            if((ir_is_number(x) || x->type == IR_TYPE_VECTOR) && is_int_constant(y, 1))
+                return x;
+            if((ir_is_number(y) || y->type == IR_TYPE_VECTOR) && is_int_constant(x, 1))
+                return y;
+            if(exact && is_double_constant(y, 1))
+                return x;
+            if((y->type == IR_TYPE_DOUBLE || y->type == IR_TYPE_VECTOR)
+                    && is_double_constant(x, 1))
+                return y;
+            break;
+        case OP_ADD:
+            if(x->type == IR_TYPE_INT && is_int_constant(y, 0))
+                return x;
+            if(y->type == IR_TYPE_INT && is_int_constant(x, 0))
+                return y;
+            break;
+        case OP_SUB:
+            if((ir_is_number(x) || x->type == IR_TYPE_VECTOR) && is_int_constant(y, 0))
+                return x;
+            if(exact && is_double_constant(y, 0))
+                return x;
+            break;
+        case OP_DIV:
+            if(exact && (is_int_constant(y, 1) || is_double_constant(y, 1)))
+                return x;
+            // the same errors come up either way
+            if(is_constant(y) && has_exact_inverse(y->as.value))
+                return ir_binary(ir, OP_MUL, x,
+                        ir_constant(ir, COG_NUMBER(1 / AS_DOUBLE(y->as.value))));
+            break;
+        case OP_NOT:
+            if(is_op(x, OP_NOT) && x->operands[0]->type == IR_TYPE_BOOLEAN)
+                return x->operands[0];
+            break;
+        case OP_NEG:
+            if(is_op(x, OP_NEG) && x->operands[0]->type == IR_TYPE_DOUBLE)
+                return x->operands[0];
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+// Reassociation
+//
+// (x + a) + b becomes x + (a + b), with subtractions of constants taken
+// as additions of their opposites, as long as x is an int and a and b
+// are small ints of the same sign. Without an overflow both come out
+// the same; with one, x is close enough to the end of the range of ints
+// that it becomes the same double either way, and a and b are too small
+// to move it, as are they if x was such a double to begin with.
+
+// Without llabs, which the smallest int has no result for
+static bool is_small(int64_t n) {
+    return n > -PASSES_REASSOCIATE_MAX && n < PASSES_REASSOCIATE_MAX;
+}
+
+// The int x + a or x - a adds, setting term to x, if node is one
+static bool adds_constant(const Ir_node *node, Ir_node **term, int64_t *addend) {
+    if(!is_op(node, OP_ADD) && !is_op(node, OP_SUB))
+        return false;
+    Ir_node *x = node->operands[0], *y = node->operands[1];
+    if(node->op == OP_ADD && is_constant(x) && IS_INT(x->as.value)) {
+        Ir_node *swap = x;
+        x = y;
+        y = swap;
+    }
+    if(!is_constant(y) || !IS_INT(y->as.value)
+            || !is_small(TO_INT(y->as.value)))
+        return false;
+    *term = x;
+    *addend = node->op == OP_ADD ? TO_INT(y->as.value) : -TO_INT(y->as.value);
+    return true;
+}
+
+static Ir_node *reassociate(Ir *ir, Ir_node *node) {
+    Ir_node *inner, *x;
+    int64_t a, b;
+    if(!adds_constant(node, &inner, &b) || !adds_constant(inner, &x, &a)
+            || x->type != IR_TYPE_INT || is_constant(x)
+            || (a < 0) != (b < 0) || !is_small(a + b))
+        return node;
+    if(a + b == 0)
+        return x;
+    return ir_binary(ir, OP_ADD, x, ir_constant(ir, COG_INT(a + b)));
+}
+
+// Dead code
+//
+// Values bound by let and never used are dropped, unless working them
+// out could fail, and so are functions that are never called
+
+// Whether working out node can neither fail nor have effects
+static bool is_safe(const Ir_node *node) {
+    for(unsigned i = 0; i < node->count; ++i) {
+        if(!is_safe(node->operands[i]))
+            return false;
+    }
+    const Ir_node *x = node->count > 0 ? node->operands[0] : NULL;
+    const Ir_node *y = node->count > 1 ? node->operands[1] : NULL;
+    switch(node->tag) {
+        case IR_CONSTANT:
+        case IR_LOCAL:
+        case IR_LET:
+        case IR_IF:
+            return true;
+        case IR_OP:
+            break;
+        default:
+            return false;
+    }
+    switch(node->op) {
+        case OP_NOT:
+        case OP_AND:
+        case OP_OR:
+            return true;
+        case OP_EQ:
+            // unless they are vectors of different lengths
+            return x->type != IR_TYPE_ANY && x->type != IR_TYPE_VECTOR
+                && y->type != IR_TYPE_ANY && y->type != IR_TYPE_VECTOR;
+        case OP_SUM:
+        case OP_MEAN:
+        case OP_MIN_OF:
+        case OP_MAX_OF:
+            return x->type == IR_TYPE_VECTOR;
+        default:
+            for(unsigned i = 0; i < node->count; ++i) {
+                if(!ir_is_number(node->operands[i]))
+                    return false;
+            }
+            return true;
+    }
+}
+
+// Counts the uses of every value bound by let and every function
+static void count_uses(Ir_node *node, int delta) {
+    if(node->tag == IR_LOCAL && node->as.binding->tag == IR_LET)
+        node->as.binding->uses += delta;
+    else if(node->tag == IR_CALL)
+        node->as.binding->uses += delta;
+    for(unsigned i = 0; i < node->count; ++i)
+        count_uses(node->operands[i], delta);
+}
+
+static Ir_node *remove_dead(Ir *ir, Ir_node *node) {
+    (void) ir;
+    if(node->tag == IR_LET && node->uses == 0 && is_safe(node->operands[0])) {
+        count_uses(node->operands[0], -1);
+        return node->operands[1];
+    }
+    if(node->tag == IR_FUNCTION && node->uses == 0) {
+        count_uses(node->operands[0], -1);
+        return node->operands[1];
+    }
+    return node;
+}
+
+// Pass manager
+
+static const Pass passes[] = {
+    { "fold", 1, fold },
+    { "simplify", 2, simplify },
+    { "reassociate", 2, reassociate },
+    { "remove-dead", 2, remove_dead },
+};
+
+Ir_node *passes_run(Ir *ir, Ir_node *root, int level) {
+    for(size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); ++i) {
+        if(passes[i].level > level)
+            continue;
+        if(passes[i].rewrite == remove_dead)
+            count_uses(root, 1);
+        root = walk(ir, root, passes[i].rewrite);
+    }
+    return root;
+}
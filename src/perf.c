@@ -0,0 +1,184 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "common.h"
+#include "perf.h"
+
+static const char *counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "branches", "branch_misses", "l1d_misses",
+};
+
+const char *cog_perf_counter_name(Perf_counter counter) {
+    return counter_names[counter];
+}
+
+#ifdef __linux__
+
+static bool counter_config(Perf_counter counter, struct perf_event_attr *attr) {
+    attr->type = PERF_TYPE_HARDWARE;
+    switch(counter) {
+        case PERF_CYCLES: attr->config = PERF_COUNT_HW_CPU_CYCLES; return true;
+        case PERF_INSTRUCTIONS: attr->config = PERF_COUNT_HW_INSTRUCTIONS; return true;
+        case PERF_BRANCHES: attr->config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS; return true;
+        case PERF_BRANCH_MISSES: attr->config = PERF_COUNT_HW_BRANCH_MISSES; return true;
+        case PERF_L1D_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            return true;
+        default: return false;
+    }
+}
+
+static int open_counter(Perf_counter counter, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if(!counter_config(counter, &attr))
+        return -1;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP
+        | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+bool cog_perf_open(Cog_perf *perf) {
+    perf->leader = -1;
+    perf->opened = 0;
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        perf->fds[i] = open_counter((Perf_counter) i, perf->leader);
+        perf->slots[i] = -1;
+        if(perf->fds[i] == -1)
+            continue;
+        if(perf->leader == -1)
+            perf->leader = perf->fds[i];
+        perf->slots[i] = perf->opened++;
+    }
+    if(perf->leader == -1)
+        return false;
+    ioctl(perf->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    // a group the PMU can't fit at once is never scheduled at all
+    Cog_perf_sample sample;
+    if(!cog_perf_read(perf, &sample)) {
+        cog_perf_close(perf);
+        return false;
+    }
+    return true;
+}
+
+bool cog_perf_read(const Cog_perf *perf, Cog_perf_sample *sample) {
+    memset(sample, 0, sizeof(*sample));
+    if(perf->leader == -1)
+        return false;
+    // number of counters, time enabled, time running, then the values
+    uint64_t data[3 + PERF_COUNTER_COUNT];
+    ssize_t size = read(perf->leader, data, sizeof(data));
+    if(size < (ssize_t) (3 * sizeof(uint64_t)) || data[0] != (uint64_t) perf->opened)
+        return false;
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+        if(perf->slots[i] != -1)
+            sample->values[i] = data[3 + perf->slots[i]];
+    return data[2] > 0;
+}
+
+void cog_perf_close(Cog_perf *perf) {
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if(perf->fds[i] != -1)
+            close(perf->fds[i]);
+        perf->fds[i] = -1;
+        perf->slots[i] = -1;
+    }
+    perf->leader = -1;
+    perf->opened = 0;
+}
+
+#else
+
+bool cog_perf_open(Cog_perf *perf) {
+    perf->leader = -1;
+    perf->opened = 0;
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        perf->fds[i] = -1;
+        perf->slots[i] = -1;
+    }
+    return false;
+}
+
+bool cog_perf_read(const Cog_perf *perf, Cog_perf_sample *sample) {
+    (void) perf;
+    memset(sample, 0, sizeof(*sample));
+    return false;
+}
+
+void cog_perf_close(Cog_perf *perf) {
+    (void) perf;
+}
+
+#endif // __linux__
+
+bool cog_perf_has(const Cog_perf *perf, Perf_counter counter) {
+    return perf->fds[counter] != -1;
+}
+
+void cog_perf_accumulate(Cog_perf_sample *total, const Cog_perf_sample *before,
+        const Cog_perf_sample *after) {
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+        total->values[i] += after->values[i] - before->values[i];
+}
+
+void cog_perf_print(const Cog_perf *perf, const Cog_perf_sample *sample,
+        uint64_t runs, FILE *file) {
+    if(runs == 0) runs = 1;
+    const uint64_t *v = sample->values;
+    bool first = true;
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if(!cog_perf_has(perf, (Perf_counter) i))
+            continue;
+        fprintf(file, "%s%s %.0f", first ? "" : ", ", counter_names[i],
+                (double) v[i] / runs);
+        first = false;
+    }
+    if(cog_perf_has(perf, PERF_CYCLES) && cog_perf_has(perf, PERF_INSTRUCTIONS)
+            && v[PERF_CYCLES] > 0)
+        fprintf(file, ", ipc %.2f", (double) v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+    if(cog_perf_has(perf, PERF_BRANCHES) && cog_perf_has(perf, PERF_BRANCH_MISSES)
+            && v[PERF_BRANCHES] > 0)
+        fprintf(file, ", branch miss rate %.2f%%",
+                100.0 * v[PERF_BRANCH_MISSES] / v[PERF_BRANCHES]);
+    fprintf(file, "\n");
+}
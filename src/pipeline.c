@@ -0,0 +1,212 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Workers claim chunks of the input in order, compile and evaluate
+// them into private buffers, and park the results in a reorder window.
+// The calling thread writes the window out in input order, so output
+// overlaps with evaluation. Workers stall when they get a whole window
+// ahead of the writer, which bounds memory use.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "box.h"
+#include "common.h"
+#include "memory.h"
+#include "output.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "vm.h"
+
+typedef struct {
+    Cog_output out;
+    bool ready;
+} Slot;
+
+typedef struct {
+    Batch_file file;
+    size_t next_start; // where the next unclaimed chunk begins
+    size_t claimed;    // chunks handed to workers so far
+    size_t emitted;    // chunks written out so far
+    Slot *slots;
+    size_t window;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t chunk_done;
+    Cog_stats *stats; // merged from the workers after every chunk
+} Pipeline;
+
+static bool exhausted(const Pipeline *pl) {
+    return pl->next_start == pl->file.size;
+}
+
+// Finds the end of the chunk starting at start, just past a newline
+static size_t chunk_end(const Pipeline *pl, size_t start) {
+    if(pl->file.size - start <= PIPELINE_CHUNK_SIZE)
+        return pl->file.size;
+    const char *from = pl->file.data + start + PIPELINE_CHUNK_SIZE;
+    const char *newline = memchr(from, '\n', pl->file.data + pl->file.size - from);
+    if(newline == NULL)
+        return pl->file.size;
+    return newline - pl->file.data + 1;
+}
+
+static void *worker(void *arg) {
+    Pipeline *pl = arg;
+    Cog_env env;
+    cog_env_init(&env);
+    Box box;
+    box_init(&box);
+    Cog_stats *stats = NULL;
+    if(pl->stats != NULL) {
+        stats = cog_realloc(NULL, 0, sizeof(Cog_stats));
+        cog_stats_init(stats);
+        // counters only ever count the thread that opened them
+        if(pl->stats->perf != NULL)
+            cog_stats_count_events(stats);
+    }
+
+    pthread_mutex_lock(&pl->lock);
+    while(true) {
+        while(!exhausted(pl) && pl->claimed >= pl->emitted + pl->window)
+            pthread_cond_wait(&pl->slot_free, &pl->lock);
+        if(exhausted(pl))
+            break;
+        size_t start = pl->next_start;
+        size_t end = chunk_end(pl, start);
+        Slot *slot = &pl->slots[pl->claimed++ % pl->window];
+        pl->next_start = end;
+        pthread_mutex_unlock(&pl->lock);
+
+        batch_eval_lines(&env, &box, pl->file.data + start, end - start,
+                &slot->out, stats);
+
+        pthread_mutex_lock(&pl->lock);
+        if(stats != NULL) {
+            cog_stats_merge(pl->stats, stats);
+            cog_stats_reset(stats);
+        }
+        slot->ready = true;
+        pthread_cond_signal(&pl->chunk_done);
+    }
+    pthread_mutex_unlock(&pl->lock);
+
+    if(stats != NULL) {
+        cog_stats_free(stats);
+        free(stats);
+    }
+    box_free(&box);
+    cog_env_free(&env);
+    return NULL;
+}
+
+// Writes finished chunks in order until everything has been written
+static void writer(Pipeline *pl, Cog_output *out) {
+    pthread_mutex_lock(&pl->lock);
+    while(true) {
+        Slot *slot = &pl->slots[pl->emitted % pl->window];
+        while(!slot->ready && !(exhausted(pl) && pl->emitted == pl->claimed))
+            pthread_cond_wait(&pl->chunk_done, &pl->lock);
+        if(!slot->ready)
+            break;
+        pthread_mutex_unlock(&pl->lock);
+
+        cog_output_write(out, slot->out.data, slot->out.count);
+        slot->out.count = 0;
+
+        pthread_mutex_lock(&pl->lock);
+        if(pl->stats != NULL && cog_stats_dump_requested())
+            cog_stats_write_json(pl->stats, stderr);
+        slot->ready = false;
+        ++pl->emitted;
+        pthread_cond_broadcast(&pl->slot_free);
+    }
+    pthread_mutex_unlock(&pl->lock);
+}
+
+// Public interface
+
+bool pipeline_run(const char *path, int jobs, Cog_output *out, Cog_stats *stats) {
+    if(jobs <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cores > 0 ? (int) cores : 1;
+    }
+
+    Pipeline pl;
+    if(!batch_file_open(&pl.file, path))
+        return false;
+    // input that can't be mapped can't be cut into chunks up front
+    if(pl.file.fd >= 0) {
+        bool alright = batch_run_file(&pl.file, out, stats);
+        batch_file_close(&pl.file);
+        return alright;
+    }
+    pl.stats = stats;
+    pl.next_start = 0;
+    pl.claimed = pl.emitted = 0;
+    pl.window = (size_t) jobs * PIPELINE_WINDOW_PER_JOB;
+    pl.slots = cog_realloc(NULL, 0, pl.window * sizeof(Slot));
+    for(size_t i = 0; i < pl.window; ++i) {
+        cog_output_init(&pl.slots[i].out, NULL, COG_OUTPUT_CAPACITY);
+        pl.slots[i].ready = false;
+    }
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.slot_free, NULL);
+    pthread_cond_init(&pl.chunk_done, NULL);
+
+    pthread_t *threads = cog_realloc(NULL, 0, jobs * sizeof(pthread_t));
+    int started = 0;
+    for(; started < jobs; ++started) {
+        if(pthread_create(&threads[started], NULL, worker, &pl) != 0)
+            break;
+    }
+    if(started > 0) {
+        writer(&pl, out);
+    } else {
+        // no threads to be had; evaluate everything right here
+        Cog_env env;
+        cog_env_init(&env);
+        Box box;
+        box_init(&box);
+        batch_eval_lines(&env, &box, pl.file.data, pl.file.size, out, stats);
+        box_free(&box);
+        cog_env_free(&env);
+    }
+    for(int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    pthread_cond_destroy(&pl.chunk_done);
+    pthread_cond_destroy(&pl.slot_free);
+    pthread_mutex_destroy(&pl.lock);
+    for(size_t i = 0; i < pl.window; ++i)
+        cog_output_free(&pl.slots[i].out);
+    free(pl.slots);
+    batch_file_close(&pl.file);
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "box.h"
+#include "common.h"
+#include "memory.h"
+#include "profile.h"
+
+void cog_profile_init(Cog_profile *prof) {
+    prof->box = NULL;
+    prof->counts = NULL;
+    prof->cycles = NULL;
+    prof->size = 0;
+    memset(prof->op_counts, 0, sizeof(prof->op_counts));
+    memset(prof->op_cycles, 0, sizeof(prof->op_cycles));
+}
+
+void cog_profile_attach(Cog_profile *prof, const Box *box) {
+    if(box->count > prof->size) {
+        prof->counts = cog_realloc(prof->counts, prof->size * sizeof(uint64_t),
+                box->count * sizeof(uint64_t));
+        prof->cycles = cog_realloc(prof->cycles, prof->size * sizeof(uint64_t),
+                box->count * sizeof(uint64_t));
+        prof->size = box->count;
+    }
+    if(box->count > 0) {
+        memset(prof->counts, 0, box->count * sizeof(uint64_t));
+        memset(prof->cycles, 0, box->count * sizeof(uint64_t));
+    }
+    prof->box = box;
+}
+
+void cog_profile_free(Cog_profile *prof) {
+    free(prof->counts);
+    free(prof->cycles);
+    cog_profile_init(prof);
+}
+
+uint64_t cog_profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
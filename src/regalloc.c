@@ -0,0 +1,476 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "box.h"
+#include "common.h"
+#include "ir.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "regalloc.h"
+#include "regbox.h"
+#include "value.h"
+
+// Code is first made with as many virtual registers as there are
+// values, counted from 0 up, which then get the registers of the window.
+// Operands below 0 are constants instead.
+#define CONSTANT(index) (-1 - (index))
+#define IS_CONSTANT(operand) ((operand) < 0)
+
+// Operands of an OP_VECTOR that follow it, two to an instruction
+#define OPERANDS_ONLY 0xFF
+
+// Intervals that don't get a register get a spill slot instead
+#define SPILLED (-1)
+
+typedef struct {
+    uint8_t op;
+    bool has_wide;
+    int def;          // register written, or -1
+    int uses[2];      // operands read, in the order they are encoded
+    unsigned use_count;
+    unsigned wide;
+} Virtual;
+
+// Where the value of a virtual register is alive: from the first
+// instruction that writes it to the last one that reads it
+typedef struct {
+    unsigned start;
+    unsigned end;
+    int reg;          // or SPILLED
+    unsigned slot;    // if spilled
+} Interval;
+
+typedef struct {
+    Box *box;
+    Reg_box *rbox;
+    Virtual *code;
+    unsigned count;
+    unsigned capacity;
+    Interval *intervals; // of each virtual register
+    int reg_count;
+    int reg_capacity;
+    // constants the code uses over and over, once written
+    int true_index, false_index, none_index;
+    bool failed;
+} Regalloc;
+
+static void fail(Regalloc *ra, const char *message) {
+    if(!ra->failed)
+        eprintf("(!) %s\n", message);
+    ra->failed = true;
+}
+
+static int new_register(Regalloc *ra) {
+    if(ra->reg_count + 1 > ra->reg_capacity) {
+        int new_capacity = ra->reg_capacity == 0 ? 16
+            : ra->reg_capacity * BOX_CODE_GROWTH_FACTOR;
+        ra->intervals = cog_realloc(ra->intervals, ra->reg_capacity * sizeof(Interval),
+                new_capacity * sizeof(Interval));
+        ra->reg_capacity = new_capacity;
+    }
+    ra->intervals[ra->reg_count] = (Interval) { UINT_MAX, 0, SPILLED, 0 };
+    return ra->reg_count++;
+}
+
+static void mark_use(Regalloc *ra, int operand, unsigned at) {
+    if(!IS_CONSTANT(operand) && ra->intervals[operand].end < at)
+        ra->intervals[operand].end = at;
+}
+
+// Appends instr, whose reads count as made at instruction at
+static unsigned emit_at(Regalloc *ra, Virtual instr, unsigned at) {
+    if(ra->count + 1 > ra->capacity) {
+        unsigned new_capacity = ra->capacity == 0 ? 16
+            : ra->capacity * BOX_CODE_GROWTH_FACTOR;
+        ra->code = cog_realloc(ra->code, ra->capacity * sizeof(Virtual),
+                new_capacity * sizeof(Virtual));
+        ra->capacity = new_capacity;
+    }
+    for(unsigned i = 0; i < instr.use_count; ++i)
+        mark_use(ra, instr.uses[i], at);
+    if(instr.def >= 0 && ra->intervals[instr.def].start > ra->count)
+        ra->intervals[instr.def].start = ra->count;
+    ra->code[ra->count] = instr;
+    return ra->count++;
+}
+
+static unsigned emit(Regalloc *ra, Virtual instr) {
+    return emit_at(ra, instr, ra->count);
+}
+
+static Virtual instruction(uint8_t op, int def) {
+    Virtual instr = { op, false, def, { 0 }, 0, 0 };
+    return instr;
+}
+
+static Virtual wide_instruction(uint8_t op, int def, unsigned wide) {
+    Virtual instr = instruction(op, def);
+    instr.has_wide = true;
+    instr.wide = wide;
+    return instr;
+}
+
+static void add_use(Virtual *instr, int operand) {
+    instr->uses[instr->use_count++] = operand;
+}
+
+// Makes the jump at index land on the next instruction
+static void patch_jump(Regalloc *ra, unsigned index) {
+    unsigned offset = ra->count - (index + 1);
+    if(offset > UINT16_MAX) {
+        fail(ra, "Branch too long to jump over");
+        return;
+    }
+    ra->code[index].wide = offset;
+}
+
+// The register to put a value in: target, if there is one
+static int destination(Regalloc *ra, int target) {
+    return target >= 0 ? target : new_register(ra);
+}
+
+// Puts operand in target, if there is one, returning where it ends up
+static int move_into(Regalloc *ra, int operand, int target) {
+    if(target < 0 || operand == target)
+        return operand;
+    Virtual move = instruction(REG_OP_MOVE, target);
+    add_use(&move, operand);
+    emit(ra, move);
+    return target;
+}
+
+static int write_constant(Regalloc *ra, Cog_value value) {
+    int *cached = IS_NONE(value) ? &ra->none_index
+        : !IS_BOOLEAN(value) ? NULL
+        : TO_BOOL(value) ? &ra->true_index : &ra->false_index;
+    if(cached != NULL && *cached >= 0)
+        return *cached;
+    int index = box_value_write(ra->box, value);
+    if(cached != NULL)
+        *cached = index;
+    return index;
+}
+
+// Constants past those the operands reach are loaded into a register
+static int lower_constant(Regalloc *ra, Cog_value value, int target) {
+    int index = write_constant(ra, value);
+    if(index < REG_OPERANDS - REG_WINDOW)
+        return move_into(ra, CONSTANT(index), target);
+    if(index > UINT16_MAX) {
+        fail(ra, "Too many constants in one expression");
+        return CONSTANT(0);
+    }
+    int reg = destination(ra, target);
+    emit(ra, wide_instruction(REG_OP_LOAD, reg, index));
+    return reg;
+}
+
+static int write_site(Regalloc *ra, const Cog_symbol *name) {
+    int site = box_site_write(ra->box, name);
+    if(site >= BOX_MAX_SITES) {
+        fail(ra, "Too many variables in one expression");
+        return 0;
+    }
+    return site;
+}
+
+static int lower(Regalloc *ra, Ir_node *node, int target);
+
+static int lower_vector(Regalloc *ra, Ir_node *node, int target) {
+    int *elements = cog_realloc(NULL, 0, (node->count + 1) * sizeof(int));
+    for(unsigned i = 0; i < node->count; ++i)
+        elements[i] = lower(ra, node->operands[i], -1);
+    int reg = destination(ra, target);
+    // the elements are all read by the vector itself
+    unsigned at = emit(ra, wide_instruction(OP_VECTOR, reg, node->count));
+    for(unsigned i = 0; i < node->count; i += 2) {
+        Virtual operands = instruction(OPERANDS_ONLY, -1);
+        for(unsigned j = i; j < node->count && j < i + 2; ++j)
+            add_use(&operands, elements[j]);
+        emit_at(ra, operands, at);
+    }
+    free(elements);
+    return reg;
+}
+
+// Returns the operand that holds the value of node, which is target if
+// one is given
+static int lower(Regalloc *ra, Ir_node *node, int target) {
+    switch(node->tag) {
+        case IR_CONSTANT:
+            return lower_constant(ra, node->as.value, target);
+
+        case IR_OP: {
+            if(node->op == OP_VECTOR)
+                return lower_vector(ra, node, target);
+            Virtual instr = instruction(node->op, -1);
+            for(unsigned i = 0; i < node->count; ++i)
+                add_use(&instr, lower(ra, node->operands[i], -1));
+            instr.def = destination(ra, target);
+            emit(ra, instr);
+            return instr.def;
+        }
+
+        // Values are never changed once made, so the local is the
+        // operand of its value itself
+        case IR_LOCAL:
+            if(node->as.binding->tag != IR_LET) {
+                fail(ra, "Functions only run on the stack machine");
+                return CONSTANT(0);
+            }
+            return move_into(ra, node->as.binding->slot, target);
+
+        case IR_GET_GLOBAL: {
+            int site = write_site(ra, node->as.name);
+            int reg = destination(ra, target);
+            emit(ra, wide_instruction(OP_GET_GLOBAL, reg, site));
+            return reg;
+        }
+
+        case IR_SET_GLOBAL: {
+            int value = lower(ra, node->operands[0], target);
+            Virtual instr = wide_instruction(OP_SET_GLOBAL, -1,
+                    write_site(ra, node->as.name));
+            add_use(&instr, value);
+            emit(ra, instr);
+            return value;
+        }
+
+        case IR_LET:
+            node->slot = lower(ra, node->operands[0], -1);
+            return lower(ra, node->operands[1], target);
+
+        // Both branches leave their value in the same register
+        case IR_IF: {
+            Virtual jump = wide_instruction(OP_JMP_FALSE, -1, 0);
+            add_use(&jump, lower(ra, node->operands[0], -1));
+            unsigned to_else = emit(ra, jump);
+            int reg = destination(ra, target);
+            lower(ra, node->operands[1], reg);
+            unsigned to_end = emit(ra, wide_instruction(OP_JMP, -1, 0));
+            patch_jump(ra, to_else);
+            lower(ra, node->operands[2], reg);
+            patch_jump(ra, to_end);
+            return reg;
+        }
+
+        case IR_FUNCTION:
+        case IR_CALL:
+            fail(ra, "Functions only run on the stack machine");
+            return CONSTANT(0);
+    }
+    return CONSTANT(0);
+}
+
+// Allocation
+
+static int by_start(const void *a, const void *b) {
+    const Interval *x = *(const Interval *const *) a;
+    const Interval *y = *(const Interval *const *) b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static void spill(Regalloc *ra, Interval *interval) {
+    interval->reg = SPILLED;
+    interval->slot = ra->rbox->spills++;
+    if(ra->rbox->spills > REG_MAX_SPILLS)
+        fail(ra, "Too many values in one expression");
+}
+
+// Takes the intervals in the order they start, giving each the lowest
+// free register. A holder is done with its register at the instruction
+// that reads it for the last time, which may well write the new value
+// there, as instructions read all of their operands before writing.
+// When all registers are taken, whichever of the intervals holding one
+// and the new one goes on for longest spends all of its life in a
+// spill slot instead.
+static void allocate(Regalloc *ra) {
+    Interval **order = cog_realloc(NULL, 0, (ra->reg_count + 1) * sizeof(Interval*));
+    for(int i = 0; i < ra->reg_count; ++i) {
+        Interval *interval = &ra->intervals[i];
+        // values that are never read still need somewhere to go
+        if(interval->end < interval->start)
+            interval->end = interval->start;
+        order[i] = interval;
+    }
+    qsort(order, ra->reg_count, sizeof(Interval*), by_start);
+
+    // the intervals holding each register, if any
+    Interval *holders[REG_WINDOW - REG_SCRATCH] = { NULL };
+    for(int i = 0; i < ra->reg_count; ++i) {
+        Interval *interval = order[i];
+        int free_reg = -1, longest = -1;
+        for(int r = 0; r < REG_WINDOW - REG_SCRATCH; ++r) {
+            if(holders[r] != NULL && holders[r]->end <= interval->start)
+                holders[r] = NULL;
+            if(holders[r] == NULL) {
+                if(free_reg < 0) free_reg = r;
+            } else if(longest < 0 || holders[r]->end > holders[longest]->end) {
+                longest = r;
+            }
+        }
+        if(free_reg < 0 && holders[longest]->end > interval->end) {
+            spill(ra, holders[longest]);
+            free_reg = longest;
+        }
+        if(free_reg < 0) {
+            spill(ra, interval);
+            continue;
+        }
+        holders[free_reg] = interval;
+        interval->reg = free_reg;
+        if((unsigned) free_reg + 1 > ra->rbox->registers)
+            ra->rbox->registers = free_reg + 1;
+    }
+    free(order);
+}
+
+// Encoding
+
+static bool is_spilled(const Regalloc *ra, int operand) {
+    return !IS_CONSTANT(operand) && ra->intervals[operand].reg == SPILLED;
+}
+
+static uint8_t encode_operand(const Regalloc *ra, int operand) {
+    if(IS_CONSTANT(operand))
+        return (uint8_t) (REG_WINDOW + CONSTANT(operand));
+    return (uint8_t) ra->intervals[operand].reg;
+}
+
+// Operands of vectors reach the spill slots as well
+static unsigned encode_wide_operand(const Regalloc *ra, int operand) {
+    if(is_spilled(ra, operand))
+        return REG_OPERANDS + ra->intervals[operand].slot;
+    return encode_operand(ra, operand);
+}
+
+static Reg_instr wide(uint8_t op, uint8_t a, unsigned wide) {
+    Reg_instr out = { .bytes = { op, a, (uint8_t) (wide & 0xFF),
+        (uint8_t) ((wide >> 8) & 0xFF) } };
+    return out;
+}
+
+static bool is_jump(uint8_t op) {
+    return op == OP_JMP || op == OP_JMP_FALSE;
+}
+
+// Writes the code out for the registers it got. Operands in spill slots
+// are reloaded into the scratch registers just before they are read,
+// and values for them are written to the first of those, then spilled.
+// That moves instructions around, so jumps are pointed at the new place
+// of their target once it is known.
+static void encode(Regalloc *ra) {
+    Reg_box *rbox = ra->rbox;
+    unsigned *starts = cog_realloc(NULL, 0, (ra->count + 1) * sizeof(unsigned));
+    int pending_spill = -1;      // of a vector, once its operands are out
+    unsigned operands_left = 0;
+    for(unsigned i = 0; i < ra->count; ++i) {
+        const Virtual *instr = &ra->code[i];
+        starts[i] = rbox->count;
+        if(instr->op == OPERANDS_ONLY) {
+            Reg_instr out = { .bytes = { 0, 0, 0, 0 } };
+            for(unsigned j = 0; j < instr->use_count; ++j) {
+                unsigned operand = encode_wide_operand(ra, instr->uses[j]);
+                out.bytes[2 * j] = (uint8_t) (operand & 0xFF);
+                out.bytes[2 * j + 1] = (uint8_t) ((operand >> 8) & 0xFF);
+            }
+            reg_box_write(rbox, out);
+            if(--operands_left == 0 && pending_spill >= 0) {
+                reg_box_write(rbox, wide(REG_OP_SPILL, REG_WINDOW - REG_SCRATCH,
+                            ra->intervals[pending_spill].slot));
+                pending_spill = -1;
+            }
+            continue;
+        }
+        // what is written comes first, then what is read
+        uint8_t fields[3] = { 0, 0, 0 };
+        unsigned count = 0;
+        if(instr->def >= 0) {
+            fields[count++] = is_spilled(ra, instr->def)
+                ? REG_WINDOW - REG_SCRATCH : encode_operand(ra, instr->def);
+        }
+        for(unsigned j = 0; j < instr->use_count; ++j) {
+            int use = instr->uses[j];
+            if(is_spilled(ra, use)) {
+                uint8_t scratch = REG_WINDOW - REG_SCRATCH + j;
+                reg_box_write(rbox, wide(REG_OP_RELOAD, scratch, ra->intervals[use].slot));
+                fields[count++] = scratch;
+            } else {
+                fields[count++] = encode_operand(ra, use);
+            }
+        }
+        Reg_instr out = { .bytes = { instr->op, fields[0], fields[1], fields[2] } };
+        if(instr->has_wide)
+            out = wide(instr->op, fields[0], instr->wide);
+        reg_box_write(rbox, out);
+        if(instr->def >= 0 && is_spilled(ra, instr->def)) {
+            if(instr->op == OP_VECTOR && instr->wide > 0) {
+                pending_spill = instr->def;
+                operands_left = (instr->wide + 1) / 2;
+            } else {
+                reg_box_write(rbox, wide(REG_OP_SPILL, REG_WINDOW - REG_SCRATCH,
+                            ra->intervals[instr->def].slot));
+            }
+        } else if(instr->op == OP_VECTOR) {
+            operands_left = (instr->wide + 1) / 2;
+        }
+    }
+    starts[ra->count] = rbox->count;
+    if(rbox->spills > 0)
+        rbox->registers = REG_WINDOW;
+
+    // jumps have nothing to spill after them, so they are the last of
+    // their instructions
+    for(unsigned i = 0; i < ra->count; ++i) {
+        const Virtual *instr = &ra->code[i];
+        if(!is_jump(instr->op))
+            continue;
+        unsigned at = starts[i + 1] - 1;
+        unsigned offset = starts[i + 1 + instr->wide] - starts[i + 1];
+        if(offset > UINT16_MAX) {
+            fail(ra, "Branch too long to jump over");
+            break;
+        }
+        rbox->code[at] = wide(instr->op, rbox->code[at].a, offset);
+    }
+    free(starts);
+}
+
+// Public interface
+
+bool reg_lower(Ir *ir, Ir_node *root, Reg_box *rbox) {
+    Regalloc ra = { ir->box, rbox, NULL, 0, 0, NULL, 0, 0, -1, -1, -1, false };
+    Virtual ret = instruction(OP_RET, -1);
+    add_use(&ret, lower(&ra, root, -1));
+    emit(&ra, ret);
+    if(!ra.failed)
+        allocate(&ra);
+    if(!ra.failed)
+        encode(&ra);
+    free(ra.code);
+    free(ra.intervals);
+    return !ra.failed;
+}
@@ -0,0 +1,64 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+
+#include "box.h"
+#include "common.h"
+#include "memory.h"
+#include "regbox.h"
+
+void reg_box_init(Reg_box *rbox) {
+    box_init(&rbox->box);
+    rbox->code = NULL;
+    rbox->count = 0;
+    rbox->capacity = 0;
+    rbox->registers = 0;
+    rbox->spills = 0;
+}
+
+void reg_box_reset(Reg_box *rbox) {
+    box_reset(&rbox->box);
+    rbox->count = 0;
+    rbox->registers = 0;
+    rbox->spills = 0;
+}
+
+unsigned reg_box_write(Reg_box *rbox, Reg_instr instr) {
+    if(rbox->count + 1 > rbox->capacity) {
+        unsigned new_capacity = rbox->capacity == 0 ? BOX_CODE_INITIAL_CAPACITY
+            : rbox->capacity * BOX_CODE_GROWTH_FACTOR;
+        rbox->code = cog_realloc(rbox->code, rbox->capacity * sizeof(Reg_instr),
+                new_capacity * sizeof(Reg_instr));
+        rbox->capacity = new_capacity;
+    }
+    rbox->code[rbox->count] = instr;
+    return rbox->count++;
+}
+
+void reg_box_free(Reg_box *rbox) {
+    box_free(&rbox->box);
+    free(rbox->code);
+    rbox->code = NULL;
+    rbox->count = 0;
+    rbox->capacity = 0;
+}
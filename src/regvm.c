@@ -0,0 +1,296 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "array.h"
+#include "box.h"
+#include "common.h"
+#include "globals.h"
+#include "intrinsic.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "opcodes.h"
+#include "regbox.h"
+#include "regvm.h"
+#include "value.h"
+#include "vector.h"
+#include "vm.h"
+
+// Types of operations, as in vm.c, from operands b and c into a
+
+#define less(a, b) ((a) < (b))
+#define greater(a, b) ((a) > (b))
+
+#define B (file[in.b])
+#define C (file[in.c])
+#define A (file[in.a])
+
+// Numbers first, then vectors
+#define BIN_NUMERIC_OP(op, vector_op) {                                \
+    if(IS_NUMERIC(B) && IS_NUMERIC(C))                                 \
+        A = op(B, C);                                                  \
+    else if(!cog_vector_op(&env->arena, vector_op, B, C, &A))          \
+        return RES_ERROR;                                              \
+}
+
+// Numbers first, then strings, in order, then vectors, into masks
+#define COMPARE_OP(op, vector_op) {                                    \
+    if(IS_INT(B) && IS_INT(C))                                         \
+        A = COG_BOOLEAN(op(TO_INT(B), TO_INT(C)));                     \
+    else if(IS_NUMERIC(B) && IS_NUMERIC(C))                            \
+        A = COG_BOOLEAN(op(AS_DOUBLE(B), AS_DOUBLE(C)));               \
+    else if(IS_STRING(B) && IS_STRING(C))                              \
+        A = COG_BOOLEAN(op(cog_strings_compare(B, C), 0));             \
+    else if(!cog_vector_op(&env->arena, vector_op, B, C, &A))          \
+        return RES_ERROR;                                              \
+}
+
+#define UNARY_MATH_OP(op) {                                 \
+    if(!IS_NUMERIC(B))                                      \
+        return RES_ERROR;                                   \
+    A = cog_intrinsic(op, B, COG_INT(0));                   \
+}
+
+#define BINARY_MATH_OP(op) {                                \
+    if(!IS_NUMERIC(B) || !IS_NUMERIC(C))                    \
+        return RES_ERROR;                                   \
+    A = cog_intrinsic(op, B, C);                            \
+}
+
+#define REDUCE_OP(reduce) {                            \
+    if(!IS_VECTOR(B))                                  \
+        return RES_ERROR;                              \
+    A = COG_NUMBER(reduce(TO_VECTOR(B)));              \
+}
+
+#define and(p, q) ((p) && (q))
+#define or(p, q) ((p) || (q))
+
+#define BIN_LOGIC_OP(op) {                   \
+    bool p = IS_TRUTHY(B), q = IS_TRUTHY(C); \
+    A = COG_BOOLEAN(op(p, q));               \
+}
+
+// The slot of the global at the wide site of in
+static inline uint32_t global_slot(Cog_env *env, const Box *box, Reg_instr in) {
+    Box_site *site = &box->sites[REG_WIDE(in)];
+    if(site->table != env->globals->id) {
+        site->slot = cog_globals_slot(env->globals, site->name);
+        site->table = env->globals->id;
+    }
+    return site->slot;
+}
+
+Cog_result reg_execute(Cog_env *env, const Reg_box *rbox) {
+    const Box *box = &rbox->box;
+    env->ip = NULL;
+    env->box = NULL;
+    cog_env_clear(env);
+
+    // The registers, followed by the constants the operands reach
+    Cog_value file[REG_OPERANDS];
+    int constants = box->constants.count;
+    if(constants > REG_OPERANDS - REG_WINDOW)
+        constants = REG_OPERANDS - REG_WINDOW;
+    memcpy(&file[REG_WINDOW], box->constants.data, constants * sizeof(Cog_value));
+    // and the spill slots, which take the place of the stack
+    while((unsigned) env->stack.count < rbox->spills)
+        cog_array_push(&env->stack, COG_NONE);
+    Cog_value *spilled = env->stack.data;
+
+    const Reg_instr *ip = rbox->code;
+    for(;;) {
+        Reg_instr in = *ip++;
+        switch(in.op) {
+            case OP_NEG:
+                if(!IS_NUMERIC(B)) return RES_ERROR;
+                A = cog_number_neg(B);
+                break;
+            case OP_ADD:
+                if(IS_NUMERIC(B) && IS_NUMERIC(C))
+                    A = cog_number_add(B, C);
+                else if(IS_STRING(B) && IS_STRING(C))
+                    A = cog_string_concat(&env->arena, B, C);
+                else if(!cog_vector_op(&env->arena, VECTOR_ADD, B, C, &A))
+                    return RES_ERROR;
+                break;
+            case OP_SUB:
+                BIN_NUMERIC_OP(cog_number_sub, VECTOR_SUB);
+                break;
+            case OP_MUL:
+                BIN_NUMERIC_OP(cog_number_mul, VECTOR_MUL);
+                break;
+            case OP_DIV:
+                BIN_NUMERIC_OP(cog_number_div, VECTOR_DIV);
+                break;
+
+            case OP_SQRT:
+                UNARY_MATH_OP(OP_SQRT);
+                break;
+            case OP_ABS:
+                UNARY_MATH_OP(OP_ABS);
+                break;
+            case OP_FLOOR:
+                UNARY_MATH_OP(OP_FLOOR);
+                break;
+            case OP_EXP:
+                UNARY_MATH_OP(OP_EXP);
+                break;
+            case OP_LOG:
+                UNARY_MATH_OP(OP_LOG);
+                break;
+            case OP_MIN:
+                BINARY_MATH_OP(OP_MIN);
+                break;
+            case OP_MAX:
+                BINARY_MATH_OP(OP_MAX);
+                break;
+            case OP_POW:
+                BINARY_MATH_OP(OP_POW);
+                break;
+
+            case OP_VECTOR: {
+                unsigned length = REG_WIDE(in);
+                Cog_vector *vector = cog_vector_new(&env->arena, length);
+                const uint8_t *operands = (const uint8_t*) ip;
+                for(unsigned i = 0; i < length; ++i) {
+                    unsigned operand = operands[2 * i] | (operands[2 * i + 1] << 8);
+                    Cog_value element = operand < REG_OPERANDS ? file[operand]
+                        : spilled[operand - REG_OPERANDS];
+                    if(!IS_NUMERIC(element))
+                        return RES_ERROR;
+                    vector->elements[i] = AS_DOUBLE(element);
+                }
+                ip += (length + 1) / 2;
+                A = COG_VECTOR(vector);
+                break;
+            }
+            case OP_SUM:
+                REDUCE_OP(cog_vector_sum);
+                break;
+            case OP_MEAN:
+                REDUCE_OP(cog_vector_mean);
+                break;
+            case OP_MIN_OF:
+                REDUCE_OP(cog_vector_min);
+                break;
+            case OP_MAX_OF:
+                REDUCE_OP(cog_vector_max);
+                break;
+
+            case OP_NOT:
+                if(IS_VECTOR(B))
+                    A = cog_vector_not(&env->arena, B);
+                else
+                    A = COG_BOOLEAN(!IS_TRUTHY(B));
+                break;
+            case OP_EQ: {
+                Cog_value b = B, c = C;
+                bool p;
+                if(IS_INT(b) && IS_INT(c))
+                    p = TO_INT(b) == TO_INT(c);
+                else if(IS_SYMBOL(b) && IS_SYMBOL(c))
+                    p = TO_SYMBOL(b) == TO_SYMBOL(c);
+                else if(b.type == TYPE_SHORT_STRING && c.type == TYPE_SHORT_STRING)
+                    p = cog_short_strings_equal(b, c);
+                else if((IS_VECTOR(b) || IS_VECTOR(c))
+                        && cog_vector_op(&env->arena, VECTOR_EQ, b, c, &A))
+                    break;
+                else
+                    p = cog_values_equal(b, c);
+                A = COG_BOOLEAN(p);
+                break;
+            }
+            case OP_LT:
+                COMPARE_OP(less, VECTOR_LT);
+                break;
+            case OP_GT:
+                COMPARE_OP(greater, VECTOR_GT);
+                break;
+            case OP_AND:
+                BIN_LOGIC_OP(and);
+                break;
+            case OP_OR:
+                BIN_LOGIC_OP(or);
+                break;
+
+            case OP_GET_GLOBAL: {
+                uint32_t slot = global_slot(env, box, in);
+                if(!cog_globals_defined(env->globals, slot))
+                    return RES_ERROR;
+                A = cog_globals_get(env->globals, slot);
+                break;
+            }
+            case OP_SET_GLOBAL:
+                cog_env_set_global(env, global_slot(env, box, in), A);
+                break;
+
+            case OP_JMP:
+                ip += REG_WIDE(in);
+                break;
+            case OP_JMP_FALSE:
+                if(!IS_TRUTHY(A))
+                    ip += REG_WIDE(in);
+                break;
+            case OP_RET:
+                env->ret = A;
+                return RES_OK;
+
+            case REG_OP_MOVE:
+                A = B;
+                break;
+            case REG_OP_LOAD:
+                A = cog_array_get(&box->constants, REG_WIDE(in));
+                break;
+            case REG_OP_SPILL:
+                spilled[REG_WIDE(in)] = A;
+                break;
+            case REG_OP_RELOAD:
+                A = spilled[REG_WIDE(in)];
+                break;
+
+            default:
+                eprintf("Unimplemented operation\n");
+                return RES_ERROR;
+        }
+    }
+}
+
+// Cleaning up local macros
+
+#undef less
+#undef greater
+#undef and
+#undef or
+#undef A
+#undef B
+#undef C
+
+#undef BIN_NUMERIC_OP
+#undef BIN_LOGIC_OP
+#undef COMPARE_OP
+#undef UNARY_MATH_OP
+#undef BINARY_MATH_OP
+#undef REDUCE_OP
@@ -0,0 +1,91 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "memory.h"
+#include "sched.h"
+#include "vm.h"
+
+#define SCHED_INITIAL_CAPACITY 16
+
+void sched_init(Scheduler *sched) {
+    sched->tasks = NULL;
+    sched->head = 0;
+    sched->count = 0;
+    sched->capacity = 0;
+}
+
+static Sched_task *task_at(Scheduler *sched, unsigned i) {
+    return &sched->tasks[(sched->head + i) % sched->capacity];
+}
+
+static void push_back(Scheduler *sched, Sched_task task) {
+    if(sched->count == sched->capacity) {
+        // unroll the ring into a bigger one
+        unsigned new_capacity = sched->capacity == 0 ? SCHED_INITIAL_CAPACITY
+            : sched->capacity * 2;
+        Sched_task *tasks = cog_realloc(NULL, 0, new_capacity * sizeof(Sched_task));
+        for(unsigned i = 0; i < sched->count; ++i)
+            tasks[i] = *task_at(sched, i);
+        free(sched->tasks);
+        sched->tasks = tasks;
+        sched->head = 0;
+        sched->capacity = new_capacity;
+    }
+    *task_at(sched, sched->count++) = task;
+}
+
+void sched_add(Scheduler *sched, Cog_env *env, void *data) {
+    push_back(sched, (Sched_task) { env, data, RES_SUSPENDED });
+}
+
+void sched_remove(Scheduler *sched, Cog_env *env) {
+    unsigned kept = 0;
+    for(unsigned i = 0; i < sched->count; ++i) {
+        Sched_task task = *task_at(sched, i);
+        if(task.env != env)
+            *task_at(sched, kept++) = task;
+    }
+    sched->count = kept;
+}
+
+bool sched_step(Scheduler *sched, Sched_task *done) {
+    if(sched->count == 0)
+        return false;
+    Sched_task task = *task_at(sched, 0);
+    sched->head = (sched->head + 1) % sched->capacity;
+    --sched->count;
+    task.result = resume(task.env);
+    if(task.result == RES_SUSPENDED) {
+        push_back(sched, task);
+        return false;
+    }
+    *done = task;
+    return true;
+}
+
+void sched_free(Scheduler *sched) {
+    free(sched->tasks);
+    sched_init(sched);
+}
@@ -0,0 +1,545 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "box.h"
+#include "common.h"
+#include "compiler.h"
+#include "memory.h"
+#include "output.h"
+#include "sched.h"
+#include "server.h"
+#include "stats.h"
+#include "value.h"
+#include "vm.h"
+
+// Box cache
+
+typedef struct {
+    uint32_t hash;
+    uint32_t id;
+    size_t length;
+    char *source;
+    Box box;
+    // why source failed to compile, if it did; failures are kept too, so
+    // that resending them is no more work than sending what compiled
+    const char *error;
+} Cached_box;
+
+// Open addressing table from source text to compiled boxes, which are
+// also listed by id
+typedef struct {
+    Cached_box **table;
+    size_t capacity;
+    Cached_box **boxes;
+    uint32_t count;
+} Box_cache;
+
+static void cache_init(Box_cache *cache) {
+    cache->capacity = 64;
+    cache->table = calloc(cache->capacity, sizeof(Cached_box*));
+    cache->boxes = cog_realloc(NULL, 0, SERVER_MAX_BOXES * sizeof(Cached_box*));
+    cache->count = 0;
+    if(cache->table == NULL) {
+        eprintf("Could not allocate memory\n");
+        exit(1);
+    }
+}
+
+static Cached_box **cache_find(Box_cache *cache, const char *source, size_t length,
+        uint32_t hash) {
+    size_t mask = cache->capacity - 1;
+    size_t i = hash & mask;
+    while(cache->table[i] != NULL) {
+        Cached_box *entry = cache->table[i];
+        if(entry->hash == hash && entry->length == length
+                && memcmp(entry->source, source, length) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return &cache->table[i];
+}
+
+static void cache_grow(Box_cache *cache) {
+    Cached_box **old = cache->table;
+    size_t old_capacity = cache->capacity;
+    cache->capacity *= 2;
+    cache->table = calloc(cache->capacity, sizeof(Cached_box*));
+    if(cache->table == NULL) {
+        eprintf("Could not allocate memory\n");
+        exit(1);
+    }
+    for(size_t i = 0; i < old_capacity; ++i) {
+        if(old[i] != NULL)
+            *cache_find(cache, old[i]->source, old[i]->length, old[i]->hash) = old[i];
+    }
+    free(old);
+}
+
+// Returns the entry for source, compiling it on first sight, whether it
+// compiled or not, or NULL if the cache is full
+static Cached_box *cache_get(Box_cache *cache, const char *source, size_t length,
+        Cog_stats *stats) {
+    uint32_t hash = cog_hash_bytes(source, length);
+    Cached_box **slot = cache_find(cache, source, length, hash);
+    if(*slot != NULL)
+        return *slot;
+    if(cache->count == SERVER_MAX_BOXES)
+        return NULL;
+
+    Cached_box *entry = cog_realloc(NULL, 0, sizeof(Cached_box));
+    box_init(&entry->box);
+    uint64_t time = 0;
+    if(stats != NULL) {
+        cog_stats_time_lexer(stats, source, length);
+        time = cog_stats_start(stats);
+    }
+    bool compiled = compile(source, length, &entry->box);
+    if(stats != NULL)
+        cog_stats_record(stats, PHASE_COMPILE, time);
+    entry->error = NULL;
+    if(!compiled) {
+        box_free(&entry->box);
+        entry->error = "compile error";
+    }
+    entry->hash = hash;
+    entry->length = length;
+    entry->source = cog_realloc(NULL, 0, length > 0 ? length : 1);
+    memcpy(entry->source, source, length);
+    entry->id = cache->count;
+    cache->boxes[cache->count++] = entry;
+    *slot = entry;
+    if(cache->count * 4 > cache->capacity * 3)
+        cache_grow(cache);
+    return entry;
+}
+
+static void cache_free(Box_cache *cache) {
+    for(uint32_t i = 0; i < cache->count; ++i) {
+        if(cache->boxes[i]->error == NULL)
+            box_free(&cache->boxes[i]->box);
+        free(cache->boxes[i]->source);
+        free(cache->boxes[i]);
+    }
+    free(cache->boxes);
+    free(cache->table);
+}
+
+// Connections
+
+typedef struct Connection {
+    struct Connection *prev;
+    struct Connection *next;
+    int fd;
+    Cog_env env;
+    char *in;
+    size_t in_count;
+    size_t in_capacity;
+    Cog_output out;
+    size_t out_sent; // bytes of out already on their way
+    bool want_write;
+    bool busy; // its evaluation is suspended in the scheduler
+    uint64_t run_start;
+    Box scratch; // for what the cache has no room for
+} Connection;
+
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    Box_cache cache;
+    Scheduler sched;
+    uint64_t slice;
+    Cog_stats *stats;
+    Connection *conns; // kept for the final cleanup
+} Server;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop_signal(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+static uint32_t read_u32(const char *bytes) {
+    const uint8_t *b = (const uint8_t*) bytes;
+    return (uint32_t) b[0] | ((uint32_t) b[1] << 8)
+        | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+static void write_u32(char *bytes, uint32_t n) {
+    bytes[0] = (char) (n & 0xFF);
+    bytes[1] = (char) ((n >> 8) & 0xFF);
+    bytes[2] = (char) ((n >> 16) & 0xFF);
+    bytes[3] = (char) ((n >> 24) & 0xFF);
+}
+
+// Starts a response frame and returns where its header is, so that the
+// length can be filled in once the payload has been written
+static size_t begin_frame(Cog_output *out, Frame_t type) {
+    size_t header = out->count;
+    char bytes[SERVER_HEADER_SIZE] = { 0, 0, 0, 0, (char) type };
+    cog_output_write(out, bytes, SERVER_HEADER_SIZE);
+    return header;
+}
+
+static void end_frame(Cog_output *out, size_t header) {
+    write_u32(out->data + header, (uint32_t) (out->count - header - 4));
+}
+
+static void respond_error(Cog_output *out, const char *message) {
+    size_t header = begin_frame(out, FRAME_ERROR);
+    cog_output_write(out, message, strlen(message));
+    end_frame(out, header);
+}
+
+static void finish_run(Server *srv, Connection *conn, Cog_result res) {
+    if(srv->stats != NULL)
+        cog_stats_record(srv->stats, PHASE_EXECUTE, conn->run_start);
+    if(res != RES_OK) {
+        respond_error(&conn->out, "runtime error");
+        return;
+    }
+    size_t header = begin_frame(&conn->out, FRAME_VALUE);
+    cog_output_value(&conn->out, conn->env.ret);
+    end_frame(&conn->out, header);
+}
+
+// Answers right away, unless the evaluation gets suspended; then the
+// answer comes once the scheduler has seen it through
+static void respond_run(Server *srv, Connection *conn, const Box *box) {
+    conn->run_start = srv->stats != NULL ? cog_stats_start(srv->stats) : 0;
+    Cog_result res = execute(&conn->env, box);
+    if(res == RES_SUSPENDED) {
+        sched_add(&srv->sched, &conn->env, conn);
+        conn->busy = true;
+        return;
+    }
+    finish_run(srv, conn, res);
+}
+
+static void handle_request(Server *srv, Connection *conn, Frame_t type,
+        const char *payload, size_t length) {
+    Cached_box *entry;
+    switch(type) {
+        case FRAME_EVAL:
+            entry = cache_get(&srv->cache, payload, length, srv->stats);
+            if(entry != NULL && entry->error != NULL) {
+                respond_error(&conn->out, entry->error);
+            } else if(entry != NULL) {
+                respond_run(srv, conn, &entry->box);
+            } else {
+                // no room left to keep it; compile it just this once
+                box_reset(&conn->scratch);
+                if(compile(payload, length, &conn->scratch))
+                    respond_run(srv, conn, &conn->scratch);
+                else
+                    respond_error(&conn->out, "compile error");
+            }
+            return;
+
+        case FRAME_COMPILE: {
+            entry = cache_get(&srv->cache, payload, length, srv->stats);
+            if(entry == NULL || entry->error != NULL) {
+                respond_error(&conn->out, entry == NULL ? "too many boxes" : entry->error);
+                return;
+            }
+            size_t header = begin_frame(&conn->out, FRAME_ID);
+            char id[4];
+            write_u32(id, entry->id);
+            cog_output_write(&conn->out, id, 4);
+            end_frame(&conn->out, header);
+            return;
+        }
+
+        case FRAME_RUN: {
+            uint32_t id = length == 4 ? read_u32(payload) : UINT32_MAX;
+            // ids of sources that failed to compile are never handed out
+            if(id >= srv->cache.count || srv->cache.boxes[id]->error != NULL) {
+                respond_error(&conn->out, "no such box");
+                return;
+            }
+            respond_run(srv, conn, &srv->cache.boxes[id]->box);
+            return;
+        }
+
+        default:
+            respond_error(&conn->out, "unknown request");
+            return;
+    }
+}
+
+static void connection_close(Server *srv, Connection *conn) {
+    if(conn->busy)
+        sched_remove(&srv->sched, &conn->env);
+    if(conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        srv->conns = conn->next;
+    if(conn->next != NULL)
+        conn->next->prev = conn->prev;
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    cog_env_free(&conn->env);
+    cog_output_free(&conn->out);
+    box_free(&conn->scratch);
+    free(conn->in);
+    free(conn);
+}
+
+// Sends as much pending output as the socket takes, asking to be told
+// when it can take more. Returns false if the connection broke.
+static bool connection_flush(Server *srv, Connection *conn) {
+    while(conn->out_sent < conn->out.count) {
+        ssize_t n = send(conn->fd, conn->out.data + conn->out_sent,
+                conn->out.count - conn->out_sent, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        conn->out_sent += n;
+    }
+    bool pending = conn->out_sent < conn->out.count;
+    if(!pending)
+        conn->out.count = conn->out_sent = 0;
+    if(pending != conn->want_write) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | (pending ? EPOLLOUT : 0);
+        ev.data.ptr = conn;
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->want_write = pending;
+    }
+    return true;
+}
+
+// Answers every complete request received so far, stopping early if an
+// evaluation gets suspended. Returns false if the connection broke.
+static bool connection_process(Server *srv, Connection *conn) {
+    size_t pos = 0;
+    while(!conn->busy && conn->in_count - pos >= SERVER_HEADER_SIZE) {
+        uint32_t length = read_u32(conn->in + pos);
+        if(length == 0 || length > SERVER_MAX_FRAME)
+            return false; // garbage; there's no way to resynchronize
+        if(conn->in_count - pos < 4 + (size_t) length)
+            break;
+        Frame_t type = (Frame_t) (uint8_t) conn->in[pos + 4];
+        handle_request(srv, conn, type, conn->in + pos + SERVER_HEADER_SIZE, length - 1);
+        pos += 4 + (size_t) length;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_count - pos);
+    conn->in_count -= pos;
+    return connection_flush(srv, conn);
+}
+
+// Reads whatever has arrived and answers what it can of it. Returns
+// false once the connection should be closed.
+static bool connection_read(Server *srv, Connection *conn) {
+    bool closed = false;
+    while(true) {
+        if(conn->in_capacity - conn->in_count < SERVER_READ_SIZE) {
+            size_t new_capacity = conn->in_capacity * 2;
+            conn->in = cog_realloc(conn->in, conn->in_capacity, new_capacity);
+            conn->in_capacity = new_capacity;
+        }
+        ssize_t n = recv(conn->fd, conn->in + conn->in_count,
+                conn->in_capacity - conn->in_count, 0);
+        if(n == 0) {
+            // answer what came before the end of the stream
+            closed = true;
+            break;
+        }
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        conn->in_count += n;
+    }
+    return connection_process(srv, conn) && !closed;
+}
+
+static void accept_connections(Server *srv) {
+    while(true) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        Connection *conn = cog_realloc(NULL, 0, sizeof(Connection));
+        conn->fd = fd;
+        cog_env_init(&conn->env);
+        conn->in_capacity = 2 * SERVER_READ_SIZE;
+        conn->in = cog_realloc(NULL, 0, conn->in_capacity);
+        conn->in_count = 0;
+        cog_output_init(&conn->out, NULL, COG_OUTPUT_CAPACITY);
+        conn->out_sent = 0;
+        conn->want_write = false;
+        conn->busy = false;
+        cog_env_set_slice(&conn->env, srv->slice);
+        box_init(&conn->scratch);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if(epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            eprintf("(!) Could not watch connection: %s\n", strerror(errno));
+            close(fd);
+            cog_env_free(&conn->env);
+            cog_output_free(&conn->out);
+            box_free(&conn->scratch);
+            free(conn->in);
+            free(conn);
+            continue;
+        }
+        conn->prev = NULL;
+        conn->next = srv->conns;
+        if(srv->conns != NULL)
+            srv->conns->prev = conn;
+        srv->conns = conn;
+    }
+}
+
+static bool server_listen(Server *srv, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        eprintf("(!) Socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(srv->listen_fd < 0) {
+        eprintf("(!) Could not create socket: %s\n", strerror(errno));
+        return false;
+    }
+    // a socket file left over from an earlier run would get in the way
+    unlink(path);
+    if(bind(srv->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+            || listen(srv->listen_fd, SOMAXCONN) < 0) {
+        eprintf("(!) Could not listen on %s: %s\n", path, strerror(errno));
+        close(srv->listen_fd);
+        return false;
+    }
+
+    srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // stands for the listening socket
+    if(srv->epoll_fd < 0
+            || epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &ev) < 0) {
+        eprintf("(!) Could not set up epoll: %s\n", strerror(errno));
+        close(srv->listen_fd);
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+// Public interface
+
+// Gives every suspended evaluation one more slice, answering those that
+// finish
+static void run_round(Server *srv) {
+    for(unsigned turns = srv->sched.count; turns > 0; --turns) {
+        Sched_task done;
+        if(!sched_step(&srv->sched, &done))
+            continue;
+        Connection *conn = done.data;
+        conn->busy = false;
+        finish_run(srv, conn, done.result);
+        // carry on with whatever it sent in the meantime
+        if(!connection_process(srv, conn))
+            connection_close(srv, conn);
+    }
+}
+
+bool server_run(const char *path, uint64_t slice, Cog_stats *stats) {
+    Server srv;
+    srv.slice = slice;
+    srv.stats = stats;
+    if(!server_listen(&srv, path))
+        return false;
+    cache_init(&srv.cache);
+    sched_init(&srv.sched);
+    srv.conns = NULL;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while(!stopping) {
+        // with evaluations pending, only look for what's already there
+        int timeout = srv.sched.count > 0 ? 0 : -1;
+        int n = epoll_wait(srv.epoll_fd, events, SERVER_MAX_EVENTS, timeout);
+        if(stats != NULL && cog_stats_dump_requested())
+            cog_stats_write_json(stats, stderr);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            eprintf("(!) epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+        for(int i = 0; i < n; ++i) {
+            Connection *conn = events[i].data.ptr;
+            if(conn == NULL) {
+                accept_connections(&srv);
+                continue;
+            }
+            uint32_t what = events[i].events;
+            // hang-ups still get their last requests answered, as the
+            // read that drains them also notices the end of the stream
+            bool alive = !(what & EPOLLERR) && (what & (EPOLLIN | EPOLLOUT));
+            if(alive && (what & EPOLLIN))
+                alive = connection_read(&srv, conn);
+            if(alive && (what & EPOLLOUT))
+                alive = connection_flush(&srv, conn);
+            if(!alive)
+                connection_close(&srv, conn);
+        }
+        run_round(&srv);
+    }
+
+    while(srv.conns != NULL)
+        connection_close(&srv, srv.conns);
+    close(srv.epoll_fd);
+    close(srv.listen_fd);
+    unlink(path);
+    cache_free(&srv.cache);
+    sched_free(&srv.sched);
+    return true;
+}
@@ -0,0 +1,253 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "lexer.h"
+#include "memory.h"
+#include "perf.h"
+#include "stats.h"
+
+static const char *phase_names[PHASE_COUNT] = { "lex", "compile", "execute" };
+
+static volatile sig_atomic_t dump_requested = 0;
+
+// Histograms
+
+static int bucket_of(uint64_t value) {
+    if(value < COG_HISTOGRAM_SUB_BUCKETS)
+        return (int) value;
+    int magnitude = 63;
+    while(!(value & (1ull << magnitude)))
+        --magnitude;
+    int shift = magnitude - COG_HISTOGRAM_SUB_BITS;
+    int sub = (int) ((value >> shift) & (COG_HISTOGRAM_SUB_BUCKETS - 1));
+    return (shift + 1) * COG_HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// The largest value that falls into a bucket
+static uint64_t bucket_limit(int bucket) {
+    if(bucket < COG_HISTOGRAM_SUB_BUCKETS)
+        return (uint64_t) bucket;
+    int shift = bucket / COG_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t) (bucket % COG_HISTOGRAM_SUB_BUCKETS);
+    uint64_t low = (COG_HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return low + ((1ull << shift) - 1);
+}
+
+void cog_histogram_init(Cog_histogram *hist) {
+    memset(hist->counts, 0, sizeof(hist->counts));
+    hist->total = 0;
+    hist->min = UINT64_MAX;
+    hist->max = 0;
+}
+
+void cog_histogram_record(Cog_histogram *hist, uint64_t value) {
+    ++hist->counts[bucket_of(value)];
+    ++hist->total;
+    if(value < hist->min) hist->min = value;
+    if(value > hist->max) hist->max = value;
+}
+
+void cog_histogram_merge(Cog_histogram *into, const Cog_histogram *from) {
+    if(from->total == 0)
+        return;
+    for(int i = 0; i < COG_HISTOGRAM_BUCKETS; ++i)
+        into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if(from->min < into->min) into->min = from->min;
+    if(from->max > into->max) into->max = from->max;
+}
+
+uint64_t cog_histogram_percentile(const Cog_histogram *hist, double p) {
+    if(hist->total == 0)
+        return 0;
+    uint64_t rank = (uint64_t) (p * hist->total + 0.5);
+    if(rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for(int i = 0; i < COG_HISTOGRAM_BUCKETS; ++i) {
+        seen += hist->counts[i];
+        if(seen >= rank) {
+            uint64_t limit = bucket_limit(i);
+            // never report more than was actually seen
+            return limit < hist->max ? limit : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+// Per-phase statistics
+
+void cog_stats_init(Cog_stats *stats) {
+    stats->perf = NULL;
+    cog_stats_reset(stats);
+}
+
+void cog_stats_reset(Cog_stats *stats) {
+    for(int i = 0; i < PHASE_COUNT; ++i)
+        cog_histogram_init(&stats->phases[i]);
+    memset(&stats->mark, 0, sizeof(stats->mark));
+    memset(stats->events, 0, sizeof(stats->events));
+    memset(stats->last, 0, sizeof(stats->last));
+}
+
+bool cog_stats_count_events(Cog_stats *stats) {
+    if(stats->perf != NULL)
+        return true;
+    Cog_perf *perf = cog_realloc(NULL, 0, sizeof(Cog_perf));
+    if(!cog_perf_open(perf)) {
+        free(perf);
+        return false;
+    }
+    stats->perf = perf;
+    return true;
+}
+
+void cog_stats_free(Cog_stats *stats) {
+    if(stats->perf != NULL) {
+        cog_perf_close(stats->perf);
+        free(stats->perf);
+        stats->perf = NULL;
+    }
+}
+
+void cog_stats_merge(Cog_stats *into, const Cog_stats *from) {
+    for(int i = 0; i < PHASE_COUNT; ++i) {
+        cog_histogram_merge(&into->phases[i], &from->phases[i]);
+        Cog_perf_sample none = { { 0 } };
+        cog_perf_accumulate(&into->events[i], &none, &from->events[i]);
+    }
+}
+
+uint64_t cog_stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t cog_stats_start(Cog_stats *stats) {
+    if(stats->perf != NULL)
+        cog_perf_read(stats->perf, &stats->mark);
+    return cog_stats_clock();
+}
+
+uint64_t cog_stats_record(Cog_stats *stats, Phase phase, uint64_t since) {
+    uint64_t now = cog_stats_clock();
+    cog_histogram_record(&stats->phases[phase], now - since);
+    if(stats->perf == NULL)
+        return now;
+    // if the counters can't be read, whatever happened is left for the
+    // next phase to account for
+    Cog_perf_sample sample;
+    if(cog_perf_read(stats->perf, &sample)) {
+        memset(&stats->last[phase], 0, sizeof(stats->last[phase]));
+        cog_perf_accumulate(&stats->last[phase], &stats->mark, &sample);
+        cog_perf_accumulate(&stats->events[phase], &stats->mark, &sample);
+        stats->mark = sample;
+    }
+    // the next phase starts only after the counters are read
+    return cog_stats_clock();
+}
+
+void cog_stats_time_lexer(Cog_stats *stats, const char *source, size_t length) {
+    uint64_t start = cog_stats_start(stats);
+    Lexer lex;
+    lexer_init(&lex, source, length);
+    while(lexer_get_token(&lex).type != TOKEN_END)
+        ;
+    cog_stats_record(stats, PHASE_LEX, start);
+}
+
+// The mean of every counter over runs, plus IPC and branch miss rate
+static void write_events_json(const Cog_perf *perf, const Cog_perf_sample *events,
+        uint64_t runs, FILE *file) {
+    const uint64_t *v = events->values;
+    double n = runs > 0 ? (double) runs : 1.0;
+    for(int i = 0; i < PERF_COUNTER_COUNT; ++i)
+        if(cog_perf_has(perf, (Perf_counter) i))
+            fprintf(file, ", \"%s\": %.1f", cog_perf_counter_name((Perf_counter) i),
+                    v[i] / n);
+    if(cog_perf_has(perf, PERF_CYCLES) && cog_perf_has(perf, PERF_INSTRUCTIONS))
+        fprintf(file, ", \"ipc\": %.3f", v[PERF_CYCLES] > 0 ?
+                (double) v[PERF_INSTRUCTIONS] / v[PERF_CYCLES] : 0.0);
+    if(cog_perf_has(perf, PERF_BRANCHES) && cog_perf_has(perf, PERF_BRANCH_MISSES))
+        fprintf(file, ", \"branch_miss_rate\": %.5f", v[PERF_BRANCHES] > 0 ?
+                (double) v[PERF_BRANCH_MISSES] / v[PERF_BRANCHES] : 0.0);
+}
+
+void cog_stats_write_json(const Cog_stats *stats, FILE *file) {
+    fprintf(file, "{");
+    for(int i = 0; i < PHASE_COUNT; ++i) {
+        const Cog_histogram *hist = &stats->phases[i];
+        fprintf(file, "%s\"%s\": { \"count\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu,"
+                " \"p99_ns\": %llu, \"max_ns\": %llu", i > 0 ? ", " : " ",
+                phase_names[i], (unsigned long long) hist->total,
+                (unsigned long long) cog_histogram_percentile(hist, 0.50),
+                (unsigned long long) cog_histogram_percentile(hist, 0.90),
+                (unsigned long long) cog_histogram_percentile(hist, 0.99),
+                (unsigned long long) hist->max);
+        if(stats->perf != NULL)
+            write_events_json(stats->perf, &stats->events[i], hist->total, file);
+        fprintf(file, " }");
+    }
+    fprintf(file, " }\n");
+    fflush(file);
+}
+
+void cog_stats_print_events(const Cog_stats *stats, FILE *file) {
+    if(stats->perf == NULL)
+        return;
+    fprintf(file, "   compile: ");
+    cog_perf_print(stats->perf, &stats->last[PHASE_COMPILE], 1, file);
+    fprintf(file, "   execute: ");
+    cog_perf_print(stats->perf, &stats->last[PHASE_EXECUTE], 1, file);
+}
+
+// Dumps on demand
+
+static void on_dump_signal(int sig) {
+    (void) sig;
+    dump_requested = 1;
+}
+
+void cog_stats_handle_signal(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_dump_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+bool cog_stats_dump_requested(void) {
+    if(!dump_requested)
+        return false;
+    dump_requested = 0;
+    return true;
+}
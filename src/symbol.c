@@ -0,0 +1,90 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+#include "symbol.h"
+
+#define SYMBOL_TABLE_INITIAL_CAPACITY 256
+
+// Open addressing with linear probing, kept at most 3/4 full. Every
+// compilation may intern, from any thread, so the table has a lock;
+// executions never touch it.
+static struct {
+    pthread_mutex_t lock;
+    const Cog_symbol **slots;
+    size_t capacity;
+    size_t count;
+} table = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+static const Cog_symbol **find_slot(const Cog_symbol **slots, size_t capacity,
+        const char *chars, size_t length, uint32_t hash) {
+    size_t mask = capacity - 1;
+    size_t i = hash & mask;
+    while(slots[i] != NULL) {
+        const Cog_symbol *sym = slots[i];
+        if(sym->hash == hash && sym->length == length
+                && memcmp(sym->chars, chars, length) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+static void grow(void) {
+    size_t capacity = table.capacity == 0 ? SYMBOL_TABLE_INITIAL_CAPACITY
+        : table.capacity * 2;
+    const Cog_symbol **slots = cog_realloc(NULL, 0, capacity * sizeof(Cog_symbol*));
+    memset(slots, 0, capacity * sizeof(Cog_symbol*));
+    for(size_t i = 0; i < table.capacity; ++i) {
+        const Cog_symbol *sym = table.slots[i];
+        if(sym != NULL)
+            *find_slot(slots, capacity, sym->chars, sym->length, sym->hash) = sym;
+    }
+    free(table.slots);
+    table.slots = slots;
+    table.capacity = capacity;
+}
+
+const Cog_symbol *cog_symbol_intern(const char *chars, size_t length) {
+    uint32_t hash = cog_hash_bytes(chars, length);
+    pthread_mutex_lock(&table.lock);
+    if((table.count + 1) * 4 > table.capacity * 3)
+        grow();
+    const Cog_symbol **slot = find_slot(table.slots, table.capacity, chars, length, hash);
+    if(*slot == NULL) {
+        Cog_symbol *sym = cog_realloc(NULL, 0, sizeof(Cog_symbol) + length + 1);
+        sym->hash = hash;
+        sym->length = (uint32_t) length;
+        memcpy(sym->chars, chars, length);
+        sym->chars[length] = '\0';
+        *slot = sym;
+        ++table.count;
+    }
+    const Cog_symbol *sym = *slot;
+    pthread_mutex_unlock(&table.lock);
+    return sym;
+}
@@ -20,28 +20,114 @@
    <https://www.gnu.org/licenses/>.
 */
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+
 #include "common.h"
+#include "dtoa.h"
+#include "object.h"
 #include "value.h"
 
-void cog_value_print(Cog_value value) {
+size_t cog_value_format_size(Cog_value value) {
+    if(IS_SYMBOL(value))
+        return TO_SYMBOL(value)->length + 2;
+    if(IS_STRING(value)) {
+        size_t length;
+        cog_string_chars(&value, &length);
+        return length + 3;
+    }
+    if(IS_VECTOR(value))
+        // brackets and a separator between each element
+        return TO_VECTOR(value)->length * (COG_VALUE_FORMAT_MAX + 2) + 3;
+    return COG_VALUE_FORMAT_MAX;
+}
+
+size_t cog_value_format(Cog_value value, char *buffer) {
     switch(value.type) {
         case TYPE_NUMBER:
-            printf("%g", TO_DOUBLE(value));
-            break;
+            return cog_dtoa(TO_DOUBLE(value), buffer);
+        case TYPE_INT:
+            return (size_t) snprintf(buffer, COG_VALUE_FORMAT_MAX, "%" PRId64, TO_INT(value));
         case TYPE_BOOLEAN:
-            printf(TO_BOOL(value) ? "true" : "false");
-            break;
+            if(TO_BOOL(value)) {
+                memcpy(buffer, "true", 5);
+                return 4;
+            }
+            memcpy(buffer, "false", 6);
+            return 5;
         case TYPE_NONE:
-            printf("none");
-            break;
+            memcpy(buffer, "none", 5);
+            return 4;
+        case TYPE_SYMBOL: {
+            const Cog_symbol *sym = TO_SYMBOL(value);
+            buffer[0] = ':';
+            memcpy(buffer + 1, sym->chars, sym->length + 1);
+            return sym->length + 1;
+        }
+        case TYPE_SHORT_STRING:
+        case TYPE_STRING: {
+            size_t length;
+            const char *chars = cog_string_chars(&value, &length);
+            buffer[0] = '"';
+            memcpy(buffer + 1, chars, length);
+            buffer[length + 1] = '"';
+            buffer[length + 2] = '\0';
+            return length + 2;
+        }
+        case TYPE_VECTOR: {
+            const Cog_vector *vector = TO_VECTOR(value);
+            size_t length = 0;
+            buffer[length++] = '[';
+            for(uint32_t i = 0; i < vector->length; ++i) {
+                if(i > 0) {
+                    memcpy(buffer + length, ", ", 2);
+                    length += 2;
+                }
+                length += cog_dtoa(vector->elements[i], buffer + length);
+            }
+            buffer[length++] = ']';
+            buffer[length] = '\0';
+            return length;
+        }
         default:
             // should be unreachable
-            eprintf("???");
+            memcpy(buffer, "???", 4);
+            return 3;
+    }
+}
+
+void cog_value_print(Cog_value value) {
+    if(IS_SYMBOL(value)) {
+        printf(":%s", TO_SYMBOL(value)->chars);
+        return;
+    }
+    if(IS_STRING(value)) {
+        size_t length;
+        const char *chars = cog_string_chars(&value, &length);
+        printf("\"%.*s\"", (int) length, chars);
+        return;
+    }
+    if(IS_VECTOR(value)) {
+        const Cog_vector *vector = TO_VECTOR(value);
+        char text[COG_VALUE_FORMAT_MAX];
+        printf("[");
+        for(uint32_t i = 0; i < vector->length; ++i) {
+            size_t length = cog_dtoa(vector->elements[i], text);
+            printf("%s%.*s", i > 0 ? ", " : "", (int) length, text);
+        }
+        printf("]");
+        return;
     }
+    char text[COG_VALUE_FORMAT_MAX];
+    size_t length = cog_value_format(value, text);
+    fwrite(text, 1, length, stdout);
 }
 
 bool cog_values_equal(Cog_value a, Cog_value b) {
+    // numbers of different kinds are compared as doubles
+    if(IS_NUMERIC(a) && IS_NUMERIC(b) && a.type != b.type)
+        return AS_DOUBLE(a) == AS_DOUBLE(b);
     if(a.type != b.type) 
         // Values of different types can never be equal
         return false;
@@ -50,10 +136,21 @@ bool cog_values_equal(Cog_value a, Cog_value b) {
     switch(a.type) {
         case TYPE_NUMBER:
             return TO_DOUBLE(a) == TO_DOUBLE(b);
+        case TYPE_INT:
+            return TO_INT(a) == TO_INT(b);
         case TYPE_BOOLEAN:
             return TO_BOOL(a) == TO_BOOL(b);
         case TYPE_NONE:
             return true;
+        case TYPE_SYMBOL:
+            // interned, so the same name is always the same symbol
+            return TO_SYMBOL(a) == TO_SYMBOL(b);
+        case TYPE_SHORT_STRING:
+            return cog_short_strings_equal(a, b);
+        case TYPE_STRING:
+            return cog_strings_equal(a, b);
+        case TYPE_VECTOR:
+            return cog_vectors_equal(a, b);
         default:
             // should be unreachable
             eprintf("(?) Equality not implemented for a type\n");
@@ -0,0 +1,353 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vector.h"
+
+// COG_NO_SIMD leaves only the plain kernels, to compare against
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && !defined(COG_NO_SIMD)
+#define VECTOR_X86
+#include <immintrin.h>
+#endif
+
+// a op b with a number on either side, flipped so that the vector goes
+// first: number - vector is VECTOR_RSUB, number < vector is VECTOR_GT, ...
+#define VECTOR_RSUB VECTOR_OP_COUNT
+#define VECTOR_RDIV (VECTOR_OP_COUNT + 1)
+#define SCALAR_OP_COUNT (VECTOR_OP_COUNT + 2)
+
+typedef void (*Pair_kernel)(double *out, const double *a, const double *b, size_t n);
+typedef void (*Scalar_kernel)(double *out, const double *a, double b, size_t n);
+typedef double (*Reduce_kernel)(const double *a, size_t n);
+
+typedef struct {
+    const char *name;
+    Pair_kernel pair[VECTOR_OP_COUNT];
+    Scalar_kernel scalar[SCALAR_OP_COUNT];
+    Reduce_kernel sum;
+    Reduce_kernel min;
+    Reduce_kernel max;
+} Kernels;
+
+// Element operations, shared by all kernels for what's left over after
+// the last full register
+
+#define add(x, y) ((x) + (y))
+#define sub(x, y) ((x) - (y))
+#define mul(x, y) ((x) * (y))
+#define div(x, y) ((x) / (y))
+#define rsub(x, y) ((y) - (x))
+#define rdiv(x, y) ((y) / (x))
+#define lt(x, y) ((x) < (y) ? 1.0 : 0.0)
+#define gt(x, y) ((x) > (y) ? 1.0 : 0.0)
+#define eq(x, y) ((x) == (y) ? 1.0 : 0.0)
+
+// x unless y is less, which keeps y (the running minimum) when x is NaN;
+// the SIMD min instructions do just the same
+#define min2(x, y) ((x) < (y) ? (x) : (y))
+#define max2(x, y) ((x) > (y) ? (x) : (y))
+
+// Reductions work on four lanes, combined as (0 + 2) + (1 + 3), whatever
+// the kernels, so that every machine gets the same sums to the bit
+
+// Plain kernels
+
+#define PLAIN_PAIR(op)                                                  \
+static void op##_pair_plain(double *out, const double *a, const double *b, \
+        size_t n) {                                                     \
+    for(size_t i = 0; i < n; ++i)                                       \
+        out[i] = op(a[i], b[i]);                                        \
+}
+
+#define PLAIN_SCALAR(op)                                                \
+static void op##_scalar_plain(double *out, const double *a, double b,   \
+        size_t n) {                                                     \
+    for(size_t i = 0; i < n; ++i)                                       \
+        out[i] = op(a[i], b);                                           \
+}
+
+#define PLAIN_REDUCE(name, op, start)                                   \
+static double name##_plain(const double *a, size_t n) {                 \
+    double lanes[4] = { start, start, start, start };                   \
+    size_t i = 0;                                                       \
+    for(; i + 4 <= n; i += 4) {                                         \
+        for(int j = 0; j < 4; ++j)                                      \
+            lanes[j] = op(a[i + j], lanes[j]);                          \
+    }                                                                   \
+    double result = op(op(lanes[0], lanes[2]), op(lanes[1], lanes[3])); \
+    for(; i < n; ++i)                                                   \
+        result = op(a[i], result);                                      \
+    return result;                                                      \
+}
+
+PLAIN_PAIR(add) PLAIN_PAIR(sub) PLAIN_PAIR(mul) PLAIN_PAIR(div)
+PLAIN_PAIR(lt) PLAIN_PAIR(gt) PLAIN_PAIR(eq)
+PLAIN_SCALAR(add) PLAIN_SCALAR(sub) PLAIN_SCALAR(mul) PLAIN_SCALAR(div)
+PLAIN_SCALAR(rsub) PLAIN_SCALAR(rdiv)
+PLAIN_SCALAR(lt) PLAIN_SCALAR(gt) PLAIN_SCALAR(eq)
+PLAIN_REDUCE(sum, add, 0.0)
+PLAIN_REDUCE(min, min2, INFINITY)
+PLAIN_REDUCE(max, max2, -INFINITY)
+
+#define KERNELS(isa) {                                                  \
+    #isa,                                                               \
+    { add_pair_##isa, sub_pair_##isa, mul_pair_##isa, div_pair_##isa,   \
+      lt_pair_##isa, gt_pair_##isa, eq_pair_##isa },                    \
+    { add_scalar_##isa, sub_scalar_##isa, mul_scalar_##isa,             \
+      div_scalar_##isa, lt_scalar_##isa, gt_scalar_##isa,               \
+      eq_scalar_##isa, rsub_scalar_##isa, rdiv_scalar_##isa },          \
+    sum_##isa, min_##isa, max_##isa,                                    \
+}
+
+static const Kernels plain_kernels = KERNELS(plain);
+
+#ifdef VECTOR_X86
+
+// SSE2 kernels, two numbers at a time
+
+#define SSE2 __attribute__((target("sse2")))
+
+#define add_sse2(x, y) _mm_add_pd(x, y)
+#define sub_sse2(x, y) _mm_sub_pd(x, y)
+#define mul_sse2(x, y) _mm_mul_pd(x, y)
+#define div_sse2(x, y) _mm_div_pd(x, y)
+#define rsub_sse2(x, y) _mm_sub_pd(y, x)
+#define rdiv_sse2(x, y) _mm_div_pd(y, x)
+// all ones where the comparison holds, masked down to 1.0
+#define lt_sse2(x, y) _mm_and_pd(_mm_cmplt_pd(x, y), _mm_set1_pd(1.0))
+#define gt_sse2(x, y) _mm_and_pd(_mm_cmpgt_pd(x, y), _mm_set1_pd(1.0))
+#define eq_sse2(x, y) _mm_and_pd(_mm_cmpeq_pd(x, y), _mm_set1_pd(1.0))
+#define min2_sse2(x, y) _mm_min_pd(x, y)
+#define max2_sse2(x, y) _mm_max_pd(x, y)
+
+#define SSE2_PAIR(op)                                                   \
+SSE2 static void op##_pair_sse2(double *out, const double *a,           \
+        const double *b, size_t n) {                                    \
+    size_t i = 0;                                                       \
+    for(; i + 2 <= n; i += 2)                                           \
+        _mm_storeu_pd(out + i,                                          \
+                op##_sse2(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));   \
+    for(; i < n; ++i)                                                   \
+        out[i] = op(a[i], b[i]);                                        \
+}
+
+#define SSE2_SCALAR(op)                                                 \
+SSE2 static void op##_scalar_sse2(double *out, const double *a,         \
+        double b, size_t n) {                                           \
+    __m128d y = _mm_set1_pd(b);                                         \
+    size_t i = 0;                                                       \
+    for(; i + 2 <= n; i += 2)                                           \
+        _mm_storeu_pd(out + i, op##_sse2(_mm_loadu_pd(a + i), y));      \
+    for(; i < n; ++i)                                                   \
+        out[i] = op(a[i], b);                                           \
+}
+
+// lanes 0 and 1 in low, 2 and 3 in high
+#define SSE2_REDUCE(name, op, start)                                    \
+SSE2 static double name##_sse2(const double *a, size_t n) {             \
+    __m128d low = _mm_set1_pd(start), high = low;                       \
+    size_t i = 0;                                                       \
+    for(; i + 4 <= n; i += 4) {                                         \
+        low = op##_sse2(_mm_loadu_pd(a + i), low);                      \
+        high = op##_sse2(_mm_loadu_pd(a + i + 2), high);                \
+    }                                                                   \
+    double lanes[2];                                                    \
+    _mm_storeu_pd(lanes, op##_sse2(low, high));                         \
+    double result = op(lanes[0], lanes[1]);                             \
+    for(; i < n; ++i)                                                   \
+        result = op(a[i], result);                                      \
+    return result;                                                      \
+}
+
+SSE2_PAIR(add) SSE2_PAIR(sub) SSE2_PAIR(mul) SSE2_PAIR(div)
+SSE2_PAIR(lt) SSE2_PAIR(gt) SSE2_PAIR(eq)
+SSE2_SCALAR(add) SSE2_SCALAR(sub) SSE2_SCALAR(mul) SSE2_SCALAR(div)
+SSE2_SCALAR(rsub) SSE2_SCALAR(rdiv)
+SSE2_SCALAR(lt) SSE2_SCALAR(gt) SSE2_SCALAR(eq)
+SSE2_REDUCE(sum, add, 0.0)
+SSE2_REDUCE(min, min2, INFINITY)
+SSE2_REDUCE(max, max2, -INFINITY)
+
+static const Kernels sse2_kernels = KERNELS(sse2);
+
+// AVX2 kernels, four numbers at a time
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define add_avx2(x, y) _mm256_add_pd(x, y)
+#define sub_avx2(x, y) _mm256_sub_pd(x, y)
+#define mul_avx2(x, y) _mm256_mul_pd(x, y)
+#define div_avx2(x, y) _mm256_div_pd(x, y)
+#define rsub_avx2(x, y) _mm256_sub_pd(y, x)
+#define rdiv_avx2(x, y) _mm256_div_pd(y, x)
+#define lt_avx2(x, y) \
+    _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), _mm256_set1_pd(1.0))
+#define gt_avx2(x, y) \
+    _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_GT_OQ), _mm256_set1_pd(1.0))
+#define eq_avx2(x, y) \
+    _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_EQ_OQ), _mm256_set1_pd(1.0))
+#define min2_avx2(x, y) _mm256_min_pd(x, y)
+#define max2_avx2(x, y) _mm256_max_pd(x, y)
+
+#define AVX2_PAIR(op)                                                   \
+AVX2 static void op##_pair_avx2(double *out, const double *a,           \
+        const double *b, size_t n) {                                    \
+    size_t i = 0;                                                       \
+    for(; i + 4 <= n; i += 4)                                           \
+        _mm256_storeu_pd(out + i,                                       \
+                op##_avx2(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+    for(; i < n; ++i)                                                   \
+        out[i] = op(a[i], b[i]);                                        \
+}
+
+#define AVX2_SCALAR(op)                                                 \
+AVX2 static void op##_scalar_avx2(double *out, const double *a,         \
+        double b, size_t n) {                                           \
+    __m256d y = _mm256_set1_pd(b);                                      \
+    size_t i = 0;                                                       \
+    for(; i + 4 <= n; i += 4)                                           \
+        _mm256_storeu_pd(out + i, op##_avx2(_mm256_loadu_pd(a + i), y)); \
+    for(; i < n; ++i)                                                   \
+        out[i] = op(a[i], b);                                           \
+}
+
+#define AVX2_REDUCE(name, op, start)                                    \
+AVX2 static double name##_avx2(const double *a, size_t n) {             \
+    __m256d acc = _mm256_set1_pd(start);                                \
+    size_t i = 0;                                                       \
+    for(; i + 4 <= n; i += 4)                                           \
+        acc = op##_avx2(_mm256_loadu_pd(a + i), acc);                   \
+    __m128d half = op##_sse2(_mm256_castpd256_pd128(acc),               \
+            _mm256_extractf128_pd(acc, 1));                             \
+    double lanes[2];                                                    \
+    _mm_storeu_pd(lanes, half);                                         \
+    double result = op(lanes[0], lanes[1]);                             \
+    for(; i < n; ++i)                                                   \
+        result = op(a[i], result);                                      \
+    return result;                                                      \
+}
+
+AVX2_PAIR(add) AVX2_PAIR(sub) AVX2_PAIR(mul) AVX2_PAIR(div)
+AVX2_PAIR(lt) AVX2_PAIR(gt) AVX2_PAIR(eq)
+AVX2_SCALAR(add) AVX2_SCALAR(sub) AVX2_SCALAR(mul) AVX2_SCALAR(div)
+AVX2_SCALAR(rsub) AVX2_SCALAR(rdiv)
+AVX2_SCALAR(lt) AVX2_SCALAR(gt) AVX2_SCALAR(eq)
+AVX2_REDUCE(sum, add, 0.0)
+AVX2_REDUCE(min, min2, INFINITY)
+AVX2_REDUCE(max, max2, -INFINITY)
+
+static const Kernels avx2_kernels = KERNELS(avx2);
+
+#endif // VECTOR_X86
+
+// Dispatch
+
+static const Kernels *kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels(void) {
+    kernels = &plain_kernels;
+#ifdef VECTOR_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        kernels = &avx2_kernels;
+    else if(__builtin_cpu_supports("sse2"))
+        kernels = &sse2_kernels;
+#endif
+}
+
+static const Kernels *get_kernels(void) {
+    pthread_once(&kernels_once, pick_kernels);
+    return kernels;
+}
+
+// The same op with its operands the other way around
+static int flipped(Vector_op op) {
+    switch(op) {
+        case VECTOR_SUB: return VECTOR_RSUB;
+        case VECTOR_DIV: return VECTOR_RDIV;
+        case VECTOR_LT: return VECTOR_GT;
+        case VECTOR_GT: return VECTOR_LT;
+        default: return op;
+    }
+}
+
+// Public interface
+
+bool cog_vector_op(Cog_arena *arena, Vector_op op, Cog_value a, Cog_value b,
+        Cog_value *result) {
+    const Kernels *k = get_kernels();
+    Cog_vector *out;
+    if(IS_VECTOR(a) && IS_VECTOR(b)) {
+        const Cog_vector *x = TO_VECTOR(a), *y = TO_VECTOR(b);
+        if(x->length != y->length)
+            return false;
+        out = cog_vector_new(arena, x->length);
+        k->pair[op](out->elements, x->elements, y->elements, x->length);
+    } else if(IS_VECTOR(a) && IS_NUMERIC(b)) {
+        const Cog_vector *x = TO_VECTOR(a);
+        out = cog_vector_new(arena, x->length);
+        k->scalar[op](out->elements, x->elements, AS_DOUBLE(b), x->length);
+    } else if(IS_NUMERIC(a) && IS_VECTOR(b)) {
+        const Cog_vector *y = TO_VECTOR(b);
+        out = cog_vector_new(arena, y->length);
+        k->scalar[flipped(op)](out->elements, y->elements, AS_DOUBLE(a), y->length);
+    } else {
+        return false;
+    }
+    *result = COG_VECTOR(out);
+    return true;
+}
+
+Cog_value cog_vector_not(Cog_arena *arena, Cog_value vector) {
+    const Cog_vector *x = TO_VECTOR(vector);
+    Cog_vector *out = cog_vector_new(arena, x->length);
+    get_kernels()->scalar[VECTOR_EQ](out->elements, x->elements, 0.0, x->length);
+    return COG_VECTOR(out);
+}
+
+double cog_vector_sum(const Cog_vector *vector) {
+    return get_kernels()->sum(vector->elements, vector->length);
+}
+
+double cog_vector_mean(const Cog_vector *vector) {
+    return cog_vector_sum(vector) / vector->length;
+}
+
+double cog_vector_min(const Cog_vector *vector) {
+    return get_kernels()->min(vector->elements, vector->length);
+}
+
+double cog_vector_max(const Cog_vector *vector) {
+    return get_kernels()->max(vector->elements, vector->length);
+}
+
+const char *cog_vector_kernels(void) {
+    return get_kernels()->name;
+}
@@ -20,33 +20,83 @@
    <https://www.gnu.org/licenses/>.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
 
 #include "array.h"
 #include "box.h"
+#include "common.h"
+#include "globals.h"
+#include "intrinsic.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include "profile.h"
 #include "value.h"
+#include "vector.h"
 #include "vm.h"
 #include "opcodes.h"
 
 // Types of operations
 
-#define add(a, b) ((a) + (b))
-#define sub(a, b) ((a) - (b))
-#define mul(a, b) ((a) * (b))
-#define div(a, b) ((a) / (b))
-
 #define less(a, b) ((a) < (b))
 #define greater(a, b) ((a) > (b))
 
-#define BIN_NUMERIC_OP(type_value, op) {       \
-    Cog_value b = pop();                       \
-    Cog_value a = pop();                       \
-    if(!IS_NUMBER(a) || !IS_NUMBER(b))         \
-        return RES_ERROR;                      \
-                                               \
-    double x = TO_DOUBLE(a), y = TO_DOUBLE(b); \
-    push(type_value(op(x, y)));                \
+// Numbers first, then vectors
+#define BIN_NUMERIC_OP(op, vector_op) {                                \
+    Cog_value b = pop();                                               \
+    Cog_value a = pop();                                               \
+    if(IS_NUMERIC(a) && IS_NUMERIC(b)) {                               \
+        push(op(a, b));                                                \
+    } else {                                                           \
+        Cog_value result;                                              \
+        if(!cog_vector_op(&env->arena, vector_op, a, b, &result))      \
+            return RES_ERROR;                                          \
+        push(result);                                                  \
+    }                                                                  \
+}
+
+// Numbers first, then strings, in order, then vectors, into masks
+#define COMPARE_OP(op, vector_op) {                                    \
+    Cog_value b = pop();                                               \
+    Cog_value a = pop();                                               \
+    Cog_value mask;                                                    \
+    if(IS_INT(a) && IS_INT(b))                                         \
+        push(COG_BOOLEAN(op(TO_INT(a), TO_INT(b))));                   \
+    else if(IS_NUMERIC(a) && IS_NUMERIC(b))                            \
+        push(COG_BOOLEAN(op(AS_DOUBLE(a), AS_DOUBLE(b))));             \
+    else if(IS_STRING(a) && IS_STRING(b))                              \
+        push(COG_BOOLEAN(op(cog_strings_compare(a, b), 0)));           \
+    else if(cog_vector_op(&env->arena, vector_op, a, b, &mask))        \
+        push(mask);                                                    \
+    else                                                               \
+        return RES_ERROR;                                              \
+}
+
+#define UNARY_MATH_OP(op) {                                 \
+    Cog_value a = pop();                                    \
+    if(!IS_NUMERIC(a))                                      \
+        return RES_ERROR;                                   \
+    push(cog_intrinsic(op, a, COG_INT(0)));                 \
+}
+
+#define BINARY_MATH_OP(op) {                                \
+    Cog_value b = pop();                                    \
+    Cog_value a = pop();                                    \
+    if(!IS_NUMERIC(a) || !IS_NUMERIC(b))                    \
+        return RES_ERROR;                                   \
+    push(cog_intrinsic(op, a, b));                          \
+}
+
+#define REDUCE_OP(reduce) {                            \
+    Cog_value a = pop();                               \
+    if(!IS_VECTOR(a))                                  \
+        return RES_ERROR;                              \
+    push(COG_NUMBER(reduce(TO_VECTOR(a))));            \
 }
 
 #define and(p, q) ((p) && (q))
@@ -59,116 +109,460 @@
     push(COG_BOOLEAN(op(p, q)));             \
 }
 
+#ifdef COG_PROFILE
+// Charges the time since the previous instruction started to it, and
+// counts the one about to run
+#define PROFILE_STEP() {                                         \
+    if(prof != NULL) {                                           \
+        uint64_t now = cog_profile_clock();                      \
+        if(prof_prev != NULL) {                                  \
+            prof->cycles[prof_prev - box->code] += now - prof_time; \
+            prof->op_cycles[*prof_prev] += now - prof_time;      \
+        }                                                        \
+        ++prof->counts[env->ip - box->code];                     \
+        ++prof->op_counts[*env->ip];                             \
+        prof_prev = env->ip;                                     \
+        prof_time = now;                                         \
+    }                                                            \
+}
+#else
+#define PROFILE_STEP()
+#endif
+
+// Reading the clock costs about as much as a block of instructions, so
+// the deadline is only checked every so many blocks
+#define DEADLINE_CHECK_INTERVAL 16
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// The block starting at offset, which is usually the one after the last
+// block entered, unless a jump was taken
+static unsigned block_at(const Box *box, unsigned hint, unsigned offset) {
+    if(hint < box->block_count
+            && (hint == 0 ? 0 : box->blocks[hint - 1].end) == offset)
+        return hint;
+    unsigned low = 0, high = box->block_count;
+    while(low < high) {
+        unsigned mid = low + (high - low) / 2;
+        if(box->blocks[mid].end <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Finds the slot for the site operand of the instruction at ip, moving
+// ip past it. Most of the time the site already knows.
+static inline uint32_t global_slot(Cog_env *env, const Box *box) {
+    Box_site *site = &box->sites[env->ip[1] | (env->ip[2] << 8)];
+    env->ip += 2;
+    if(site->table != env->globals->id) {
+        site->slot = cog_globals_slot(env->globals, site->name);
+        site->table = env->globals->id;
+    }
+    return site->slot;
+}
+
 // Public interface
 
 void cog_env_init(Cog_env *env) {
     env->ip = NULL;
+    env->box = NULL;
+    env->block = 0;
+    env->frame_count = 0;
+    env->ret = COG_NONE;
+    env->budget = COG_BUDGET_UNLIMITED;
+    env->deadline = 0;
+    env->slice = 0;
+    cog_arena_init(&env->arena);
+    cog_globals_init(&env->own_globals);
+    env->globals = &env->own_globals;
+#ifdef COG_PROFILE
+    env->profile = NULL;
+#endif
     cog_array_init(&env->stack, 256);
+    cog_array_init(&env->results, COG_ARRAY_INITIAL_CAPACITY);
+    cog_array_init(&env->retired, COG_ARRAY_INITIAL_CAPACITY);
+}
+
+static void release_retired(Cog_env *env) {
+    for(int i = 0; i < env->retired.count; ++i)
+        cog_globals_release(env->retired.data[i]);
+    env->retired.count = 0;
 }
 
 void cog_env_free(Cog_env *env) {
     env->ip = NULL;
+    env->box = NULL;
     cog_array_free(&env->stack);
+    cog_array_free(&env->results);
+    release_retired(env);
+    cog_array_free(&env->retired);
+    cog_arena_free(&env->arena);
+    cog_globals_free(&env->own_globals);
 }
 
-Cog_result execute(Cog_env *env, const Box *box) {
+void cog_env_use_globals(Cog_env *env, Cog_globals *globals) {
+    env->globals = globals;
+}
+
+void cog_env_set_budget(Cog_env *env, uint64_t budget) {
+    env->budget = budget;
+}
+
+void cog_env_set_timeout(Cog_env *env, uint64_t timeout) {
+    env->deadline = timeout == 0 ? 0 : monotonic_ns() + timeout;
+}
+
+void cog_env_set_slice(Cog_env *env, uint64_t slice) {
+    env->slice = slice;
+}
+
+// The interpreter proper, carrying on from env->ip. It runs the
+// instructions up to limit without a second thought; only when limited
+// does it then charge the next block of the box and carry on up to its
+// end. Inlined into both of its call sites, so unlimited executions pay
+// nothing for budgets. Executions that stop before the end keep their
+// place in env.
+static COG_ALWAYS_INLINE Cog_result run(Cog_env *env, const Box *box, bool limited) {
 
     #define push(value) cog_array_push(&env->stack, (value))
     #define pop() cog_array_pop(&env->stack)
     #define end() &box->code[box->count]
 
     uint8_t addr;
-    env->ip = box->code;
-    while(env->ip != end()) {
-        switch(*env->ip) {
-            case OP_NEG: {
-                Cog_value a = pop();
-                if(!IS_NUMBER(a)) return RES_ERROR;
-                double x = TO_DOUBLE(a);
-                push(COG_NUMBER(-x));
-                break;
-            }
-            case OP_ADD:
-                BIN_NUMERIC_OP(COG_NUMBER, add);
-                break;
-            case OP_SUB:
-                BIN_NUMERIC_OP(COG_NUMBER, sub);
-                break;
-            case OP_MUL:
-                BIN_NUMERIC_OP(COG_NUMBER, mul);
-                break;
-            case OP_DIV:
-                BIN_NUMERIC_OP(COG_NUMBER, div);
-                break;
-
-            case OP_NOT: {
-                Cog_value a = pop();
-                bool b = IS_TRUTHY(a);
-                push(COG_BOOLEAN(!b));
-                break;
-            }
-            case OP_EQ: {
-                Cog_value b = pop(), a = pop();
-                bool p = cog_values_equal(a, b);
-                push(COG_BOOLEAN(p));
-                break;
-            }
-            case OP_LT:
-                BIN_NUMERIC_OP(COG_BOOLEAN, less);
-                break;
-            case OP_GT:
-                BIN_NUMERIC_OP(COG_BOOLEAN, greater);
-                break;
-            case OP_AND:
-                BIN_LOGIC_OP(and);
-                break;
-            case OP_OR:
-                BIN_LOGIC_OP(or);
-                break;
-
-            case OP_PSH:
-                addr = *(++env->ip);
-                Cog_value a = cog_array_get(&box->constants, addr);
-                push(a);
-                break;
-            case OP_PSH_TRUE:
-                push(COG_BOOLEAN(true));
-                break;
-            case OP_PSH_FALSE:
-                push(COG_BOOLEAN(false));
-                break;
-            case OP_PSH_NONE:
-                push(COG_NONE);
-                break;
-
-            case OP_RET: {
-                // Print the final result and exit (temporary)
-                Cog_value expr = pop();
-                printf("=> ");
-                cog_value_print(expr);
-                printf("\n");
-                return RES_OK;
-            }
+    uint8_t *limit = limited ? env->ip : end();
+    // where the slots of locals are counted from: the arguments of the
+    // call in progress, if any
+    unsigned base = env->frame_count == 0 ? 0
+        : env->frames[env->frame_count - 1].base;
+    unsigned blocks_entered = 0;
+    uint64_t slice_left = env->slice;
+#ifdef COG_PROFILE
+    Cog_profile *prof = env->profile;
+    if(prof != NULL && prof->box != box)
+        prof = NULL;
+    const uint8_t *prof_prev = NULL;
+    uint64_t prof_time = 0;
+#endif
+    for(;;) {
+        while(env->ip != limit) {
+            PROFILE_STEP();
+            switch(*env->ip) {
+                case OP_NEG: {
+                    Cog_value a = pop();
+                    if(!IS_NUMERIC(a)) return RES_ERROR;
+                    push(cog_number_neg(a));
+                    break;
+                }
+                case OP_ADD: {
+                    Cog_value b = pop(), a = pop(), result;
+                    if(IS_NUMERIC(a) && IS_NUMERIC(b))
+                        push(cog_number_add(a, b));
+                    else if(IS_STRING(a) && IS_STRING(b))
+                        push(cog_string_concat(&env->arena, a, b));
+                    else if(cog_vector_op(&env->arena, VECTOR_ADD, a, b, &result))
+                        push(result);
+                    else
+                        return RES_ERROR;
+                    break;
+                }
+                case OP_SUB:
+                    BIN_NUMERIC_OP(cog_number_sub, VECTOR_SUB);
+                    break;
+                case OP_MUL:
+                    BIN_NUMERIC_OP(cog_number_mul, VECTOR_MUL);
+                    break;
+                case OP_DIV:
+                    BIN_NUMERIC_OP(cog_number_div, VECTOR_DIV);
+                    break;
+
+                case OP_SQRT:
+                    UNARY_MATH_OP(OP_SQRT);
+                    break;
+                case OP_ABS:
+                    UNARY_MATH_OP(OP_ABS);
+                    break;
+                case OP_FLOOR:
+                    UNARY_MATH_OP(OP_FLOOR);
+                    break;
+                case OP_EXP:
+                    UNARY_MATH_OP(OP_EXP);
+                    break;
+                case OP_LOG:
+                    UNARY_MATH_OP(OP_LOG);
+                    break;
+                case OP_MIN:
+                    BINARY_MATH_OP(OP_MIN);
+                    break;
+                case OP_MAX:
+                    BINARY_MATH_OP(OP_MAX);
+                    break;
+                case OP_POW:
+                    BINARY_MATH_OP(OP_POW);
+                    break;
+
+                case OP_VECTOR: {
+                    unsigned length = env->ip[1] | (env->ip[2] << 8);
+                    env->ip += 2;
+                    Cog_vector *vector = cog_vector_new(&env->arena, length);
+                    const Cog_value *elements = &env->stack.data[env->stack.count - length];
+                    for(unsigned i = 0; i < length; ++i) {
+                        if(!IS_NUMERIC(elements[i]))
+                            return RES_ERROR;
+                        vector->elements[i] = AS_DOUBLE(elements[i]);
+                    }
+                    env->stack.count -= length;
+                    push(COG_VECTOR(vector));
+                    break;
+                }
+                case OP_SUM:
+                    REDUCE_OP(cog_vector_sum);
+                    break;
+                case OP_MEAN:
+                    REDUCE_OP(cog_vector_mean);
+                    break;
+                case OP_MIN_OF:
+                    REDUCE_OP(cog_vector_min);
+                    break;
+                case OP_MAX_OF:
+                    REDUCE_OP(cog_vector_max);
+                    break;
+
+                case OP_NOT: {
+                    Cog_value a = pop();
+                    if(IS_VECTOR(a)) {
+                        push(cog_vector_not(&env->arena, a));
+                        break;
+                    }
+                    bool b = IS_TRUTHY(a);
+                    push(COG_BOOLEAN(!b));
+                    break;
+                }
+                case OP_EQ: {
+                    Cog_value b = pop(), a = pop();
+                    // ints, symbols (which are interned) and short strings
+                    // fit in a word: matching on any is not worth a call
+                    bool p;
+                    Cog_value mask;
+                    if(IS_INT(a) && IS_INT(b))
+                        p = TO_INT(a) == TO_INT(b);
+                    else if(IS_SYMBOL(a) && IS_SYMBOL(b))
+                        p = TO_SYMBOL(a) == TO_SYMBOL(b);
+                    else if(a.type == TYPE_SHORT_STRING && b.type == TYPE_SHORT_STRING)
+                        p = cog_short_strings_equal(a, b);
+                    // vectors that go together compare into masks
+                    else if((IS_VECTOR(a) || IS_VECTOR(b))
+                            && cog_vector_op(&env->arena, VECTOR_EQ, a, b, &mask)) {
+                        push(mask);
+                        break;
+                    } else
+                        p = cog_values_equal(a, b);
+                    push(COG_BOOLEAN(p));
+                    break;
+                }
+                case OP_LT:
+                    COMPARE_OP(less, VECTOR_LT);
+                    break;
+                case OP_GT:
+                    COMPARE_OP(greater, VECTOR_GT);
+                    break;
+                case OP_AND:
+                    BIN_LOGIC_OP(and);
+                    break;
+                case OP_OR:
+                    BIN_LOGIC_OP(or);
+                    break;
+
+                case OP_PSH:
+                    addr = *(++env->ip);
+                    Cog_value a = cog_array_get(&box->constants, addr);
+                    push(a);
+                    break;
+                case OP_PSH_LONG: {
+                    int index = env->ip[1] | (env->ip[2] << 8) | (env->ip[3] << 16);
+                    env->ip += 3;
+                    push(cog_array_get(&box->constants, index));
+                    break;
+                }
+                case OP_PSH_TRUE:
+                    push(COG_BOOLEAN(true));
+                    break;
+                case OP_PSH_FALSE:
+                    push(COG_BOOLEAN(false));
+                    break;
+                case OP_PSH_NONE:
+                    push(COG_NONE);
+                    break;
+
+                case OP_GET_LOCAL:
+                    addr = *(++env->ip);
+                    push(cog_array_get(&env->stack, base + addr));
+                    break;
+                case OP_SET_LOCAL: {
+                    addr = *(++env->ip);
+                    Cog_value value = pop();
+                    cog_array_set(&env->stack, base + addr, value);
+                    break;
+                }
+                case OP_GET_GLOBAL: {
+                    uint32_t slot = global_slot(env, box);
+                    if(!cog_globals_defined(env->globals, slot))
+                        return RES_ERROR;
+                    push(cog_globals_get(env->globals, slot));
+                    break;
+                }
+                case OP_SET_GLOBAL: {
+                    uint32_t slot = global_slot(env, box);
+                    Cog_value value = pop();
+                    cog_env_set_global(env, slot, value);
+                    push(value);
+                    break;
+                }
+
+                case OP_JMP:
+                    env->ip += 3 + (env->ip[1] | (env->ip[2] << 8));
+                    // a new block begins where a jump lands
+                    if(limited) limit = env->ip;
+                    continue;
+                case OP_JMP_FALSE: {
+                    Cog_value cond = pop();
+                    if(IS_TRUTHY(cond)) {
+                        env->ip += 2;
+                        break;
+                    }
+                    env->ip += 3 + (env->ip[1] | (env->ip[2] << 8));
+                    if(limited) limit = env->ip;
+                    continue;
+                }
+
+                case OP_CALL: {
+                    if(env->frame_count == COG_FRAMES_MAX)
+                        return RES_ERROR;
+                    // the arguments are already in place
+                    base = env->stack.count - env->ip[3];
+                    env->frames[env->frame_count++] = (Cog_frame) { env->ip + 4, base };
+                    env->ip = &box->code[env->ip[1] | (env->ip[2] << 8)];
+                    // a new block begins where a function does
+                    if(limited) limit = env->ip;
+                    continue;
+                }
+                case OP_TAIL_CALL: {
+                    // the arguments take the place of those of the caller,
+                    // whose frame is reused as it is
+                    unsigned count = env->ip[3];
+                    memmove(&env->stack.data[base], &env->stack.data[env->stack.count - count],
+                            count * sizeof(Cog_value));
+                    env->stack.count = base + count;
+                    env->ip = &box->code[env->ip[1] | (env->ip[2] << 8)];
+                    if(limited) limit = env->ip;
+                    continue;
+                }
+
+                case OP_RET: {
+                    if(env->frame_count == 0) {
+                        // The caller decides what to do with the result
+                        env->ret = pop();
+                        return RES_OK;
+                    }
+                    // the result takes the place of the arguments
+                    Cog_value result = pop();
+                    const Cog_frame *frame = &env->frames[--env->frame_count];
+                    env->stack.count = frame->base;
+                    push(result);
+                    env->ip = frame->ret_ip;
+                    base = env->frame_count == 0 ? 0
+                        : env->frames[env->frame_count - 1].base;
+                    // and a new block where it returns to
+                    if(limited) limit = env->ip;
+                    continue;
+                }
+                case OP_RESULT:
+                    cog_array_push(&env->results, pop());
+                    break;
 
-            default:
-                eprintf("Unimplemented operation\n");
-                return RES_ERROR;
+                default:
+                    eprintf("Unimplemented operation\n");
+                    return RES_ERROR;
+            }
+            ++env->ip;
+        }
+        if(!limited || env->ip == end())
+            return RES_OK;
+        env->block = block_at(box, env->block, env->ip - box->code);
+        if(env->block == box->block_count) {
+            // code that was never split into blocks runs free of charge
+            limit = end();
+            continue;
         }
-        ++env->ip;
+        const Box_block *next = &box->blocks[env->block];
+        if(env->budget < next->cost)
+            return RES_BUDGET_EXHAUSTED;
+        if(env->deadline != 0 && blocks_entered % DEADLINE_CHECK_INTERVAL == 0
+                && monotonic_ns() >= env->deadline)
+            return RES_DEADLINE_PASSED;
+        if(env->slice != 0) {
+            if(slice_left < next->cost && blocks_entered > 0)
+                return RES_SUSPENDED;
+            slice_left = slice_left > next->cost ? slice_left - next->cost : 0;
+        }
+        env->budget -= next->cost;
+        limit = &box->code[next->end];
+        ++env->block;
+        ++blocks_entered;
     }
-    return RES_OK;
 
     #undef push
     #undef pop
     #undef end
 }
 
+static Cog_result carry_on(Cog_env *env, const Box *box) {
+    Cog_result res;
+    if(env->budget == COG_BUDGET_UNLIMITED && env->deadline == 0 && env->slice == 0)
+        res = run(env, box, false);
+    else
+        res = run(env, box, true);
+    env->box = res == RES_OK || res == RES_ERROR ? NULL : box;
+    return res;
+}
+
+void cog_env_clear(Cog_env *env) {
+    // leftovers from a failed execution are of no use, and neither is
+    // anything the last one made
+    env->stack.count = 0;
+    env->results.count = 0;
+    env->frame_count = 0;
+    cog_arena_reset(&env->arena);
+    release_retired(env);
+}
+
+void cog_env_set_global(Cog_env *env, uint32_t slot, Cog_value value) {
+    Cog_value old;
+    if(cog_globals_replace(env->globals, slot, value, &old))
+        cog_array_push(&env->retired, old);
+}
+
+Cog_result execute(Cog_env *env, const Box *box) {
+    env->ip = box->code;
+    env->block = 0;
+    cog_env_clear(env);
+    return carry_on(env, box);
+}
+
+Cog_result resume(Cog_env *env) {
+    if(env->box == NULL)
+        return RES_ERROR;
+    return carry_on(env, env->box);
+}
+
 // Cleaning up local macros
 
-#undef add
-#undef sub
-#undef mul
-#undef div
 #undef less
 #undef greater
 #undef and
@@ -176,3 +570,5 @@ Cog_result execute(Cog_env *env, const Box *box) {
 
 #undef BIN_NUMERIC_OP
 #undef BIN_LOGIC_OP
+#undef COMPARE_OP
+#undef PROFILE_STEP
@@ -0,0 +1,296 @@
+/*
+   Copyright 2022 Eduardo Antunes dos Santos Vieira
+
+   This file is part of cog.
+
+   cog is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation,
+   either version 3 of the License, or (at your option)
+   any later version.
+
+   cog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+   PURPOSE. See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General
+   Public License along with cog. If not, see
+   <https://www.gnu.org/licenses/>.
+*/
+
+// Load generator for cog --serve: keeps a number of requests in flight
+// on each of several connections and reports latency percentiles and
+// throughput
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "server.h"
+
+typedef struct {
+    int fd;
+    long sent;
+    long received;
+    uint64_t *sent_at; // ring of send times, one per request in flight
+    char *in;
+    size_t in_count;
+    size_t in_capacity;
+} Client;
+
+typedef struct {
+    const char *socket_path;
+    const char *expr;
+    int connections;
+    long requests; // per connection
+    int depth;
+    bool precompile;
+} Options;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static void put_u32(char *bytes, uint32_t n) {
+    bytes[0] = (char) (n & 0xFF);
+    bytes[1] = (char) ((n >> 8) & 0xFF);
+    bytes[2] = (char) ((n >> 16) & 0xFF);
+    bytes[3] = (char) ((n >> 24) & 0xFF);
+}
+
+static uint32_t get_u32(const char *bytes) {
+    const uint8_t *b = (const uint8_t*) bytes;
+    return (uint32_t) b[0] | ((uint32_t) b[1] << 8)
+        | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+// Writes a request frame into buffer and returns its size
+static size_t make_frame(char *buffer, Frame_t type, const char *payload, size_t length) {
+    put_u32(buffer, (uint32_t) length + 1);
+    buffer[4] = (char) type;
+    memcpy(buffer + SERVER_HEADER_SIZE, payload, length);
+    return SERVER_HEADER_SIZE + length;
+}
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        eprintf("(!) Could not connect to %s: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool write_all(int fd, const char *data, size_t length) {
+    while(length > 0) {
+        ssize_t n = write(fd, data, length);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Compiles the expression once, up front, and returns its box id
+static bool precompile(const Options *opt, uint32_t *id) {
+    int fd = connect_to(opt->socket_path);
+    if(fd < 0) return false;
+    size_t length = strlen(opt->expr);
+    char *frame = malloc(SERVER_HEADER_SIZE + length);
+    size_t size = make_frame(frame, FRAME_COMPILE, opt->expr, length);
+    bool alright = write_all(fd, frame, size);
+    free(frame);
+
+    char response[SERVER_HEADER_SIZE + 4];
+    size_t got = 0;
+    while(alright && got < sizeof(response)) {
+        ssize_t n = read(fd, response + got, sizeof(response) - got);
+        if(n <= 0) alright = false;
+        else got += n;
+    }
+    close(fd);
+    if(!alright || (uint8_t) response[4] != FRAME_ID) {
+        eprintf("(!) The server would not compile '%s'\n", opt->expr);
+        return false;
+    }
+    *id = get_u32(response + SERVER_HEADER_SIZE);
+    return true;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t *sorted, long count, double p) {
+    long i = (long) (p * (count - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+static void usage(const char *name) {
+    eprintf("usage: %s SOCKET [--connections N] [--requests N] [--depth N]"
+            " [--expr EXPR] [--precompile]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    Options opt = { NULL, "1 + 2 * 3", 4, 100000, 16, false };
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--connections") == 0 && i + 1 < argc)
+            opt.connections = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--requests") == 0 && i + 1 < argc)
+            opt.requests = atol(argv[++i]);
+        else if(strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+            opt.depth = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--expr") == 0 && i + 1 < argc)
+            opt.expr = argv[++i];
+        else if(strcmp(argv[i], "--precompile") == 0)
+            opt.precompile = true;
+        else if(argv[i][0] != '-' && opt.socket_path == NULL)
+            opt.socket_path = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(opt.socket_path == NULL || opt.connections <= 0 || opt.requests <= 0
+            || opt.depth <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Every request is the same, so a whole window of them is prepared
+    // once and sent in slices
+    char *frame;
+    size_t frame_size;
+    if(opt.precompile) {
+        uint32_t id;
+        if(!precompile(&opt, &id)) return 1;
+        char payload[4];
+        put_u32(payload, id);
+        frame = malloc(SERVER_HEADER_SIZE + 4);
+        frame_size = make_frame(frame, FRAME_RUN, payload, 4);
+    } else {
+        size_t length = strlen(opt.expr);
+        frame = malloc(SERVER_HEADER_SIZE + length);
+        frame_size = make_frame(frame, FRAME_EVAL, opt.expr, length);
+    }
+    char *window = malloc(frame_size * opt.depth);
+    for(int i = 0; i < opt.depth; ++i)
+        memcpy(window + i * frame_size, frame, frame_size);
+
+    Client *clients = calloc(opt.connections, sizeof(Client));
+    struct pollfd *fds = calloc(opt.connections, sizeof(struct pollfd));
+    long total = opt.requests * opt.connections;
+    uint64_t *latencies = malloc(total * sizeof(uint64_t));
+    long measured = 0, errors = 0;
+    for(int i = 0; i < opt.connections; ++i) {
+        clients[i].fd = connect_to(opt.socket_path);
+        if(clients[i].fd < 0) return 1;
+        clients[i].sent_at = malloc(opt.depth * sizeof(uint64_t));
+        clients[i].in_capacity = 1 << 16;
+        clients[i].in = malloc(clients[i].in_capacity);
+        fds[i].fd = clients[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    uint64_t start = now_ns();
+    int active = opt.connections;
+    while(active > 0) {
+        // top up every connection to the full depth
+        for(int i = 0; i < opt.connections; ++i) {
+            Client *c = &clients[i];
+            long in_flight = c->sent - c->received;
+            long batch = opt.depth - in_flight;
+            if(batch > opt.requests - c->sent)
+                batch = opt.requests - c->sent;
+            if(batch <= 0) continue;
+            uint64_t t = now_ns();
+            for(long k = 0; k < batch; ++k)
+                c->sent_at[(c->sent + k) % opt.depth] = t;
+            if(!write_all(c->fd, window, batch * frame_size)) {
+                eprintf("(!) Lost the connection: %s\n", strerror(errno));
+                return 1;
+            }
+            c->sent += batch;
+        }
+
+        if(poll(fds, opt.connections, -1) < 0) {
+            if(errno == EINTR) continue;
+            eprintf("(!) poll failed: %s\n", strerror(errno));
+            return 1;
+        }
+        for(int i = 0; i < opt.connections; ++i) {
+            Client *c = &clients[i];
+            if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if(c->in_count == c->in_capacity) {
+                c->in_capacity *= 2;
+                c->in = realloc(c->in, c->in_capacity);
+            }
+            ssize_t n = read(c->fd, c->in + c->in_count, c->in_capacity - c->in_count);
+            if(n <= 0) {
+                eprintf("(!) The server hung up\n");
+                return 1;
+            }
+            c->in_count += n;
+            uint64_t t = now_ns();
+            size_t pos = 0;
+            while(c->in_count - pos >= SERVER_HEADER_SIZE) {
+                uint32_t length = get_u32(c->in + pos);
+                if(c->in_count - pos < 4 + (size_t) length) break;
+                if((uint8_t) c->in[pos + 4] == FRAME_ERROR) ++errors;
+                latencies[measured++] = t - c->sent_at[c->received % opt.depth];
+                ++c->received;
+                pos += 4 + (size_t) length;
+            }
+            memmove(c->in, c->in + pos, c->in_count - pos);
+            c->in_count -= pos;
+            if(c->received == opt.requests) {
+                fds[i].fd = -1; // done; poll ignores negative descriptors
+                --active;
+            }
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    qsort(latencies, measured, sizeof(uint64_t), compare_u64);
+    printf("requests:   %ld (%ld errors)\n", measured, errors);
+    printf("elapsed:    %.3f s\n", elapsed);
+    printf("throughput: %.0f req/s\n", measured / elapsed);
+    printf("latency:    p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+            percentile(latencies, measured, 0.50), percentile(latencies, measured, 0.90),
+            percentile(latencies, measured, 0.99), percentile(latencies, measured, 0.999),
+            latencies[measured - 1] / 1000.0);
+
+    for(int i = 0; i < opt.connections; ++i) {
+        close(clients[i].fd);
+        free(clients[i].sent_at);
+        free(clients[i].in);
+    }
+    free(clients);
+    free(fds);
+    free(latencies);
+    free(window);
+    free(frame);
+    return errors > 0 ? 1 : 0;
+}